@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Disassembles a build of audit/patterns.cpp and checks each audit_* function:
+//  - no fences, acquire loads or release stores;
+//  - no calls, for example into libatomic;
+//  - for chains, every load after the function's first one has an address
+//    register whose value derives from an earlier load.
+//
+// The dataflow is a single forward pass over straight-line code, tracking which
+// registers (and stack slots, for spills) hold values derived from loads. It
+// understands GNU and LLVM objdump output for x86, x86-64, ARM, AArch64, POWER
+// (with r-prefixed register names) and RISC-V.
+//
+// Usage: codegen_audit <objdump> <binary>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum class isa { unknown, x86, arm, ppc, riscv };
+
+struct instruction {
+    std::string address;
+    std::string mnemonic;
+    std::vector<std::string> operands;
+};
+
+struct function {
+    std::string name;
+    std::vector<instruction> instructions;
+};
+
+std::string trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+        return std::string();
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+// Splits at commas which aren't nested in (), [] or {}.
+std::vector<std::string> split_operands(const std::string& text)
+{
+    std::vector<std::string> operands;
+    std::string current;
+    int depth = 0;
+    for (char c : text) {
+        if (c == '(' || c == '[' || c == '{')
+            ++depth;
+        else if (c == ')' || c == ']' || c == '}')
+            --depth;
+        if (c == ',' && !depth) {
+            operands.push_back(trim(current));
+            current.clear();
+        } else
+            current += c;
+    }
+    if (!trim(current).empty())
+        operands.push_back(trim(current));
+    return operands;
+}
+
+bool is_prefix(const std::string& word)
+{
+    static const std::set<std::string> prefixes = { "lock", "rep", "repz", "repe", "repnz", "repne", "cs", "ds", "es", "ss", "fs", "gs", "data16", "addr32", "notrack", "bnd" };
+    return prefixes.count(word);
+}
+
+bool starts_with(const std::string& s, const char* prefix) { return !s.compare(0, std::strlen(prefix), prefix); }
+
+// "  1103:\tmov    0x8(%rax),%rax   # comment" and "  4c: ldr x0, [x0, #8]".
+bool parse_instruction(const std::string& line, instruction& out)
+{
+    static const std::regex pattern("^\\s*([0-9a-f]+):\\s+(.*)$");
+    std::smatch match;
+    if (!std::regex_match(line, match, pattern))
+        return false;
+    std::string text = match[2];
+    // Drop comments and symbolic annotations. '#' starts a comment in AT&T
+    // syntax, which names registers with '%', but an immediate on ARM.
+    std::vector<const char*> comments = { "//", ";", "<" };
+    if (text.find('%') != std::string::npos)
+        comments.push_back("#");
+    for (const char* comment : comments) {
+        size_t at = text.find(comment);
+        if (at != std::string::npos)
+            text = text.substr(0, at);
+    }
+    text = trim(text);
+    if (text.empty() || text == "...")
+        return false;
+
+    out = instruction();
+    out.address = match[1];
+    std::string rest = text;
+    for (;;) {
+        size_t space = rest.find_first_of(" \t");
+        std::string word = rest.substr(0, space);
+        rest = space == std::string::npos ? std::string() : trim(rest.substr(space));
+        if (is_prefix(word) && !rest.empty()) {
+            out.mnemonic += word + ' ';
+            continue;
+        }
+        out.mnemonic += word;
+        break;
+    }
+    out.operands = split_operands(rest);
+    return true;
+}
+
+isa parse(FILE* input, std::vector<function>& functions)
+{
+    static const std::regex header("^[0-9a-f]+ <_?(audit_[A-Za-z0-9_]+)>:$");
+    isa arch = isa::unknown;
+    function* current = nullptr;
+    char buffer[4096];
+    while (std::fgets(buffer, sizeof(buffer), input)) {
+        std::string line = buffer;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (line.find("file format") != std::string::npos) {
+            if (line.find("x86-64") != std::string::npos || line.find("i386") != std::string::npos || line.find("x86") != std::string::npos)
+                arch = isa::x86;
+            else if (line.find("aarch64") != std::string::npos || line.find("arm") != std::string::npos)
+                arch = isa::arm;
+            else if (line.find("powerpc") != std::string::npos || line.find("ppc") != std::string::npos)
+                arch = isa::ppc;
+            else if (line.find("riscv") != std::string::npos)
+                arch = isa::riscv;
+            continue;
+        }
+        std::smatch match;
+        if (std::regex_match(line, match, header)) {
+            functions.push_back(function { match[1], { } });
+            current = &functions.back();
+            continue;
+        }
+        if (trim(line).empty() || line.back() == ':') {
+            current = nullptr;
+            continue;
+        }
+        instruction insn;
+        if (current && parse_instruction(line, insn))
+            current->instructions.push_back(insn);
+    }
+    return arch;
+}
+
+// Register families, so that partial-width names alias: %eax is %rax, w3 is x3.
+std::string x86_register(const std::string& name)
+{
+    static const std::regex gpr("^[re]?([abcd])[xlh]$|^[re]?(si|di|bp|sp)l?$|^(r[0-9]+)[dwb]?$|^[xyz]mm([0-9]+)$|^(rip|eip)$");
+    std::smatch match;
+    if (!std::regex_match(name, match, gpr))
+        return name;
+    for (size_t i = 1; i != 4; ++i) {
+        if (match[i].matched)
+            return match[i];
+    }
+    if (match[4].matched)
+        return "v" + match[4].str();
+    return "ip";
+}
+
+std::string arm_register(const std::string& name)
+{
+    static const std::regex gpr("^[xwr]([0-9]+)$|^[qdshbv]([0-9]+)(\\..*)?$");
+    std::smatch match;
+    if (name == "wsp")
+        return "sp";
+    if (name == "ip")
+        return "12";
+    if (name == "fp")
+        return "r29";
+    if (!std::regex_match(name, match, gpr))
+        return name;
+    if (match[1].matched)
+        return "r" + match[1].str();
+    return "v" + match[2].str();
+}
+
+// r1 is POWER's stack pointer.
+std::string ppc_register(const std::string& name) { return name == "r1" ? "sp" : name; }
+
+std::string riscv_register(const std::string& name)
+{
+    static const std::map<std::string, std::string> aliases = { { "x0", "zero" }, { "x1", "ra" }, { "x2", "sp" }, { "x8", "s0" }, { "fp", "s0" } };
+    auto alias = aliases.find(name);
+    return alias == aliases.end() ? name : alias->second;
+}
+
+std::vector<std::string> registers_in(isa arch, const std::string& operand)
+{
+    static const std::regex x86("%([a-z0-9]+)");
+    static const std::regex arm("\\b([xwrqdshbv][0-9]+(\\.[0-9]*[bhsdq])?|sp|wsp|lr|fp|ip|xzr|wzr)\\b");
+    static const std::regex ppc("\\b((r|f|v|vs)[0-9]+)\\b");
+    static const std::regex riscv("\\b(zero|ra|sp|gp|tp|fp|t[0-6]|s[0-9]|s1[01]|a[0-7]|f[a-z]*[0-9]+|x[0-9]+)\\b");
+    std::vector<std::string> result;
+    switch (arch) {
+    case isa::x86:
+        for (std::sregex_iterator it(operand.begin(), operand.end(), x86), end; it != end; ++it)
+            result.push_back(x86_register((*it)[1]));
+        break;
+    case isa::arm:
+        for (std::sregex_iterator it(operand.begin(), operand.end(), arm), end; it != end; ++it)
+            result.push_back(arm_register((*it)[1]));
+        break;
+    case isa::ppc:
+        for (std::sregex_iterator it(operand.begin(), operand.end(), ppc), end; it != end; ++it)
+            result.push_back(ppc_register((*it)[1]));
+        break;
+    case isa::riscv:
+        for (std::sregex_iterator it(operand.begin(), operand.end(), riscv), end; it != end; ++it)
+            result.push_back(riscv_register((*it)[1]));
+        break;
+    case isa::unknown:
+        break;
+    }
+    return result;
+}
+
+bool is_memory(isa arch, const std::string& operand)
+{
+    if (arch == isa::x86)
+        return operand.find('(') != std::string::npos || (operand.find(':') != std::string::npos && operand[0] == '%');
+    if (arch == isa::arm)
+        return operand.find('[') != std::string::npos;
+    return operand.find('(') != std::string::npos;
+}
+
+std::string address_part(isa arch, const std::string& operand)
+{
+    if (arch != isa::arm) {
+        size_t open = operand.find('(');
+        return open == std::string::npos ? std::string() : operand.substr(open);
+    }
+    size_t open = operand.find('[');
+    if (open == std::string::npos)
+        return std::string();
+    return operand.substr(open, operand.find(']') - open + 1);
+}
+
+bool is_stack(isa arch, const std::string& operand)
+{
+    for (const std::string& reg : registers_in(arch, address_part(arch, operand))) {
+        if (reg == "sp")
+            return true;
+    }
+    return false;
+}
+
+// Instructions which order memory, directly or as a side effect.
+bool is_fence(isa arch, const instruction& insn)
+{
+    const std::string& m = insn.mnemonic;
+    if (arch == isa::x86) {
+        if (m == "mfence" || m == "lfence" || m == "sfence" || starts_with(m, "lock "))
+            return true;
+        if (starts_with(m, "xchg")) {
+            for (const std::string& operand : insn.operands) {
+                if (is_memory(arch, operand))
+                    return true;
+            }
+        }
+        return false;
+    }
+    if (arch == isa::ppc) {
+        static const std::regex ordered("^(sync|lwsync|hwsync|ptesync|isync|eieio|mbar|msync)$");
+        return std::regex_match(m, ordered);
+    }
+    if (arch == isa::riscv) {
+        static const std::regex ordered("^(fence.*|.*\\.aq|.*\\.rl|.*\\.aqrl)$");
+        return std::regex_match(m, ordered);
+    }
+    static const std::regex ordered("^(dmb|dsb|isb|ldar|ldapr|ldaxr|ldaxp|ldaex|stlr|stlxr|stlxp|stlex|cas[a-z]*a[a-z]*|swp[a-z]*a[a-z]*|ld(add|clr|eor|set|smax|smin|umax|umin)[a-z]*a[a-z]*)(\\..*)?[bh]?$");
+    return std::regex_match(m, ordered) || (m == "mcr" && insn.operands.size() > 4 && insn.operands[4] == "c7");
+}
+
+bool ends_flow(isa arch, const instruction& insn)
+{
+    const std::string& m = insn.mnemonic;
+    if (arch == isa::x86)
+        return starts_with(m, "ret") || starts_with(m, "jmp") || m == "ud2";
+    if (arch == isa::ppc)
+        return m == "blr" || m == "b" || m == "bctr" || m == "trap";
+    if (arch == isa::riscv)
+        return m == "ret" || m == "j" || m == "jr" || m == "tail" || m == "ebreak" || m == "unimp";
+    if (m == "ret" || m == "b" || m == "br" || m == "udf" || m == "brk")
+        return true;
+    if (m == "bx" && !insn.operands.empty() && insn.operands[0] == "lr")
+        return true;
+    return (m == "pop" || m == "ldm") && insn.operands.back().find("pc") != std::string::npos;
+}
+
+bool is_call(isa arch, const std::string& m)
+{
+    if (arch == isa::x86)
+        return starts_with(m, "call");
+    if (arch == isa::ppc)
+        return m == "bl" || m == "bctrl" || m == "blrl";
+    if (arch == isa::riscv)
+        return m == "call" || m == "jal" || m == "jalr";
+    return m == "bl" || m == "blr" || m == "blx";
+}
+
+bool is_nop(const std::string& m)
+{
+    return starts_with(m, "nop") || starts_with(m, "cs nop") || starts_with(m, "data16") || m == "endbr64" || m == "endbr32" || m == "hint" || starts_with(m, "pac") || starts_with(m, "bti") || starts_with(m, "aut");
+}
+
+struct state {
+    std::set<std::string> tainted;
+    std::map<std::string, bool> stack;
+    size_t loads { 0 };
+
+    bool any_tainted(const std::vector<std::string>& regs) const
+    {
+        for (const std::string& reg : regs) {
+            if (tainted.count(reg))
+                return true;
+        }
+        return false;
+    }
+
+    void set(const std::string& reg, bool taint)
+    {
+        if (reg == "xzr" || reg == "wzr" || reg == "zero")
+            return;
+        if (taint)
+            tainted.insert(reg);
+        else
+            tainted.erase(reg);
+    }
+};
+
+// Returns an empty string on success, otherwise what's wrong.
+std::string check_load(isa arch, state& s, const instruction& insn, const std::string& operand, bool checkChain)
+{
+    std::vector<std::string> address = registers_in(arch, address_part(arch, operand));
+    bool dependent = s.any_tainted(address);
+    if (checkChain && s.loads && !dependent)
+        return "load at " + insn.address + " (" + insn.mnemonic + ' ' + operand + ") does not depend on an earlier load";
+    ++s.loads;
+    return std::string();
+}
+
+std::string analyze_x86(const function& f, bool checkChain)
+{
+    state s;
+    for (const instruction& insn : f.instructions) {
+        const std::string& m = insn.mnemonic;
+        if (ends_flow(isa::x86, insn))
+            break;
+        if (is_nop(m) || starts_with(m, "j") || starts_with(m, "cmp") || starts_with(m, "test") || m == "push")
+            continue;
+        const std::vector<std::string>& ops = insn.operands;
+        if (ops.empty())
+            continue;
+
+        const std::string& destination = ops.back();
+        bool loaded = false;
+        bool sources = false;
+        for (size_t i = 0; i + 1 < ops.size() || (ops.size() == 1 && i == 0); ++i) {
+            if (is_memory(isa::x86, ops[i]) && m != "lea" && !starts_with(m, "lea")) {
+                if (is_stack(isa::x86, ops[i])) {
+                    sources |= s.stack[ops[i]];
+                    continue;
+                }
+                std::string error = check_load(isa::x86, s, insn, ops[i], checkChain);
+                if (!error.empty())
+                    return error;
+                loaded = true;
+            } else
+                sources |= s.any_tainted(registers_in(isa::x86, ops[i]));
+        }
+        if (ops.size() == 1 && !is_memory(isa::x86, destination)) {
+            if (m == "pop")
+                s.set(x86_register(destination.substr(1)), false);
+            continue;
+        }
+
+        if (is_memory(isa::x86, destination)) {
+            if (is_stack(isa::x86, destination))
+                s.stack[destination] = sources || loaded;
+            continue;
+        }
+        std::vector<std::string> regs = registers_in(isa::x86, destination);
+        if (regs.size() != 1)
+            continue;
+        bool overwrites = starts_with(m, "mov") || starts_with(m, "lea") || starts_with(m, "cvt") || starts_with(m, "pmov") || starts_with(m, "set") || m[0] == 'v' || ops.size() > 2;
+        bool zeroing = ops.size() == 2 && ops[0] == ops[1] && (starts_with(m, "xor") || starts_with(m, "sub") || starts_with(m, "pxor") || starts_with(m, "psub"));
+        bool taint = loaded || sources || (!overwrites && s.tainted.count(regs[0]));
+        s.set(regs[0], taint && !zeroing);
+    }
+    return std::string();
+}
+
+bool is_load(isa arch, const std::string& m)
+{
+    static const std::regex ppc("^(lbz|lhz|lha|lwz|lwa|ld|lq|lfs|lfd|lxv|lxsd|lxssp|lvx|lbarx|lharx|lwarx|ldarx|lhbrx|lwbrx|ldbrx)[a-z0-9]*$");
+    static const std::regex riscv("^(c\\.)?(lb|lbu|lh|lhu|lw|lwu|ld|flh|flw|fld|flq|lr\\..*)$");
+    switch (arch) {
+    case isa::arm:
+        return starts_with(m, "ld");
+    case isa::ppc:
+        return std::regex_match(m, ppc);
+    case isa::riscv:
+        return std::regex_match(m, riscv);
+    default:
+        return false;
+    }
+}
+
+bool is_store(isa arch, const std::string& m)
+{
+    static const std::regex ppc("^(stb|sth|stw|std|stq|stfs|stfd|stxv|stxsd|stxssp|stvx|stbcx|sthcx|stwcx|stdcx|sthbrx|stwbrx|stdbrx)[a-z0-9.]*$");
+    static const std::regex riscv("^(c\\.)?(sb|sh|sw|sd|fsh|fsw|fsd|fsq|sc\\..*)$");
+    switch (arch) {
+    case isa::arm:
+        return starts_with(m, "st");
+    case isa::ppc:
+        return std::regex_match(m, ppc);
+    case isa::riscv:
+        return std::regex_match(m, riscv);
+    default:
+        return false;
+    }
+}
+
+// Compares and conditional branches, which define no register we track.
+bool is_test(isa arch, const std::string& m)
+{
+    switch (arch) {
+    case isa::arm:
+        return starts_with(m, "cmp") || starts_with(m, "cmn") || starts_with(m, "tst") || starts_with(m, "b.") || starts_with(m, "cb") || starts_with(m, "tb") || m == "push";
+    case isa::ppc:
+        return starts_with(m, "cmp") || starts_with(m, "b");
+    case isa::riscv:
+        return starts_with(m, "b");
+    default:
+        return false;
+    }
+}
+
+// ARM, POWER and RISC-V: loads and stores name their value registers first and
+// their address last, and other instructions write their first operand.
+std::string analyze_load_store(isa arch, const function& f, bool checkChain)
+{
+    state s;
+    for (const instruction& insn : f.instructions) {
+        const std::string& m = insn.mnemonic;
+        if (ends_flow(arch, insn))
+            break;
+        const std::vector<std::string>& ops = insn.operands;
+        if (is_nop(m) || ops.empty() || is_test(arch, m))
+            continue;
+
+        bool load = is_load(arch, m);
+        bool store = is_store(arch, m);
+        if (load || store) {
+            std::string memory;
+            std::vector<std::string> values;
+            for (const std::string& operand : ops) {
+                if (is_memory(arch, operand))
+                    memory = operand;
+                else if (memory.empty())
+                    values.push_back(operand);
+            }
+            // POWER's indexed forms add two registers: ldx rT,rA,rB.
+            if (memory.empty() && arch == isa::ppc && ops.size() == 3) {
+                memory = "(" + ops[1] + "," + ops[2] + ")";
+                values.resize(1);
+            }
+            if (memory.empty()) {
+                // A PC-relative literal, whose address doesn't depend on anything.
+                if (load) {
+                    std::string error = check_load(arch, s, insn, std::string(), checkChain);
+                    if (!error.empty())
+                        return error;
+                    for (const std::string& value : values) {
+                        for (const std::string& reg : registers_in(arch, value))
+                            s.set(reg, true);
+                    }
+                }
+                continue;
+            }
+            std::vector<std::string> regs;
+            for (const std::string& value : values) {
+                for (const std::string& reg : registers_in(arch, value))
+                    regs.push_back(reg);
+            }
+            if (is_stack(arch, memory)) {
+                if (store)
+                    s.stack[memory] = s.any_tainted(regs);
+                else {
+                    for (const std::string& reg : regs)
+                        s.set(reg, s.stack[memory]);
+                }
+                continue;
+            }
+            if (store)
+                continue;
+            std::string error = check_load(arch, s, insn, memory, checkChain);
+            if (!error.empty())
+                return error;
+            for (const std::string& reg : regs)
+                s.set(reg, true);
+            continue;
+        }
+
+        std::vector<std::string> destination = registers_in(arch, ops[0]);
+        if (destination.size() != 1)
+            continue;
+        bool taint = false;
+        for (size_t i = 1; i != ops.size(); ++i)
+            taint |= s.any_tainted(registers_in(arch, ops[i]));
+        // These only replace some of the destination's bits.
+        if (starts_with(m, "movk") || starts_with(m, "bfi") || starts_with(m, "bfxil") || starts_with(m, "ins") || starts_with(m, "rldimi") || starts_with(m, "rlwimi"))
+            taint |= s.tainted.count(destination[0]);
+        s.set(destination[0], taint);
+    }
+    return std::string();
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <objdump> <binary>\n";
+        return 1;
+    }
+    std::string command = std::string("\"") + argv[1] + "\" -d --no-show-raw-insn \"" + argv[2] + "\"";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        std::cerr << "Can't run " << command << '\n';
+        return 1;
+    }
+    std::vector<function> functions;
+    isa arch = parse(pipe, functions);
+    if (pclose(pipe)) {
+        std::cerr << command << " failed\n";
+        return 1;
+    }
+    if (arch == isa::unknown) {
+        std::cerr << "Unsupported architecture in " << argv[2] << '\n';
+        return 1;
+    }
+    if (functions.empty()) {
+        std::cerr << "No audit_ functions in " << argv[2] << '\n';
+        return 1;
+    }
+
+    unsigned failures = 0;
+    for (const function& f : functions) {
+        std::string error;
+        for (const instruction& insn : f.instructions) {
+            if (is_fence(arch, insn))
+                error = "ordering instruction at " + insn.address + ": " + insn.mnemonic;
+            else if (is_call(arch, insn.mnemonic))
+                error = "call at " + insn.address;
+            if (!error.empty())
+                break;
+        }
+        // x86 dependencies are constant zeros: TSO already orders the loads.
+        bool chain = starts_with(f.name, "audit_chain_") || (starts_with(f.name, "audit_dependency_") && arch != isa::x86);
+        if (error.empty())
+            error = arch == isa::x86 ? analyze_x86(f, chain) : analyze_load_store(arch, f, chain);
+        if (error.empty())
+            std::cout << "ok    " << f.name << '\n';
+        else {
+            std::cout << "FAIL  " << f.name << ": " << error << '\n';
+            ++failures;
+        }
+    }
+    std::cout << functions.size() - failures << '/' << functions.size() << " patterns passed\n";
+    return failures ? 1 : 0;
+}
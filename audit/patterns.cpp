@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Corpus for the codegen audit: one function per consume pattern, compiled at
+// -O2, -O3 and with LTO, then disassembled and checked by codegen_audit.
+//
+// Function names tell the checker what to expect:
+//  - audit_chain_*: every load after the first reaches its address through
+//    values loaded earlier, so the addresses must depend on those loads'
+//    registers on every architecture.
+//  - audit_dependency_*: later loads are only ordered by a dependency, which
+//    x86 folds to a constant zero. Their addresses must depend on the earlier
+//    loads on architectures whose dependencies are materialized.
+// Neither kind may contain fences or acquire loads.
+//
+// Each function takes its roots as arguments and is straight-line code, which
+// keeps the checker's dataflow simple.
+
+#include "consume.h"
+#include "tagged_ptr.h"
+
+#define AUDIT extern "C" NEVER_INLINE __attribute__((used))
+
+namespace {
+
+struct Node {
+    Node* next;
+    uint64_t key;
+    uint64_t payload[4];
+};
+
+struct alignas(8) Marked {
+    atomic_tagged_ptr<Marked, 1> next;
+    uint64_t key;
+};
+
+} // anonymous namespace
+
+// consume_load(const std::atomic<T*>&), then operator->.
+AUDIT uint64_t audit_chain_atomic_pointer(const std::atomic<Node*>& root)
+{
+    return consume_load(root)->key;
+}
+
+// consume_load(const std::atomic<T>&), then indexing by the loaded value.
+AUDIT uint64_t audit_chain_atomic_value(const std::atomic<uint32_t>& index, uint64_t* table)
+{
+    dependent<uint32_t> i = consume_load(index);
+    return consume_load(table + i.value(), i.dependency()).value();
+}
+
+// consume_load(dependent_ptr<T*>), three hops.
+AUDIT uint64_t audit_chain_dependent_pointer_pointer(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    p = consume_load(dependent_ptr<Node*>(&p->next, p.dependency()));
+    p = consume_load(dependent_ptr<Node*>(&p->next, p.dependency()));
+    return p->key;
+}
+
+// consume_load(dependent_ptr<T>).
+AUDIT uint64_t audit_chain_dependent_pointer_value(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    return consume_load(dependent_ptr<uint64_t>(&p->key, p.dependency())).value();
+}
+
+// consume_load(T**, dependency), three hops.
+AUDIT uint64_t audit_chain_pointer_dependency(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    p = consume_load(&p->next, p.dependency());
+    p = consume_load(&p->next, p.dependency());
+    return p->key;
+}
+
+// dependent_ptr::member and dependent_ptr::field, three hops.
+AUDIT uint64_t audit_chain_member(const std::atomic<Node*>& root)
+{
+    return consume_load(root).member(&Node::next).member(&Node::next).field(&Node::key).value();
+}
+
+// Prefetches between hops neither add fences nor break the chain.
+AUDIT uint64_t audit_chain_prefetch(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    p.prefetch(&Node::payload);
+    return p.prefetch_through(&Node::next).field(&Node::key).value();
+}
+
+// consume_load(T*, dependency) on a field of the loaded node.
+AUDIT uint64_t audit_chain_value_dependency(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    return consume_load(&p->key, p.dependency()).value();
+}
+
+// operator* and operator[] on a dependent_ptr.
+AUDIT uint64_t audit_chain_dereference(const std::atomic<uint64_t*>& root)
+{
+    dependent_ptr<uint64_t> p = consume_load(root);
+    return (*p).value() + p[3].value();
+}
+
+// A tagged pointer: the low bits are stripped from the loaded integer, which
+// still carries its chain.
+AUDIT uint64_t audit_chain_tagged_pointer(const std::atomic<uintptr_t>& root)
+{
+    dependent<uintptr_t> tagged = consume_load(root);
+    dependent_ptr<Node> p(dependent<uintptr_t>(tagged.value() & ~uintptr_t(7), tagged.dependency()));
+    return p->key;
+}
+
+// Pointer tagging through dependency::operator|(uintptr_t) and
+// to_uintptr_t.
+AUDIT uint64_t audit_chain_to_uintptr(const std::atomic<Node*>& root)
+{
+    dependent_ptr<Node> p = consume_load(root);
+    dependent<uintptr_t> bits = p.to_uintptr_t();
+    dependent_ptr<Node> q(dependent<uintptr_t>(bits.dependency() | ((bits.value() | 1) - 1)));
+    return consume_load(&q->next, q.dependency())->key;
+}
+
+// dependent_tagged_ptr: two hops down a list with mark bits.
+AUDIT uint64_t audit_chain_tagged_ptr(const atomic_tagged_ptr<Marked, 1>& root)
+{
+    dependent_tagged_ptr<Marked, 1> p = consume_load(root);
+    dependent_tagged_ptr<Marked, 1> next = consume_load(&p->next, p.dependency());
+    return next->key + next.tag().value();
+}
+
+#if !CPU(X86_64) || defined(__AVX__)
+// A 16-byte versioned pointer, followed through its first word. Without AVX,
+// x86-64 loads these by calling into libatomic, which this audit would reject.
+struct alignas(16) versioned {
+    Node* node;
+    uint64_t version;
+};
+
+AUDIT uint64_t audit_chain_versioned_pointer(const std::atomic<versioned>& root)
+{
+    dependent<versioned> v = consume_load(root);
+    return consume_load(&v.value().node->key, v.dependency()).value() + v.value().version;
+}
+#endif
+
+// Message passing: the data's address doesn't come from the flag.
+AUDIT uint64_t audit_dependency_flag(const std::atomic<uint32_t>& flag, uint64_t* data)
+{
+    dependent<uint32_t> f = consume_load(flag);
+    return consume_load(data, f.dependency()).value();
+}
+
+// A pointer made dependent on an unrelated load.
+AUDIT uint64_t audit_dependency_pointer(const std::atomic<uint32_t>& flag, Node* node)
+{
+    dependent<uint32_t> f = consume_load(flag);
+    dependent_ptr<Node> p(node, f.dependency());
+    return p->key;
+}
+
+// dependency::operator|(dependency).
+AUDIT uint64_t audit_dependency_combine(const std::atomic<uint32_t>& a, const std::atomic<uint32_t>& b, uint64_t* data)
+{
+    dependent<uint32_t> x = consume_load(a);
+    dependent<uint32_t> y = consume_load(b);
+    return consume_load(data, x.dependency() | y.dependency()).value();
+}
+
+// operator|(dependency, dependent_ptr) and operator|(dependent_ptr, dependency).
+AUDIT uint64_t audit_dependency_combine_pointer(const std::atomic<Node*>& a, const std::atomic<uint32_t>& b, uint64_t* data)
+{
+    dependent_ptr<Node> p = consume_load(a);
+    dependent<uint32_t> y = consume_load(b);
+    uint64_t sum = consume_load(data, y.dependency() | p).value();
+    return sum + consume_load(data + 1, p | y.dependency()).value();
+}
+
+// Pointer tagging with operator|(dependency, uintptr_t) and
+// operator|(intptr_t, dependency).
+AUDIT uint64_t audit_dependency_tagging(const std::atomic<uint32_t>& flag, Node* node)
+{
+    dependent<uint32_t> f = consume_load(flag);
+    dependent_ptr<Node> p(dependent<uintptr_t>(f.dependency() | reinterpret_cast<uintptr_t>(node)));
+    dependent_ptr<Node> q(dependent<intptr_t>(reinterpret_cast<intptr_t>(node + 1) | f.dependency()));
+    return p->key + q->key;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef bench_h
+#define bench_h
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "helpers.h"
+
+#if OS(LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if CPU(X86) || CPU(X86_64)
+#include <x86intrin.h>
+#endif
+
+// Shared plumbing for the benchmarks in this directory. Nothing here is part of
+// the consume API.
+
+namespace bench {
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fixed-frequency cycle counter: TSC on x86, the virtual counter on ARM64.
+// Neither is the core clock, but both are cheap and monotonic, which is what
+// relative comparisons need.
+inline uint64_t cycles() {
+#if CPU(X86) || CPU(X86_64)
+    return __rdtsc();
+#elif CPU(ARM64)
+    uint64_t value;
+    asm volatile("mrs %[value], cntvct_el0" : [value] "=r"(value));
+    return value;
+#else
+    return now_ns();
+#endif
+}
+
+// Ratio of cycles() to now_ns(), measured once.
+inline double cycles_per_ns() {
+    static const double ratio = [] {
+        uint64_t startNs = now_ns();
+        uint64_t startCycles = cycles();
+        while (now_ns() - startNs < 10 * 1000 * 1000) { }
+        return static_cast<double>(cycles() - startCycles) / (now_ns() - startNs);
+    }();
+    return ratio;
+}
+
+// Pins the calling thread, wrapping around the available CPUs. Returns false
+// where pinning isn't supported.
+inline bool pin_to_cpu(unsigned cpu) {
+#if OS(LINUX)
+    unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % cpus, &set);
+    return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Keep the compiler from discarding a computed value.
+template<typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline uint64_t xorshift(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Runs body(index, stop) on the given number of pinned threads for durationMs,
+// where body loops until stop becomes true and returns how many operations it
+// performed. Returns the aggregate in millions of operations per second.
+template<typename Body>
+inline double run_threads(size_t threads, uint64_t durationMs, Body body) {
+    std::atomic<bool> go { false };
+    std::atomic<bool> stop { false };
+    std::atomic<size_t> ready { 0 };
+    std::atomic<uint64_t> totalOps { 0 };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t != threads; ++t) {
+        workers.emplace_back([&, t] () {
+                pin_to_cpu(t);
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                totalOps.fetch_add(body(t, stop));
+            });
+    }
+    while (ready.load() != threads) { }
+    uint64_t start = now_ns();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    stop.store(true);
+    uint64_t elapsed = now_ns() - start;
+    for (std::thread& worker : workers)
+        worker.join();
+    return totalOps.load() * 1000.0 / elapsed;
+}
+
+// Powers of two up to the number of CPUs, plus that number.
+inline std::vector<size_t> default_thread_counts() {
+    std::vector<size_t> counts;
+    size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t n = 1; n < cpus; n *= 2)
+        counts.push_back(n);
+    counts.push_back(cpus);
+    return counts;
+}
+
+// Parses sizes such as "32K", "1M" or "256M".
+inline size_t parse_size(const char* text) {
+    char* end;
+    size_t value = std::strtoull(text, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': value <<= 10; // Fall through.
+    case 'm': case 'M': value <<= 10; // Fall through.
+    case 'k': case 'K': value <<= 10; break;
+    default: break;
+    }
+    return value;
+}
+
+// Parses comma-separated sizes such as "16K,256K,8M".
+inline std::vector<size_t> parse_list(const char* text) {
+    std::vector<size_t> values;
+    std::string copy(text);
+    for (char* item = std::strtok(&copy[0], ","); item; item = std::strtok(nullptr, ","))
+        values.push_back(parse_size(item));
+    return values;
+}
+
+inline std::string format_size(size_t bytes) {
+    const char* suffix = "";
+    for (const char* s : { "K", "M", "G" }) {
+        if (bytes < 1024 || bytes % 1024)
+            break;
+        bytes /= 1024;
+        suffix = s;
+    }
+    return std::to_string(bytes) + suffix;
+}
+
+// A random cyclic permutation: following order[i] -> order[i + 1] visits every
+// element once before wrapping around, and defeats hardware prefetchers.
+inline std::vector<size_t> random_cycle(size_t count, uint64_t seed = 42) {
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i != count; ++i)
+        order[i] = i;
+    std::mt19937_64 rng(seed);
+    std::shuffle(order.begin(), order.end(), rng);
+    return order;
+}
+
+// Log-linear histogram: exact below 16, then 16 sub-buckets per power of two,
+// for at most 1/16 relative error on reported percentiles.
+class latency_histogram {
+public:
+    void record(uint64_t value) { ++buckets[index(value)]; ++total; }
+
+    void merge(const latency_histogram& other) {
+        for (size_t i = 0; i != buckets.size(); ++i)
+            buckets[i] += other.buckets[i];
+        total += other.total;
+    }
+
+    uint64_t count() const { return total; }
+
+    // Lower bound of the bucket containing the given quantile, in [0, 1].
+    uint64_t percentile(double quantile) const {
+        uint64_t rank = static_cast<uint64_t>(quantile * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i != buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen > rank)
+                return lower_bound(i);
+        }
+        return total ? lower_bound(buckets.size() - 1) : 0;
+    }
+
+private:
+    static constexpr unsigned sub_bits = 4;
+    static constexpr uint64_t sub_count = 1 << sub_bits;
+
+    static size_t index(uint64_t value) {
+        if (value < sub_count)
+            return value;
+        unsigned shift = 63 - count_leading_zeros(value) - sub_bits;
+        return (shift + 1) * sub_count + ((value >> shift) - sub_count);
+    }
+
+    static uint64_t lower_bound(size_t index) {
+        if (index < sub_count)
+            return index;
+        unsigned shift = index / sub_count - 1;
+        return (sub_count + index % sub_count) << shift;
+    }
+
+    std::array<uint64_t, 64 * sub_count> buckets {};
+    uint64_t total { 0 };
+};
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Broadcast ring throughput: one pinned producer publishes into a
+// broadcast_ring while N pinned consumers each read every message, with
+// consumers either consuming the sequence (broadcast_ring) or loading it with
+// acquire (a copy of the same ring). Consumers read in batches of up to
+// --batch messages per sequence load. Reports delivered messages per second,
+// summed over consumers and per consumer.
+//
+// Usage: bench_broadcast_ring [--consumers 1,2,4] [--batch 1,16] [--duration-ms MS]
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "bench/bench.h"
+#include "broadcast_ring.h"
+
+namespace {
+
+constexpr size_t capacity = 1024;
+
+struct message {
+    uint64_t seq;
+    uint64_t payload[3];
+};
+
+// Same layout and gating as broadcast_ring, with an acquire load of the
+// sequence and no dependency.
+class acquire_ring {
+public:
+    explicit acquire_ring(size_t maxConsumers) : cursors(new cursor[maxConsumers]), maxConsumers(maxConsumers) {}
+
+    bool try_publish(const message& value)
+    {
+        uint64_t seq = next;
+        if (seq - gate >= capacity) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            gate = seq;
+            for (size_t i = 0; i != maxConsumers; ++i)
+                gate = std::min(gate, cursors[i].position.load(std::memory_order_acquire));
+            if (seq - gate >= capacity)
+                return false;
+        }
+        slots[seq & (capacity - 1)].value = value;
+        next = seq + 1;
+        head.store(seq + 1, std::memory_order_release);
+        return true;
+    }
+
+    class consumer {
+    public:
+        explicit consumer(acquire_ring& ring)
+            : ring(ring)
+        {
+            std::lock_guard<std::mutex> locker(ring.cursorsLock);
+            for (index = 0; ring.cursors[index].claimed; ++index) { }
+            ring.cursors[index].claimed = true;
+            ring.cursors[index].position.store(ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            position = ring.head.load(std::memory_order_relaxed);
+            ring.cursors[index].position.store(position, std::memory_order_relaxed);
+        }
+
+        ~consumer()
+        {
+            std::lock_guard<std::mutex> locker(ring.cursorsLock);
+            ring.cursors[index].position.store(UINT64_MAX, std::memory_order_release);
+            ring.cursors[index].claimed = false;
+        }
+
+        template<typename Visitor>
+        size_t read(Visitor&& visit, size_t max)
+        {
+            uint64_t seq = ring.head.load(std::memory_order_acquire);
+            size_t count = std::min<size_t>(seq - position, max);
+            if (!count)
+                return 0;
+            for (size_t i = 0; i != count; ++i)
+                visit(static_cast<const message&>(ring.slots[(position + i) & (capacity - 1)].value));
+            position += count;
+            ring.cursors[index].position.store(position, std::memory_order_release);
+            return count;
+        }
+
+    private:
+        acquire_ring& ring;
+        size_t index;
+        uint64_t position;
+    };
+
+private:
+    struct alignas(CACHE_LINE_SIZE) slot {
+        message value;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) cursor {
+        std::atomic<uint64_t> position { UINT64_MAX };
+        bool claimed { false };
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head { 0 };
+    alignas(CACHE_LINE_SIZE) uint64_t next { 0 };
+    uint64_t gate { 0 };
+    std::unique_ptr<cursor[]> cursors;
+    size_t maxConsumers;
+    std::mutex cursorsLock;
+    slot slots[capacity];
+};
+
+// Index 0 produces; the others consume and count deliveries.
+template<typename Ring>
+NEVER_INLINE double run(size_t consumers, size_t batch, uint64_t durationMs) {
+    std::unique_ptr<Ring> ring(new Ring(consumers));
+    std::atomic<size_t> subscribed = 0;
+    return bench::run_threads(consumers + 1, durationMs, [&] (size_t index, const std::atomic<bool>& stop) -> uint64_t {
+            if (!index) {
+                while (subscribed.load() != consumers)
+                    std::this_thread::yield();
+                message m { 0, { 1, 2, 3 } };
+                for (unsigned spins = 0; !stop.load(std::memory_order_relaxed); ) {
+                    if (ring->try_publish(m)) {
+                        ++m.seq;
+                        spins = 0;
+                    } else if (++spins > 128)
+                        std::this_thread::yield();
+                }
+                return 0;
+            }
+            typename Ring::consumer consumer(*ring);
+            ++subscribed;
+            uint64_t delivered = 0;
+            uint64_t sum = 0;
+            for (unsigned spins = 0; !stop.load(std::memory_order_relaxed); ) {
+                size_t count = consumer.read([&] (const message& m) { sum += m.seq + m.payload[0]; }, batch);
+                delivered += count;
+                if (count)
+                    spins = 0;
+                else if (++spins > 128)
+                    std::this_thread::yield();
+            }
+            bench::do_not_optimize(sum);
+            return delivered;
+        });
+}
+
+void report(const char* name, size_t consumers, size_t batch, double mmsgs) {
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::setw(10) << consumers << std::setw(8) << batch << std::fixed << std::setprecision(2)
+              << std::setw(14) << mmsgs << std::setw(14) << mmsgs / consumers << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::vector<size_t> consumers;
+    std::vector<size_t> batches = { 1, 16 };
+    uint64_t durationMs = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--consumers"))
+            consumers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--batch"))
+            batches = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (consumers.empty()) {
+        // One CPU goes to the producer.
+        for (size_t n : bench::default_thread_counts())
+            consumers.push_back(n > 1 ? n - 1 : 1);
+        consumers.erase(std::unique(consumers.begin(), consumers.end()), consumers.end());
+    }
+
+    std::cout << std::left << std::setw(16) << "# ring" << std::right
+              << std::setw(10) << "consumers" << std::setw(8) << "batch"
+              << std::setw(14) << "Mmsg/s" << std::setw(14) << "Mmsg/s/cons" << '\n';
+    for (size_t consumerCount : consumers) {
+        for (size_t batch : batches) {
+            batch = std::max<size_t>(batch, 1);
+            report("consume", consumerCount, batch, run<broadcast_ring<message, capacity>>(consumerCount, batch, durationMs));
+            report("acquire", consumerCount, batch, run<acquire_ring>(consumerCount, batch, durationMs));
+        }
+    }
+    return 0;
+}
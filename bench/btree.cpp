@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// B+tree reads: consume_btree, with epoch and QSBR read sections, against
+// std::map behind a reader-writer lock. Reader threads either look up random
+// keys or scan random ranges of --range entries.
+//
+// With --write-interval-us, a writer replaces a random key's value at that
+// interval during each run: consume_btree copies the leaf's path and publishes
+// it, and std::map takes its lock exclusively.
+//
+// Usage: bench_btree [--keys N] [--range R] [--readers 1,2,4] [--duration-ms MS]
+//                    [--write-interval-us US]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <shared_mutex>
+#include <thread>
+#include "bench/bench.h"
+#include "btree.h"
+
+namespace {
+
+class rwlock_map {
+public:
+    void insert(uint64_t key, uint64_t value)
+    {
+        std::unique_lock<std::shared_mutex> locker(lock);
+        map.emplace(key, value);
+    }
+
+    bool replace(uint64_t key, uint64_t value)
+    {
+        std::unique_lock<std::shared_mutex> locker(lock);
+        auto found = map.find(key);
+        if (found == map.end())
+            return false;
+        found->second = value;
+        return true;
+    }
+
+    bool find(uint64_t key, uint64_t& out) const
+    {
+        std::shared_lock<std::shared_mutex> locker(lock);
+        auto found = map.find(key);
+        if (found == map.end())
+            return false;
+        out = found->second;
+        return true;
+    }
+
+    template<typename Visitor>
+    size_t scan(uint64_t low, uint64_t high, Visitor&& visit) const
+    {
+        std::shared_lock<std::shared_mutex> locker(lock);
+        size_t visited = 0;
+        for (auto it = map.lower_bound(low); it != map.end() && it->first < high; ++it, ++visited)
+            visit(it->first, it->second);
+        return visited;
+    }
+
+private:
+    std::map<uint64_t, uint64_t> map;
+    mutable std::shared_mutex lock;
+};
+
+template<typename Map>
+struct is_qsbr : std::false_type { };
+
+template<typename Key, typename Value, typename Compare>
+struct is_qsbr<consume_btree<Key, Value, Compare, rcu_qsbr>> : std::true_type { };
+
+template<typename Map>
+NEVER_INLINE double run(Map& map, size_t keys, size_t range, size_t readerCount, uint64_t durationMs, uint64_t writeIntervalUs) {
+    std::atomic<bool> stopWriter = false;
+    std::thread writer;
+    if (writeIntervalUs) {
+        writer = std::thread([&] () {
+                uint64_t rng = 0xbf58476d1ce4e5b9ull;
+                while (!stopWriter.load(std::memory_order_relaxed)) {
+                    uint64_t key = bench::xorshift(rng) % keys;
+                    map.replace(key, key);
+                    std::this_thread::sleep_for(std::chrono::microseconds(writeIntervalUs));
+                }
+            });
+    }
+    double mops = bench::run_threads(readerCount, durationMs, [&] (size_t r, const std::atomic<bool>& stop) {
+            uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+            uint64_t ops = 0;
+            uint64_t sum = 0;
+            if (is_qsbr<Map>::value)
+                rcu_register_thread<rcu_qsbr>();
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t key = bench::xorshift(rng) % keys;
+                if (!range) {
+                    uint64_t value = 0;
+                    if (UNLIKELY(!map.find(key, value)))
+                        abort();
+                    sum += value;
+                } else
+                    map.scan(key, key + range, [&] (uint64_t, uint64_t value) { sum += value; });
+                ++ops;
+                if (is_qsbr<Map>::value && !(ops % 1024))
+                    rcu_quiescent_state();
+            }
+            if (is_qsbr<Map>::value)
+                rcu_unregister_thread<rcu_qsbr>();
+            bench::do_not_optimize(sum);
+            return ops;
+        });
+    stopWriter = true;
+    if (writer.joinable())
+        writer.join();
+    return mops;
+}
+
+void report(const char* name, const char* operation, size_t readers, double mops) {
+    std::cout << std::left << std::setw(16) << name << std::setw(10) << operation << std::right
+              << std::setw(8) << readers << std::fixed << std::setprecision(2)
+              << std::setw(12) << mops << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t keys = 1 << 20;
+    size_t range = 100;
+    std::vector<size_t> readers;
+    uint64_t durationMs = 200;
+    uint64_t writeIntervalUs = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--keys"))
+            keys = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--range"))
+            range = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--readers"))
+            readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--write-interval-us"))
+            writeIntervalUs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (readers.empty())
+        readers = bench::default_thread_counts();
+
+    consume_btree<uint64_t, uint64_t> epochTree;
+    consume_btree<uint64_t, uint64_t, std::less<uint64_t>, rcu_qsbr> qsbrTree;
+    rwlock_map rwlockMap;
+    std::vector<size_t> order = bench::random_cycle(keys);
+    for (size_t key : order) {
+        epochTree.insert(key, key);
+        qsbrTree.insert(key, key);
+        rwlockMap.insert(key, key);
+    }
+
+    std::cout << std::left << std::setw(16) << "# map" << std::setw(10) << "op" << std::right
+              << std::setw(8) << "readers" << std::setw(12) << "Mops/s" << '\n';
+    std::string scan = "scan" + std::to_string(range);
+    for (size_t readerCount : readers) {
+        for (size_t r : { size_t(0), range }) {
+            const char* operation = r ? scan.c_str() : "lookup";
+            report("consume/epoch", operation, readerCount, run(epochTree, keys, r, readerCount, durationMs, writeIntervalUs));
+            report("consume/qsbr", operation, readerCount, run(qsbrTree, keys, r, readerCount, durationMs, writeIntervalUs));
+            report("rwlock/std::map", operation, readerCount, run(rwlockMap, keys, r, readerCount, durationMs, writeIntervalUs));
+        }
+    }
+    return 0;
+}
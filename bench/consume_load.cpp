@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Single-thread pointer chasing: consume_load chains against the same chains
+// loaded with acquire, consume, seq_cst and relaxed (the unordered floor).
+//
+// Each traversal starts with a consume_load from a std::atomic<Node*> and then
+// follows `depth - 1` dependent hops, so the depth controls how much of the
+// chain is carried by dependencies rather than by a fresh load. Nodes occupy a
+// cache line each and are linked in a random cycle, so the working-set size
+// selects which level of the memory hierarchy services the loads.
+//
+// Usage: bench_consume_load [--hops N] [--sizes 16K,256K,8M,256M] [--depths 1,4,16,64]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+struct alignas(CACHE_LINE_SIZE) Node {
+    Node* next;
+};
+
+inline const std::atomic<Node*>& as_atomic(Node* const& field) {
+    static_assert(sizeof(Node*) == sizeof(std::atomic<Node*>), "The cast below relies on this fact");
+    return reinterpret_cast<const std::atomic<Node*>&>(field);
+}
+
+// consume_load(dependent_ptr<T*>): the next field's address is itself a
+// dependent_ptr built from the current node.
+NEVER_INLINE Node* chase_dependent_ptr(Node* cur, size_t traversals, size_t depth) {
+    for (size_t t = 0; t != traversals; ++t) {
+        dependent_ptr<Node> p = consume_load(as_atomic(cur->next));
+        for (size_t d = 1; d < depth; ++d)
+            p = consume_load(dependent_ptr<Node*>(&p->next, p.dependency()));
+        cur = p.value();
+    }
+    return cur;
+}
+
+// consume_load(T**, dependency): the dependency is passed alongside a raw
+// address.
+NEVER_INLINE Node* chase_pointer_dependency(Node* cur, size_t traversals, size_t depth) {
+    for (size_t t = 0; t != traversals; ++t) {
+        dependent_ptr<Node> p = consume_load(as_atomic(cur->next));
+        for (size_t d = 1; d < depth; ++d)
+            p = consume_load(&p->next, p.dependency());
+        cur = p.value();
+    }
+    return cur;
+}
+
+// dependent_ptr::member: the projection carries the chain by itself.
+NEVER_INLINE Node* chase_member(Node* cur, size_t traversals, size_t depth) {
+    for (size_t t = 0; t != traversals; ++t) {
+        dependent_ptr<Node> p = consume_load(as_atomic(cur->next));
+        for (size_t d = 1; d < depth; ++d)
+            p = p.member(&Node::next);
+        cur = p.value();
+    }
+    return cur;
+}
+
+template<std::memory_order order>
+NEVER_INLINE Node* chase_ordered(Node* cur, size_t traversals, size_t depth) {
+    for (size_t t = 0; t != traversals; ++t) {
+        for (size_t d = 0; d != depth; ++d)
+            cur = as_atomic(cur->next).load(order);
+    }
+    return cur;
+}
+
+typedef Node* (*Chase)(Node*, size_t, size_t);
+
+struct Variant {
+    const char* name;
+    Chase chase;
+};
+
+const Variant variants[] = {
+    { "consume_load(dependent_ptr<T*>)", chase_dependent_ptr },
+    { "consume_load(T**, dependency)", chase_pointer_dependency },
+    { "dependent_ptr::member", chase_member },
+    { "load(acquire)", chase_ordered<std::memory_order_acquire> },
+    { "load(consume)", chase_ordered<std::memory_order_consume> },
+    { "load(seq_cst)", chase_ordered<std::memory_order_seq_cst> },
+    { "load(relaxed)", chase_ordered<std::memory_order_relaxed> },
+};
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t hops = 1 << 22;
+    std::vector<size_t> sizes = { 16 << 10, 256 << 10, 8 << 20, 256 << 20 };
+    std::vector<size_t> depths = { 1, 4, 16, 64 };
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--hops"))
+            hops = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--sizes"))
+            sizes = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--depths"))
+            depths = bench::parse_list(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(34) << "# variant" << std::right
+              << std::setw(8) << "ws" << std::setw(8) << "depth"
+              << std::setw(10) << "ns/op" << std::setw(12) << "cycles/op" << '\n';
+
+    for (size_t size : sizes) {
+        size_t count = std::max<size_t>(size / sizeof(Node), 2);
+        std::unique_ptr<Node[]> nodes(new Node[count]);
+        std::vector<size_t> order = bench::random_cycle(count);
+        for (size_t i = 0; i != count; ++i)
+            nodes[order[i]].next = &nodes[order[(i + 1) % count]];
+
+        for (size_t depth : depths) {
+            size_t traversals = std::max<size_t>(hops / depth, 1);
+            for (const Variant& variant : variants) {
+                Node* cur = &nodes[0];
+                // Warm up caches and TLBs with one full lap.
+                cur = variant.chase(cur, std::max<size_t>(count / depth, 1), depth);
+
+                uint64_t startNs = bench::now_ns();
+                uint64_t startCycles = bench::cycles();
+                cur = variant.chase(cur, traversals, depth);
+                uint64_t endCycles = bench::cycles();
+                uint64_t endNs = bench::now_ns();
+                bench::do_not_optimize(cur);
+
+                double ops = static_cast<double>(traversals * depth);
+                std::cout << std::left << std::setw(34) << variant.name << std::right
+                          << std::setw(8) << bench::format_size(size) << std::setw(8) << depth
+                          << std::fixed << std::setprecision(2)
+                          << std::setw(10) << (endNs - startNs) / ops
+                          << std::setw(12) << (endCycles - startCycles) / ops << '\n';
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Codegen of the opaque dependent<T> against the representation it replaced,
+// a struct holding the value next to an eagerly created dependency.
+//
+// read_*: the vector-reading loop from consume.cpp, indexing a consumed
+// dependent_ptr and summing the elements. The old representation creates a
+// dependency for every element, which keeps an extra register live and, being
+// an asm statement, keeps the loop from vectorizing.
+//
+// chase_*: a chain of indices through a table, passing the dependent value to
+// and from a non-inlined step, where the old representation needs two
+// registers (or the stack) and the opaque one needs one.
+//
+// Inspect the loops with:
+//   objdump -d --no-show-raw-insn -C bench_dependent | less   (look for read_ and chase_)
+//
+// Usage: bench_dependent [--elements N] [--repeat R]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+// The layout dependent<T> used to have.
+template<typename T>
+struct pair_dependent {
+    T value;
+    dependency dep;
+
+    pair_dependent(T value) : value(value), dep(value) {}
+    pair_dependent(T value, dependency dep) : value(value), dep(dep) {}
+};
+
+NEVER_INLINE uint64_t read_opaque(dependent_ptr<uint32_t> vec, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i != count; ++i)
+        sum += vec[i].value();
+    return sum;
+}
+
+NEVER_INLINE uint64_t read_pair(dependent_ptr<uint32_t> vec, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i != count; ++i)
+        sum += pair_dependent<uint32_t>(vec.value()[i]).value;
+    return sum;
+}
+
+NEVER_INLINE dependent<uint64_t> step_opaque(uint64_t* table, dependent<uint64_t> index) {
+    return consume_load(&table[index.value()], index.dependency());
+}
+
+NEVER_INLINE pair_dependent<uint64_t> step_pair(uint64_t* table, pair_dependent<uint64_t> index) {
+    dependent<uint64_t> next = consume_load(&table[index.value], index.dep);
+    return pair_dependent<uint64_t>(next.value());
+}
+
+NEVER_INLINE uint64_t chase_opaque(uint64_t* table, size_t hops) {
+    dependent<uint64_t> index(0);
+    for (size_t h = 0; h != hops; ++h)
+        index = step_opaque(table, index);
+    return index.value();
+}
+
+NEVER_INLINE uint64_t chase_pair(uint64_t* table, size_t hops) {
+    pair_dependent<uint64_t> index(0);
+    for (size_t h = 0; h != hops; ++h)
+        index = step_pair(table, index);
+    return index.value;
+}
+
+template<typename Body>
+double ns_per(size_t operations, size_t repeat, Body body) {
+    uint64_t sum = body();
+    uint64_t start = bench::now_ns();
+    for (size_t r = 0; r != repeat; ++r)
+        sum += body();
+    uint64_t elapsed = bench::now_ns() - start;
+    bench::do_not_optimize(sum);
+    return static_cast<double>(elapsed) / (operations * repeat);
+}
+
+void report(const char* name, size_t bytes, double ns) {
+    std::cout << std::left << std::setw(16) << name << std::right << std::setw(8) << bytes
+              << std::fixed << std::setprecision(3) << std::setw(12) << ns << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t elements = 1 << 14;
+    size_t repeat = 1000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--elements"))
+            elements = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--repeat"))
+            repeat = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::unique_ptr<uint32_t[]> vec(new uint32_t[elements]);
+    for (size_t i = 0; i != elements; ++i)
+        vec[i] = static_cast<uint32_t>(i * 2);
+    std::unique_ptr<uint64_t[]> table(new uint64_t[elements]);
+    std::vector<size_t> order = bench::random_cycle(elements);
+    for (size_t i = 0; i != elements; ++i)
+        table[order[i]] = order[(i + 1) % elements];
+    std::atomic<uint32_t*> published(vec.get());
+
+    std::cout << std::left << std::setw(16) << "# loop" << std::right << std::setw(8) << "sizeof"
+              << std::setw(12) << "ns/elem" << '\n';
+    report("read_opaque", sizeof(dependent<uint32_t>), ns_per(elements, repeat, [&] { return read_opaque(consume_load(published), elements); }));
+    report("read_pair", sizeof(pair_dependent<uint32_t>), ns_per(elements, repeat, [&] { return read_pair(consume_load(published), elements); }));
+    report("chase_opaque", sizeof(dependent<uint64_t>), ns_per(elements, repeat, [&] { return chase_opaque(table.get(), elements); }));
+    report("chase_pair", sizeof(pair_dependent<uint64_t>), ns_per(elements, repeat, [&] { return chase_pair(table.get(), elements); }));
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Snapshot copies and key comparisons out of a published buffer:
+// dependent_memcpy and dependent_memcmp against a per-element operator[] loop
+// through the consumed dependent_ptr, and against an acquire load followed by
+// the library memcpy or memcmp. Comparisons are between equal buffers, the
+// worst case for a lookup hit. Reports ns per operation and GB/s.
+//
+// Usage: bench_dependent_memory [--sizes 16,64,256,1K,4K,64K] [--bytes-per-size B]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "bench/bench.h"
+#include "dependent_memory.h"
+
+namespace {
+
+typedef const std::atomic<const uint8_t*> published;
+
+NEVER_INLINE uint64_t copy_dependent(published& src, uint8_t* dst, size_t bytes) {
+    dependent_memcpy(dst, consume_load(src), bytes);
+    return dst[bytes - 1];
+}
+
+NEVER_INLINE uint64_t copy_indexed(published& src, uint8_t* dst, size_t bytes) {
+    dependent_ptr<const uint8_t> p = consume_load(src);
+    for (size_t i = 0; i != bytes; ++i)
+        dst[i] = p[i].value();
+    return dst[bytes - 1];
+}
+
+NEVER_INLINE uint64_t copy_acquire(published& src, uint8_t* dst, size_t bytes) {
+    std::memcpy(dst, src.load(std::memory_order_acquire), bytes);
+    return dst[bytes - 1];
+}
+
+NEVER_INLINE uint64_t compare_dependent(published& src, uint8_t* key, size_t bytes) {
+    return dependent_memcmp(consume_load(src), key, bytes);
+}
+
+NEVER_INLINE uint64_t compare_indexed(published& src, uint8_t* key, size_t bytes) {
+    dependent_ptr<const uint8_t> p = consume_load(src);
+    for (size_t i = 0; i != bytes; ++i) {
+        uint8_t byte = p[i].value();
+        if (byte != key[i])
+            return byte < key[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+NEVER_INLINE uint64_t compare_acquire(published& src, uint8_t* key, size_t bytes) {
+    return std::memcmp(src.load(std::memory_order_acquire), key, bytes);
+}
+
+typedef uint64_t (*Operation)(published&, uint8_t*, size_t);
+
+struct Variant {
+    const char* name;
+    Operation operation;
+};
+
+const Variant variants[] = {
+    { "dependent_memcpy", copy_dependent },
+    { "copy operator[]", copy_indexed },
+    { "acquire+memcpy", copy_acquire },
+    { "dependent_memcmp", compare_dependent },
+    { "cmp operator[]", compare_indexed },
+    { "acquire+memcmp", compare_acquire },
+};
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes = { 16, 64, 256, 1 << 10, 4 << 10, 64 << 10 };
+    size_t bytesPerSize = size_t(1) << 30;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--sizes"))
+            sizes = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--bytes-per-size"))
+            bytesPerSize = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(18) << "# variant" << std::right
+              << std::setw(8) << "bytes" << std::setw(10) << "ns/op" << std::setw(10) << "GB/s" << '\n';
+    for (size_t size : sizes) {
+        size = std::max<size_t>(size, 1);
+        std::unique_ptr<uint8_t[]> source(new uint8_t[size]);
+        std::unique_ptr<uint8_t[]> target(new uint8_t[size]);
+        for (size_t i = 0; i != size; ++i)
+            source[i] = target[i] = static_cast<uint8_t>(i);
+        published src(source.get());
+        size_t iterations = std::max<size_t>(bytesPerSize / size, 1);
+        for (const Variant& variant : variants) {
+            uint64_t sum = variant.operation(src, target.get(), size);
+            uint64_t start = bench::now_ns();
+            for (size_t i = 0; i != iterations; ++i)
+                sum += variant.operation(src, target.get(), size);
+            uint64_t elapsed = bench::now_ns() - start;
+            bench::do_not_optimize(sum);
+            std::cout << std::left << std::setw(18) << variant.name << std::right << std::setw(8) << size
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(10) << static_cast<double>(elapsed) / iterations
+                      << std::setw(10) << static_cast<double>(iterations * size) / elapsed << '\n';
+        }
+    }
+    return 0;
+}
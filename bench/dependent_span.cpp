@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Streaming reads of a published array: dependent_span, with range-for and
+// std::accumulate, against indexing the consumed dependent_ptr element by
+// element, and against a raw loop behind an acquire load. Working-set sizes
+// are swept from cache-resident to DRAM. Reports GB/s.
+//
+// Usage: bench_dependent_span [--sizes 32K,1M,64M] [--bytes-per-size B]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include "bench/bench.h"
+#include "dependent_span.h"
+
+namespace {
+
+NEVER_INLINE uint64_t sum_span_for(const std::atomic<const uint64_t*>& published, size_t count) {
+    dependent_span<const uint64_t> span(consume_load(published), count);
+    uint64_t sum = 0;
+    for (uint64_t element : span)
+        sum += element;
+    return sum;
+}
+
+NEVER_INLINE uint64_t sum_span_accumulate(const std::atomic<const uint64_t*>& published, size_t count) {
+    dependent_span<const uint64_t> span(consume_load(published), count);
+    return std::accumulate(span.begin(), span.end(), uint64_t(0));
+}
+
+NEVER_INLINE uint64_t sum_indexed(const std::atomic<const uint64_t*>& published, size_t count) {
+    dependent_ptr<const uint64_t> data = consume_load(published);
+    uint64_t sum = 0;
+    for (size_t i = 0; i != count; ++i)
+        sum += data[i].value();
+    return sum;
+}
+
+NEVER_INLINE uint64_t sum_acquire(const std::atomic<const uint64_t*>& published, size_t count) {
+    const uint64_t* data = published.load(std::memory_order_acquire);
+    uint64_t sum = 0;
+    for (size_t i = 0; i != count; ++i)
+        sum += data[i];
+    return sum;
+}
+
+typedef uint64_t (*Sum)(const std::atomic<const uint64_t*>&, size_t);
+
+struct Variant {
+    const char* name;
+    Sum sum;
+};
+
+const Variant variants[] = {
+    { "span range-for", sum_span_for },
+    { "span accumulate", sum_span_accumulate },
+    { "dependent_ptr[i]", sum_indexed },
+    { "acquire", sum_acquire },
+};
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes = { 32 << 10, 1 << 20, 64 << 20 };
+    size_t bytesPerSize = size_t(4) << 30;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--sizes"))
+            sizes = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--bytes-per-size"))
+            bytesPerSize = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(18) << "# variant" << std::right
+              << std::setw(8) << "ws" << std::setw(10) << "GB/s" << '\n';
+    for (size_t size : sizes) {
+        size_t count = std::max<size_t>(size / sizeof(uint64_t), 1);
+        std::unique_ptr<uint64_t[]> data(new uint64_t[count]);
+        for (size_t i = 0; i != count; ++i)
+            data[i] = i;
+        std::atomic<const uint64_t*> published(data.get());
+        size_t passes = std::max<size_t>(bytesPerSize / (count * sizeof(uint64_t)), 1);
+        for (const Variant& variant : variants) {
+            uint64_t sum = variant.sum(published, count);
+            uint64_t start = bench::now_ns();
+            for (size_t pass = 0; pass != passes; ++pass)
+                sum += variant.sum(published, count);
+            uint64_t elapsed = bench::now_ns() - start;
+            bench::do_not_optimize(sum);
+            std::cout << std::left << std::setw(18) << variant.name << std::right
+                      << std::setw(8) << bench::format_size(size) << std::fixed << std::setprecision(2)
+                      << std::setw(10) << static_cast<double>(passes * count * sizeof(uint64_t)) / elapsed << '\n';
+        }
+    }
+    return 0;
+}
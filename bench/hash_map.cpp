@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Hash map lookups: consume_hash_map, with epoch and QSBR read sections, against
+// the same chained layout read with acquire loads, and against
+// std::unordered_map behind a std::mutex. Maps are
+// pre-sized to hit each requested load factor, then N reader threads perform
+// random successful lookups.
+//
+// Usage: bench_hash_map [--keys N] [--load-factors 1,2,4] [--readers 1,2,4] [--duration-ms MS]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "bench/bench.h"
+#include "hash_map.h"
+
+namespace {
+
+// Same layout as consume_hash_map, with acquire loads on every link and no
+// support for updates.
+class acquire_hash_map {
+public:
+    explicit acquire_hash_map(size_t buckets) : mask(buckets - 1), buckets(new std::atomic<node*>[buckets]()) {}
+
+    ~acquire_hash_map()
+    {
+        for (size_t i = 0; i <= mask; ++i) {
+            for (node* n = buckets[i].load(std::memory_order_relaxed); n; ) {
+                node* next = n->next.load(std::memory_order_relaxed);
+                delete n;
+                n = next;
+            }
+        }
+    }
+
+    void insert(uint64_t key, uint64_t value)
+    {
+        size_t hash = std::hash<uint64_t>()(key);
+        std::atomic<node*>& bucket = buckets[hash & mask];
+        bucket.store(new node { bucket.load(std::memory_order_relaxed), hash, key, value }, std::memory_order_release);
+    }
+
+    bool find(uint64_t key, uint64_t& out) const
+    {
+        size_t hash = std::hash<uint64_t>()(key);
+        for (node* n = buckets[hash & mask].load(std::memory_order_acquire); n; n = n->next.load(std::memory_order_acquire)) {
+            if (n->hash == hash && n->key == key) {
+                out = n->value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct node {
+        std::atomic<node*> next;
+        size_t hash;
+        uint64_t key;
+        uint64_t value;
+    };
+
+    size_t mask;
+    std::unique_ptr<std::atomic<node*>[]> buckets;
+};
+
+class mutex_hash_map {
+public:
+    mutex_hash_map(size_t buckets, double loadFactor)
+    {
+        map.max_load_factor(loadFactor);
+        map.rehash(buckets);
+    }
+
+    void insert(uint64_t key, uint64_t value) { map.emplace(key, value); }
+
+    bool find(uint64_t key, uint64_t& out) const
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        auto it = map.find(key);
+        if (it == map.end())
+            return false;
+        out = it->second;
+        return true;
+    }
+
+private:
+    mutable std::mutex lock;
+    std::unordered_map<uint64_t, uint64_t> map;
+};
+
+template<typename Map>
+struct is_qsbr : std::false_type { };
+
+template<typename Key, typename Value, typename Hash>
+struct is_qsbr<consume_hash_map<Key, Value, Hash, rcu_qsbr>> : std::true_type { };
+
+template<typename Map>
+NEVER_INLINE double run(const Map& map, size_t keys, size_t readerCount, uint64_t durationMs) {
+    return bench::run_threads(readerCount, durationMs, [&] (size_t r, const std::atomic<bool>& stop) {
+            uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+            uint64_t ops = 0;
+            uint64_t sum = 0;
+            if (is_qsbr<Map>::value)
+                rcu_register_thread<rcu_qsbr>();
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t value = 0;
+                if (UNLIKELY(!map.find(bench::xorshift(rng) % keys, value)))
+                    abort();
+                sum += value;
+                ++ops;
+                if (is_qsbr<Map>::value && !(ops % 1024))
+                    rcu_quiescent_state();
+            }
+            if (is_qsbr<Map>::value)
+                rcu_unregister_thread<rcu_qsbr>();
+            bench::do_not_optimize(sum);
+            return ops;
+        });
+}
+
+void report(const char* name, double loadFactor, size_t readers, double mops) {
+    std::cout << std::left << std::setw(16) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(8) << loadFactor << std::setw(8) << readers
+              << std::setw(12) << mops << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t keys = 1 << 20;
+    std::vector<size_t> loadFactors = { 1, 2, 4 };
+    std::vector<size_t> readers;
+    uint64_t durationMs = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--keys"))
+            keys = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--load-factors"))
+            loadFactors = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--readers"))
+            readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (readers.empty())
+        readers = bench::default_thread_counts();
+
+    std::cout << std::left << std::setw(16) << "# map" << std::right << std::setw(8) << "load"
+              << std::setw(8) << "readers" << std::setw(12) << "Mops/s" << '\n';
+    for (size_t loadFactor : loadFactors) {
+        loadFactor = std::max<size_t>(loadFactor, 1);
+        size_t buckets = 1;
+        while (buckets * loadFactor < keys)
+            buckets *= 2;
+        double actual = static_cast<double>(keys) / buckets;
+
+        consume_hash_map<uint64_t, uint64_t> consumeMap(buckets, 2 * actual);
+        consume_hash_map<uint64_t, uint64_t, std::hash<uint64_t>, rcu_qsbr> qsbrMap(buckets, 2 * actual);
+        acquire_hash_map acquireMap(buckets);
+        mutex_hash_map mutexMap(buckets, 2 * actual);
+        for (uint64_t k = 0; k != keys; ++k) {
+            consumeMap.insert(k, k);
+            qsbrMap.insert(k, k);
+            acquireMap.insert(k, k);
+            mutexMap.insert(k, k);
+        }
+
+        for (size_t readerCount : readers) {
+            report("consume/epoch", actual, readerCount, run(consumeMap, keys, readerCount, durationMs));
+            report("consume/qsbr", actual, readerCount, run(qsbrMap, keys, readerCount, durationMs));
+            report("acquire", actual, readerCount, run(acquireMap, keys, readerCount, durationMs));
+            report("mutex", actual, readerCount, run(mutexMap, keys, readerCount, durationMs));
+        }
+    }
+    return 0;
+}
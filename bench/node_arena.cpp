@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Node allocation for consume-published structures: node_arena against glibc
+// malloc, on both sides of the publication.
+//
+// Writers: each thread churns a ring of live nodes, freeing the oldest and
+// allocating a replacement, which is how an RCU writer's steady state looks
+// once the reclaimer has caught up. The zeroed variants stand in for writers
+// which clear new nodes before initializing them.
+//
+// Readers: a reader walks a list of small nodes, each allocated right before
+// a small object which a writer thread keeps incrementing. With malloc, each
+// node shares its line with a written object; with the arena, nodes sit on
+// their own lines. The walk reports ns per hop, and cache misses per hop when
+// perf events are available.
+//
+// Usage: bench_node_arena [--threads 1,2,4] [--node-size B] [--live N]
+//                         [--nodes N] [--laps N] [--duration-ms MS]
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "bench/bench.h"
+#include "consume.h"
+#include "node_arena.h"
+
+#if OS(LINUX)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Last-level cache misses of the calling thread, or nothing without perf
+// events.
+class miss_counter {
+public:
+    miss_counter() {
+#if OS(LINUX)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~miss_counter() {
+#if OS(LINUX)
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    bool available() const { return fd >= 0; }
+
+    uint64_t read() const {
+        uint64_t value = 0;
+#if OS(LINUX)
+        if (fd >= 0 && ::read(fd, &value, sizeof(value)) != sizeof(value))
+            value = 0;
+#endif
+        return value;
+    }
+
+private:
+    int fd { -1 };
+};
+
+struct Malloc {
+    static constexpr const char* name = "malloc";
+    static void* allocate(size_t size) { return std::malloc(size); }
+    static void deallocate(void* p, size_t) { std::free(p); }
+};
+
+struct Calloc {
+    static constexpr const char* name = "calloc";
+    static void* allocate(size_t size) { return std::calloc(1, size); }
+    static void deallocate(void* p, size_t) { std::free(p); }
+};
+
+struct Arena {
+    static constexpr const char* name = "node_arena";
+    static void* allocate(size_t size) { return node_arena::global().allocate(size); }
+    static void deallocate(void* p, size_t size) { node_arena::global().deallocate(p, size); }
+};
+
+struct ArenaZeroed {
+    static constexpr const char* name = "node_arena zeroed";
+    static void* allocate(size_t size) { return node_arena::global().allocate_zeroed(size); }
+    static void deallocate(void* p, size_t size) { node_arena::global().deallocate(p, size); }
+};
+
+struct Options {
+    std::vector<size_t> threads;
+    size_t nodeSize { 48 };
+    size_t live { 4096 };
+    size_t nodes { 1 << 18 };
+    size_t laps { 8 };
+    uint64_t durationMs { 200 };
+};
+
+template<typename Allocator>
+NEVER_INLINE void run_writers(const Options& options, size_t threadCount) {
+    double mops = bench::run_threads(threadCount, options.durationMs, [&] (size_t, std::atomic<bool>& stop) {
+            std::vector<void*> ring(options.live);
+            for (void*& p : ring)
+                p = Allocator::allocate(options.nodeSize);
+            uint64_t ops = 0;
+            for (size_t i = 0; !stop.load(std::memory_order_relaxed); i = (i + 1) % ring.size()) {
+                Allocator::deallocate(ring[i], options.nodeSize);
+                ring[i] = Allocator::allocate(options.nodeSize);
+                // Initializing the node is part of the writer's cost.
+                static_cast<uint64_t*>(ring[i])[0] = i;
+                ++ops;
+            }
+            for (void* p : ring)
+                Allocator::deallocate(p, options.nodeSize);
+            return ops;
+        });
+    std::cout << std::left << std::setw(8) << "writer" << std::setw(20) << Allocator::name << std::right
+              << std::setw(8) << threadCount << std::fixed << std::setprecision(2)
+              << std::setw(14) << mops << std::setw(14) << mops / threadCount << '\n';
+}
+
+struct ListNode {
+    ListNode* next;
+    uint64_t key;
+};
+
+struct HotObject {
+    std::atomic<uint64_t> counter;
+};
+
+inline const std::atomic<ListNode*>& as_atomic(ListNode* const& field) {
+    static_assert(sizeof(ListNode*) == sizeof(std::atomic<ListNode*>), "The cast below relies on this fact");
+    return reinterpret_cast<const std::atomic<ListNode*>&>(field);
+}
+
+template<typename Allocator>
+NEVER_INLINE void run_reader(const Options& options) {
+    std::vector<ListNode*> list(options.nodes);
+    std::vector<HotObject*> hot(options.nodes);
+    for (size_t i = 0; i != options.nodes; ++i) {
+        list[i] = static_cast<ListNode*>(Allocator::allocate(sizeof(ListNode)));
+        hot[i] = static_cast<HotObject*>(std::malloc(sizeof(HotObject)));
+        hot[i]->counter.store(0, std::memory_order_relaxed);
+    }
+    std::vector<size_t> order = bench::random_cycle(options.nodes);
+    for (size_t i = 0; i != options.nodes; ++i) {
+        list[order[i]]->next = i + 1 == options.nodes ? nullptr : list[order[i + 1]];
+        list[order[i]]->key = i;
+    }
+    std::atomic<ListNode*> head(list[order[0]]);
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&] () {
+            bench::pin_to_cpu(1);
+            uint64_t rng = 0xbf58476d1ce4e5b9ull;
+            while (!stop.load(std::memory_order_relaxed))
+                hot[bench::xorshift(rng) % hot.size()]->counter.fetch_add(1, std::memory_order_relaxed);
+        });
+
+    bench::pin_to_cpu(0);
+    miss_counter misses;
+    uint64_t sum = 0;
+    uint64_t startMisses = misses.read();
+    uint64_t startNs = bench::now_ns();
+    for (size_t lap = 0; lap != options.laps; ++lap) {
+        for (dependent_ptr<ListNode> p = consume_load(head); p.value(); p = consume_load(&p->next, p.dependency()))
+            sum += p->key;
+    }
+    double ns = bench::now_ns() - startNs;
+    uint64_t missCount = misses.read() - startMisses;
+    stop.store(true);
+    writer.join();
+    bench::do_not_optimize(sum);
+
+    double hops = static_cast<double>(options.nodes * options.laps);
+    std::cout << std::left << std::setw(8) << "reader" << std::setw(20) << Allocator::name << std::right
+              << std::setw(8) << 1 << std::fixed << std::setprecision(2)
+              << std::setw(14) << ns / hops;
+    if (misses.available())
+        std::cout << std::setw(14) << missCount / hops;
+    else
+        std::cout << std::setw(14) << "-";
+    std::cout << '\n';
+
+    for (size_t i = 0; i != options.nodes; ++i) {
+        Allocator::deallocate(list[i], sizeof(ListNode));
+        std::free(hot[i]);
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--threads"))
+            options.threads = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--node-size"))
+            options.nodeSize = std::max<size_t>(bench::parse_size(argv[i + 1]), sizeof(uint64_t));
+        else if (!std::strcmp(argv[i], "--live"))
+            options.live = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--nodes"))
+            options.nodes = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--laps"))
+            options.laps = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            options.durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (options.threads.empty())
+        options.threads = bench::default_thread_counts();
+
+    // Writers report allocations per second, readers ns and misses per hop.
+    std::cout << std::left << std::setw(8) << "# side" << std::setw(20) << "allocator" << std::right
+              << std::setw(8) << "threads" << std::setw(14) << "Mallocs/s" << std::setw(14) << "Mallocs/s/thr" << '\n';
+    for (size_t threadCount : options.threads) {
+        run_writers<Malloc>(options, threadCount);
+        run_writers<Calloc>(options, threadCount);
+        run_writers<Arena>(options, threadCount);
+        run_writers<ArenaZeroed>(options, threadCount);
+    }
+    std::cout << std::left << std::setw(8) << "# side" << std::setw(20) << "allocator" << std::right
+              << std::setw(8) << "threads" << std::setw(14) << "ns/hop" << std::setw(14) << "misses/hop" << '\n';
+    run_reader<Malloc>(options);
+    run_reader<Arena>(options);
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Dependency-aware prefetching on DRAM-resident structures, against the plain
+// hop-by-hop consume_load(dependent_ptr<T*>) walk.
+//
+// Lists: two-line nodes linked in a random cycle, whose payload line is summed
+// at every hop. Each node also holds a jump pointer `ahead` hops down the list,
+// which prefetch_through follows to warm both lines of that node while the
+// walk is still `ahead` misses away from it.
+//
+// Trees: lookups of random keys in a balanced binary search tree whose nodes
+// are scattered in memory. Lookups either descend alone, prefetch both
+// children before comparing, or run `group` lookups in lockstep, each of which
+// prefetches its next node before the group moves on.
+//
+// Usage: bench_prefetch [--hops N] [--sizes 64M,256M] [--ahead 2,4,8,16]
+//                       [--lookups N] [--groups 4,8,16]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+struct alignas(CACHE_LINE_SIZE) ListNode {
+    ListNode* next;
+    ListNode* ahead;
+    alignas(CACHE_LINE_SIZE) uint64_t payload[8];
+};
+
+inline uint64_t sum_payload(const dependent_ptr<ListNode>& p) {
+    uint64_t sum = 0;
+    for (uint64_t word : p->payload)
+        sum += word;
+    return sum;
+}
+
+NEVER_INLINE uint64_t walk_hop_by_hop(ListNode* head, size_t hops) {
+    uint64_t sum = 0;
+    dependent_ptr<ListNode> p = head;
+    for (size_t h = 0; h != hops; ++h) {
+        sum += sum_payload(p);
+        p = consume_load(dependent_ptr<ListNode*>(&p->next, p.dependency()));
+    }
+    return sum;
+}
+
+NEVER_INLINE uint64_t walk_prefetch_ahead(ListNode* head, size_t hops) {
+    uint64_t sum = 0;
+    dependent_ptr<ListNode> p = head;
+    for (size_t h = 0; h != hops; ++h) {
+        p.prefetch_through(&ListNode::ahead, sizeof(ListNode) / CACHE_LINE_SIZE);
+        sum += sum_payload(p);
+        p = p.member(&ListNode::next);
+    }
+    return sum;
+}
+
+struct alignas(CACHE_LINE_SIZE) TreeNode {
+    TreeNode* left;
+    TreeNode* right;
+    uint64_t key;
+    uint64_t value;
+};
+
+// Node i of the tree lives at nodes[slot[i]], where the in-order index i holds
+// key 2i + 1, so that lookups of even keys miss.
+struct Tree {
+    explicit Tree(size_t count)
+        : nodes(new TreeNode[count])
+        , slot(bench::random_cycle(count, 7))
+    {
+        root = build(0, count);
+    }
+
+    TreeNode* build(size_t begin, size_t end) {
+        if (begin == end)
+            return nullptr;
+        size_t middle = begin + (end - begin) / 2;
+        TreeNode* node = &nodes[slot[middle]];
+        node->key = 2 * middle + 1;
+        node->value = middle;
+        node->left = build(begin, middle);
+        node->right = build(middle + 1, end);
+        return node;
+    }
+
+    std::unique_ptr<TreeNode[]> nodes;
+    std::vector<size_t> slot;
+    TreeNode* root;
+};
+
+inline dependent_ptr<TreeNode> child(const dependent_ptr<TreeNode>& p, uint64_t key) {
+    return key < p->key ? p.member(&TreeNode::left) : p.member(&TreeNode::right);
+}
+
+NEVER_INLINE uint64_t lookup_hop_by_hop(const Tree& tree, const std::vector<uint64_t>& keys) {
+    uint64_t found = 0;
+    for (uint64_t key : keys) {
+        dependent_ptr<TreeNode> p = tree.root;
+        while (p.value()) {
+            if (p->key == key) {
+                found += p->value;
+                break;
+            }
+            p = consume_load(dependent_ptr<TreeNode*>(key < p->key ? &p->left : &p->right, p.dependency()));
+        }
+    }
+    return found;
+}
+
+NEVER_INLINE uint64_t lookup_prefetch_children(const Tree& tree, const std::vector<uint64_t>& keys) {
+    uint64_t found = 0;
+    for (uint64_t key : keys) {
+        dependent_ptr<TreeNode> p = tree.root;
+        while (p.value()) {
+            p.prefetch_through(&TreeNode::left);
+            p.prefetch_through(&TreeNode::right);
+            if (p->key == key) {
+                found += p->value;
+                break;
+            }
+            p = child(p, key);
+        }
+    }
+    return found;
+}
+
+template<size_t group>
+NEVER_INLINE uint64_t lookup_interleaved(const Tree& tree, const std::vector<uint64_t>& keys) {
+    uint64_t found = 0;
+    size_t count = keys.size() - keys.size() % group;
+    for (size_t base = 0; base != count; base += group) {
+        dependent_ptr<TreeNode> p[group];
+        for (size_t i = 0; i != group; ++i)
+            p[i] = tree.root;
+        for (size_t active = group; active; ) {
+            active = 0;
+            for (size_t i = 0; i != group; ++i) {
+                if (!p[i].value())
+                    continue;
+                uint64_t key = keys[base + i];
+                if (p[i]->key == key) {
+                    found += p[i]->value;
+                    p[i] = nullptr;
+                    continue;
+                }
+                p[i] = child(p[i], key);
+                p[i].prefetch();
+                ++active;
+            }
+        }
+    }
+    return found;
+}
+
+typedef uint64_t (*Lookup)(const Tree&, const std::vector<uint64_t>&);
+
+struct Variant {
+    const char* name;
+    Lookup lookup;
+    size_t group;
+};
+
+const Variant treeVariants[] = {
+    { "hop-by-hop", lookup_hop_by_hop, 1 },
+    { "prefetch children", lookup_prefetch_children, 1 },
+    { "interleaved", lookup_interleaved<4>, 4 },
+    { "interleaved", lookup_interleaved<8>, 8 },
+    { "interleaved", lookup_interleaved<16>, 16 },
+};
+
+void report(const char* structure, const std::string& name, size_t size, double ns, uint64_t cycles, double ops) {
+    std::cout << std::left << std::setw(6) << structure << std::setw(22) << name << std::right
+              << std::setw(8) << bench::format_size(size)
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << ns / ops << std::setw(12) << cycles / ops << '\n';
+}
+
+void run_lists(size_t size, size_t hops, const std::vector<size_t>& aheads) {
+    size_t count = std::max<size_t>(size / sizeof(ListNode), 2);
+    std::unique_ptr<ListNode[]> nodes(new ListNode[count]);
+    std::vector<size_t> order = bench::random_cycle(count);
+    for (size_t i = 0; i != count; ++i) {
+        nodes[order[i]].next = &nodes[order[(i + 1) % count]];
+        for (size_t w = 0; w != 8; ++w)
+            nodes[order[i]].payload[w] = i + w;
+    }
+
+    auto measure = [&] (const std::string& name, uint64_t (*walk)(ListNode*, size_t)) {
+        uint64_t startNs = bench::now_ns();
+        uint64_t startCycles = bench::cycles();
+        uint64_t sum = walk(&nodes[order[0]], hops);
+        uint64_t cycles = bench::cycles() - startCycles;
+        double ns = bench::now_ns() - startNs;
+        bench::do_not_optimize(sum);
+        report("list", name, size, ns, cycles, hops);
+    };
+
+    measure("hop-by-hop", walk_hop_by_hop);
+    for (size_t ahead : aheads) {
+        for (size_t i = 0; i != count; ++i)
+            nodes[order[i]].ahead = &nodes[order[(i + ahead) % count]];
+        measure("prefetch ahead " + std::to_string(ahead), walk_prefetch_ahead);
+    }
+}
+
+void run_trees(size_t size, size_t lookups, const std::vector<size_t>& groups) {
+    size_t count = std::max<size_t>(size / sizeof(TreeNode), 2);
+    Tree tree(count);
+    std::vector<uint64_t> keys(lookups);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (uint64_t& key : keys)
+        key = bench::xorshift(rng) % (2 * count);
+
+    for (const Variant& variant : treeVariants) {
+        if (variant.group != 1 && std::find(groups.begin(), groups.end(), variant.group) == groups.end())
+            continue;
+        uint64_t startNs = bench::now_ns();
+        uint64_t startCycles = bench::cycles();
+        uint64_t found = variant.lookup(tree, keys);
+        uint64_t cycles = bench::cycles() - startCycles;
+        double ns = bench::now_ns() - startNs;
+        bench::do_not_optimize(found);
+        std::string name = variant.name;
+        if (variant.group != 1)
+            name += " x" + std::to_string(variant.group);
+        report("tree", name, size, ns, cycles, lookups);
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t hops = 1 << 22;
+    size_t lookups = 1 << 20;
+    std::vector<size_t> sizes = { 64 << 20, 256 << 20 };
+    std::vector<size_t> aheads = { 2, 4, 8, 16 };
+    std::vector<size_t> groups = { 4, 8, 16 };
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--hops"))
+            hops = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--sizes"))
+            sizes = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--ahead"))
+            aheads = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--lookups"))
+            lookups = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--groups"))
+            groups = bench::parse_list(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    // Lists report per hop, trees per lookup.
+    std::cout << std::left << std::setw(28) << "# variant" << std::right
+              << std::setw(8) << "ws" << std::setw(10) << "ns/op" << std::setw(12) << "cycles/op" << '\n';
+    for (size_t size : sizes) {
+        run_lists(size, hops, aheads);
+        run_trees(size, lookups, groups);
+    }
+    return 0;
+}
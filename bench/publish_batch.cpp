@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Batched publication: one writer republishes random slots of a table, either
+// with a release store per slot or by staging `batch` stores in a
+// publish_batch and committing them behind one release fence, while pinned
+// readers consume_load random slots.
+//
+// The writer reports stores per second. Each record carries the cycle count at
+// which the writer initialized it, so a reader which finds a slot changed since
+// its previous visit reports how long ago the record was written: for batches,
+// that includes the time spent staging the rest of the batch, which is the
+// latency cost of batching. Records are reused round-robin, so a reader may
+// miss a change or read a newer stamp; both only bias the latency downwards,
+// equally for every variant.
+//
+// Usage: bench_publish_batch [--batches 1,4,16,64] [--readers N] [--slots N]
+//                            [--duration-ms MS]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "bench/bench.h"
+#include "consume.h"
+#include "publish_batch.h"
+
+namespace {
+
+struct alignas(CACHE_LINE_SIZE) Record {
+    std::atomic<uint64_t> stamp;
+    uint64_t payload[7];
+};
+
+struct alignas(CACHE_LINE_SIZE) Slot {
+    std::atomic<Record*> current;
+};
+
+constexpr size_t versions = 8;
+
+struct Table {
+    explicit Table(size_t slotCount)
+        : slotCount(slotCount)
+        , slots(new Slot[slotCount])
+        , records(new Record[slotCount * versions])
+        , nextVersion(slotCount)
+    {
+        for (size_t s = 0; s != slotCount; ++s) {
+            for (size_t v = 0; v != versions; ++v)
+                records[s * versions + v].stamp.store(0, std::memory_order_relaxed);
+            slots[s].current.store(&records[s * versions], std::memory_order_relaxed);
+        }
+    }
+
+    // Initializes the slot's next record, which no reader can be reaching
+    // through the slot since at least `versions - 1` publications.
+    Record* prepare(size_t slot) {
+        size_t v = ++nextVersion[slot] % versions;
+        Record* record = &records[slot * versions + v];
+        record->stamp.store(bench::cycles(), std::memory_order_relaxed);
+        for (uint64_t& word : record->payload)
+            word = v;
+        return record;
+    }
+
+    size_t slotCount;
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<Record[]> records;
+    std::vector<size_t> nextVersion;
+};
+
+NEVER_INLINE void publish_release(Table& table, uint64_t& rng, size_t batch) {
+    for (size_t i = 0; i != batch; ++i) {
+        size_t slot = bench::xorshift(rng) % table.slotCount;
+        table.slots[slot].current.store(table.prepare(slot), std::memory_order_release);
+    }
+}
+
+NEVER_INLINE void publish_batched(Table& table, uint64_t& rng, size_t batch) {
+    static thread_local publish_batch staged(64);
+    for (size_t i = 0; i != batch; ++i) {
+        size_t slot = bench::xorshift(rng) % table.slotCount;
+        staged.stage(table.slots[slot].current, table.prepare(slot));
+    }
+    staged.commit();
+}
+
+typedef void (*Publish)(Table&, uint64_t&, size_t);
+
+struct Variant {
+    const char* name;
+    Publish publish;
+};
+
+const Variant variants[] = {
+    { "release", publish_release },
+    { "publish_batch", publish_batched },
+};
+
+struct alignas(CACHE_LINE_SIZE) ReaderResult {
+    uint64_t ops { 0 };
+    bench::latency_histogram latency;
+};
+
+struct Options {
+    std::vector<size_t> batches { 1, 4, 16, 64 };
+    size_t readers { 1 };
+    size_t slots { 256 };
+    uint64_t durationMs { 200 };
+};
+
+NEVER_INLINE void run(const Variant& variant, Table& table, const Options& options, size_t batch) {
+    std::atomic<bool> go = false;
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> ready = 0;
+    std::vector<ReaderResult> results(options.readers);
+    uint64_t writes = 0;
+    std::vector<std::thread> threads;
+
+    threads.emplace_back([&] () {
+            bench::pin_to_cpu(0);
+            uint64_t rng = 0xbf58476d1ce4e5b9ull;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) { }
+            while (!stop.load(std::memory_order_relaxed)) {
+                variant.publish(table, rng, batch);
+                writes += batch;
+            }
+        });
+
+    for (size_t r = 0; r != options.readers; ++r) {
+        threads.emplace_back([&, r] () {
+                bench::pin_to_cpu(r + 1);
+                ReaderResult& result = results[r];
+                std::vector<Record*> seen(table.slotCount);
+                uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                while (!stop.load(std::memory_order_relaxed)) {
+                    size_t slot = bench::xorshift(rng) % table.slotCount;
+                    dependent_ptr<Record> p = consume_load(table.slots[slot].current);
+                    uint64_t stamp = p.field(&Record::stamp).value();
+                    if (seen[slot] != p.value()) {
+                        seen[slot] = p.value();
+                        uint64_t now = bench::cycles();
+                        result.latency.record(now > stamp ? now - stamp : 0);
+                    }
+                    bench::do_not_optimize(p->payload[6]);
+                    ++result.ops;
+                }
+            });
+    }
+
+    while (ready.load() != threads.size()) { }
+    uint64_t start = bench::now_ns();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.durationMs));
+    stop.store(true);
+    uint64_t elapsed = bench::now_ns() - start;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    ReaderResult total;
+    for (const ReaderResult& result : results) {
+        total.ops += result.ops;
+        total.latency.merge(result.latency);
+    }
+    double nsPerCycle = 1 / bench::cycles_per_ns();
+    std::cout << std::left << std::setw(16) << variant.name << std::right
+              << std::setw(8) << batch << std::setw(8) << options.readers
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << writes * 1000.0 / elapsed
+              << std::setw(14) << total.ops * 1000.0 / elapsed
+              << std::setw(12) << total.latency.percentile(0.5) * nsPerCycle
+              << std::setw(12) << total.latency.percentile(0.99) * nsPerCycle << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--batches"))
+            options.batches = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--readers"))
+            options.readers = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--slots"))
+            options.slots = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            options.durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    Table table(options.slots);
+    std::cout << std::left << std::setw(16) << "# variant" << std::right
+              << std::setw(8) << "batch" << std::setw(8) << "readers"
+              << std::setw(14) << "Mstores/s" << std::setw(14) << "Mreads/s"
+              << std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns" << '\n';
+    for (size_t batch : options.batches) {
+        for (const Variant& variant : variants)
+            run(variant, table, options, batch);
+    }
+    return 0;
+}
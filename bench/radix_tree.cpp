@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Radix tree longest-prefix matching over IPv4- and IPv6-shaped routing
+// tables, with epoch and QSBR read sections. Prefix lengths follow the rough
+// shape of Internet routing tables: mostly /24 for IPv4 and /48 for IPv6, with
+// a default route so that every lookup matches. Queries pick a random route
+// and fill in random host bits, so they walk down to the route's depth.
+//
+// With --write-interval-us, a control-plane writer replaces a random route at
+// that interval during each run, publishing copy-on-write path updates.
+//
+// Usage: bench_radix_tree [--routes4 N] [--routes6 N] [--readers 1,2,4]
+//                         [--duration-ms MS] [--write-interval-us US]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "bench/bench.h"
+#include "radix_tree.h"
+
+namespace {
+
+struct route_set {
+    const char* name;
+    size_t bytes;
+    std::vector<std::vector<uint8_t>> prefixes;
+    std::vector<unsigned> lengths;
+    std::vector<uint8_t> queries;
+};
+
+constexpr size_t query_count = 1 << 20;
+
+// Lengths are drawn from (weight, bits) pairs.
+route_set make_routes(const char* name, size_t bytes, size_t count, std::initializer_list<std::pair<unsigned, unsigned>> shape, uint64_t seed) {
+    route_set set { name, bytes, { }, { }, { } };
+    unsigned total = 0;
+    for (auto& entry : shape)
+        total += entry.first;
+    uint64_t rng = seed;
+    for (size_t i = 0; i != count; ++i) {
+        unsigned pick = bench::xorshift(rng) % total;
+        unsigned bits = 0;
+        for (auto& entry : shape) {
+            bits = entry.second;
+            if (pick < entry.first)
+                break;
+            pick -= entry.first;
+        }
+        std::vector<uint8_t> prefix(bytes);
+        for (uint8_t& byte : prefix)
+            byte = static_cast<uint8_t>(bench::xorshift(rng));
+        if (bytes == 16)
+            prefix[0] = static_cast<uint8_t>(0x20 | (prefix[0] & 0x1f)); // 2000::/3
+        set.prefixes.push_back(prefix);
+        set.lengths.push_back(bits);
+    }
+    set.queries.resize(query_count * bytes);
+    for (size_t q = 0; q != query_count; ++q) {
+        size_t r = bench::xorshift(rng) % count;
+        uint8_t* query = &set.queries[q * bytes];
+        for (size_t i = 0; i != bytes; ++i) {
+            unsigned bit = static_cast<unsigned>(i * 8);
+            uint8_t host = static_cast<uint8_t>(bench::xorshift(rng));
+            unsigned bits = set.lengths[r];
+            uint8_t keep = bit >= bits ? 0 : bit + 8 <= bits ? 0xff : static_cast<uint8_t>(0xff << (8 - (bits - bit)));
+            query[i] = static_cast<uint8_t>((set.prefixes[r][i] & keep) | (host & ~keep));
+        }
+    }
+    return set;
+}
+
+template<typename Flavor>
+NEVER_INLINE double run(consume_radix_tree<uint32_t, Flavor>& tree, const route_set& set, size_t readerCount, uint64_t durationMs, uint64_t writeIntervalUs) {
+    std::atomic<bool> stopWriter = false;
+    std::thread writer;
+    if (writeIntervalUs) {
+        writer = std::thread([&] () {
+                uint64_t rng = 0xbf58476d1ce4e5b9ull;
+                while (!stopWriter.load(std::memory_order_relaxed)) {
+                    size_t r = bench::xorshift(rng) % set.prefixes.size();
+                    tree.insert(set.prefixes[r].data(), set.lengths[r], static_cast<uint32_t>(bench::xorshift(rng)));
+                    std::this_thread::sleep_for(std::chrono::microseconds(writeIntervalUs));
+                }
+            });
+    }
+    double mops = bench::run_threads(readerCount, durationMs, [&] (size_t r, const std::atomic<bool>& stop) {
+            uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+            uint64_t ops = 0;
+            uint64_t sum = 0;
+            if (Flavor::quiescent_state_based)
+                rcu_register_thread<rcu_qsbr>();
+            while (!stop.load(std::memory_order_relaxed)) {
+                const uint8_t* query = &set.queries[(bench::xorshift(rng) % query_count) * set.bytes];
+                uint32_t value = 0;
+                if (UNLIKELY(!tree.lookup(query, set.bytes, value)))
+                    abort();
+                sum += value;
+                ++ops;
+                if (Flavor::quiescent_state_based && !(ops % 1024))
+                    rcu_quiescent_state();
+            }
+            if (Flavor::quiescent_state_based)
+                rcu_unregister_thread<rcu_qsbr>();
+            bench::do_not_optimize(sum);
+            return ops;
+        });
+    stopWriter = true;
+    if (writer.joinable())
+        writer.join();
+    return mops;
+}
+
+template<typename Flavor>
+void populate(consume_radix_tree<uint32_t, Flavor>& tree, const route_set& set) {
+    std::vector<uint8_t> zero(set.bytes);
+    tree.insert(zero.data(), 0, 0);
+    for (size_t r = 0; r != set.prefixes.size(); ++r)
+        tree.insert(set.prefixes[r].data(), set.lengths[r], static_cast<uint32_t>(r + 1));
+}
+
+void report(const char* name, const route_set& set, size_t readers, double mops) {
+    std::cout << std::left << std::setw(16) << name << std::setw(8) << set.name << std::right
+              << std::setw(10) << set.prefixes.size() << std::setw(8) << readers
+              << std::fixed << std::setprecision(2) << std::setw(12) << mops << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t routes4 = 200000;
+    size_t routes6 = 50000;
+    std::vector<size_t> readers;
+    uint64_t durationMs = 200;
+    uint64_t writeIntervalUs = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--routes4"))
+            routes4 = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--routes6"))
+            routes6 = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--readers"))
+            readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--write-interval-us"))
+            writeIntervalUs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (readers.empty())
+        readers = bench::default_thread_counts();
+
+    route_set sets[] = {
+        make_routes("ipv4", 4, routes4, { { 55, 24 }, { 10, 23 }, { 10, 22 }, { 6, 21 }, { 5, 20 }, { 4, 19 }, { 5, 16 }, { 5, 18 }, { 2, 17 }, { 3, 12 } }, 42),
+        make_routes("ipv6", 16, routes6, { { 45, 48 }, { 20, 32 }, { 10, 44 }, { 10, 40 }, { 5, 36 }, { 5, 56 }, { 5, 64 } }, 43),
+    };
+
+    std::cout << std::left << std::setw(16) << "# tree" << std::setw(8) << "keys" << std::right
+              << std::setw(10) << "routes" << std::setw(8) << "readers" << std::setw(12) << "Mops/s" << '\n';
+    for (const route_set& set : sets) {
+        consume_radix_tree<uint32_t> epochTree;
+        consume_radix_tree<uint32_t, rcu_qsbr> qsbrTree;
+        populate(epochTree, set);
+        populate(qsbrTree, set);
+        for (size_t readerCount : readers) {
+            report("consume/epoch", set, readerCount, run(epochTree, set, readerCount, durationMs, writeIntervalUs));
+            report("consume/qsbr", set, readerCount, run(qsbrTree, set, readerCount, durationMs, writeIntervalUs));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Read-mostly scaling: N pinned readers traverse chains hanging off a table of
+// published pointers while M pinned writers republish those pointers with
+// release stores. Readers run either through consume_load or through acquire
+// loads, and the reader count is swept to produce a throughput-vs-threads
+// curve along with p50/p99/p999 per-traversal latency.
+//
+// Writers flip each slot between pre-built immutable versions of its chain, so
+// no reclamation is needed and readers never race with initialization. The
+// churn still invalidates the slot lines readers hit.
+//
+// Usage: bench_read_mostly [--readers 1,2,4] [--writers M] [--write-interval-ns NS]
+//                          [--slots N] [--chain L] [--duration-ms MS] [--sample S]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+struct Record {
+    Record* next;
+    uint64_t payload[3];
+};
+
+struct alignas(CACHE_LINE_SIZE) Slot {
+    std::atomic<Record*> head;
+};
+
+constexpr size_t versions = 4;
+
+struct Table {
+    Table(size_t slotCount, size_t chain)
+        : slotCount(slotCount)
+        , chain(chain)
+        , slots(new Slot[slotCount])
+        , records(new Record[slotCount * versions * chain])
+    {
+        for (size_t s = 0; s != slotCount; ++s) {
+            for (size_t v = 0; v != versions; ++v) {
+                Record* first = version(s, v);
+                for (size_t i = 0; i != chain; ++i) {
+                    first[i].next = i + 1 == chain ? nullptr : &first[i + 1];
+                    for (uint64_t& word : first[i].payload)
+                        word = s + v + i;
+                }
+            }
+            slots[s].head.store(version(s, 0), std::memory_order_relaxed);
+        }
+    }
+
+    Record* version(size_t slot, size_t v) { return &records[(slot * versions + v) * chain]; }
+
+    size_t slotCount;
+    size_t chain;
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<Record[]> records;
+};
+
+inline const std::atomic<Record*>& as_atomic(Record* const& field) {
+    static_assert(sizeof(Record*) == sizeof(std::atomic<Record*>), "The cast below relies on this fact");
+    return reinterpret_cast<const std::atomic<Record*>&>(field);
+}
+
+// Payload reads go through operator->, whose access is in the dependency chain.
+inline uint64_t traverse_consume(Table& table, size_t slot) {
+    uint64_t sum = 0;
+    dependent_ptr<Record> p = consume_load(table.slots[slot].head);
+    while (p.value()) {
+        sum += p->payload[0] + p->payload[1] + p->payload[2];
+        p = consume_load(&p->next, p.dependency());
+    }
+    return sum;
+}
+
+inline uint64_t traverse_acquire(Table& table, size_t slot) {
+    uint64_t sum = 0;
+    Record* r = table.slots[slot].head.load(std::memory_order_acquire);
+    while (r) {
+        sum += r->payload[0] + r->payload[1] + r->payload[2];
+        r = as_atomic(r->next).load(std::memory_order_acquire);
+    }
+    return sum;
+}
+
+typedef uint64_t (*Traverse)(Table&, size_t);
+
+struct Variant {
+    const char* name;
+    Traverse traverse;
+};
+
+const Variant variants[] = {
+    { "consume_load", traverse_consume },
+    { "acquire", traverse_acquire },
+};
+
+struct alignas(CACHE_LINE_SIZE) ReaderResult {
+    uint64_t ops { 0 };
+    bench::latency_histogram latency;
+};
+
+struct Options {
+    std::vector<size_t> readers;
+    size_t writers { 1 };
+    uint64_t writeIntervalNs { 1000 };
+    size_t slots { 1024 };
+    size_t chain { 4 };
+    uint64_t durationMs { 200 };
+    unsigned sample { 16 };
+};
+
+NEVER_INLINE void run(const Variant& variant, Table& table, const Options& options, size_t readerCount) {
+    std::atomic<bool> go = false;
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> ready = 0;
+    std::vector<ReaderResult> results(readerCount);
+    std::vector<std::thread> threads;
+
+    for (size_t r = 0; r != readerCount; ++r) {
+        threads.emplace_back([&, r] () {
+                bench::pin_to_cpu(r);
+                ReaderResult& result = results[r];
+                uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+                uint64_t sum = 0;
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                while (!stop.load(std::memory_order_relaxed)) {
+                    size_t slot = bench::xorshift(rng) % table.slotCount;
+                    if (result.ops % options.sample) {
+                        sum += variant.traverse(table, slot);
+                    } else {
+                        uint64_t start = bench::cycles();
+                        sum += variant.traverse(table, slot);
+                        result.latency.record(bench::cycles() - start);
+                    }
+                    ++result.ops;
+                }
+                bench::do_not_optimize(sum);
+            });
+    }
+
+    for (size_t w = 0; w != options.writers; ++w) {
+        threads.emplace_back([&, w] () {
+                bench::pin_to_cpu(readerCount + w);
+                uint64_t rng = 0xbf58476d1ce4e5b9ull * (w + 1);
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                while (!stop.load(std::memory_order_relaxed)) {
+                    uint64_t random = bench::xorshift(rng);
+                    size_t slot = random % table.slotCount;
+                    size_t v = (random >> 32) % versions;
+                    table.slots[slot].head.store(table.version(slot, v), std::memory_order_release);
+                    uint64_t until = bench::now_ns() + options.writeIntervalNs;
+                    while (bench::now_ns() < until) { }
+                }
+            });
+    }
+
+    while (ready.load() != threads.size()) { }
+    uint64_t start = bench::now_ns();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.durationMs));
+    stop.store(true);
+    uint64_t elapsed = bench::now_ns() - start;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    ReaderResult total;
+    for (const ReaderResult& result : results) {
+        total.ops += result.ops;
+        total.latency.merge(result.latency);
+    }
+    double mops = total.ops * 1000.0 / elapsed;
+    double nsPerCycle = 1 / bench::cycles_per_ns();
+    std::cout << std::left << std::setw(14) << variant.name << std::right
+              << std::setw(8) << readerCount << std::setw(8) << options.writers
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << mops << std::setw(12) << mops / readerCount
+              << std::setw(10) << total.latency.percentile(0.5) * nsPerCycle
+              << std::setw(10) << total.latency.percentile(0.99) * nsPerCycle
+              << std::setw(10) << total.latency.percentile(0.999) * nsPerCycle << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--readers"))
+            options.readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--writers"))
+            options.writers = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--write-interval-ns"))
+            options.writeIntervalNs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--slots"))
+            options.slots = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--chain"))
+            options.chain = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            options.durationMs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--sample"))
+            options.sample = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (options.readers.empty()) {
+        size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+        size_t available = cpus > options.writers ? cpus - options.writers : 1;
+        for (size_t n = 1; n < available; n *= 2)
+            options.readers.push_back(n);
+        options.readers.push_back(available);
+    }
+
+    Table table(options.slots, options.chain);
+    std::cout << std::left << std::setw(14) << "# variant" << std::right
+              << std::setw(8) << "readers" << std::setw(8) << "writers"
+              << std::setw(12) << "Mops/s" << std::setw(12) << "Mops/s/thr"
+              << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns" << std::setw(10) << "p999 ns" << '\n';
+    for (size_t readerCount : options.readers) {
+        for (const Variant& variant : variants)
+            run(variant, table, options, readerCount);
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Seqlock read latency: seqlock, whose reader orders its loads through
+// dependencies, against the same lock read with an acquire load of the
+// sequence and an acquire fence before the reload. Payloads of several sizes
+// are read by N pinned readers while an optional writer stores a new snapshot
+// every --write-interval-ns. Reports throughput and p50/p99/p999 latency per
+// read, retries included.
+//
+// Usage: bench_seqlock [--readers 1,2,4] [--write-interval-ns NS] [--duration-ms MS] [--sample S]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "bench/bench.h"
+#include "seqlock.h"
+
+namespace {
+
+// Same layout and writer as seqlock, with the conventional reader.
+template<typename T>
+class acquire_seqlock {
+public:
+    acquire_seqlock()
+    {
+        for (std::atomic<uint64_t>& word : payload)
+            word.store(0, std::memory_order_relaxed);
+    }
+
+    bool try_load(T& out) const
+    {
+        uint64_t before = sequence.load(std::memory_order_acquire);
+        if (UNLIKELY(before & 1))
+            return false;
+        uint64_t copy[words];
+        for (size_t i = 0; i != words; ++i)
+            copy[i] = payload[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (UNLIKELY(sequence.load(std::memory_order_relaxed) != before))
+            return false;
+        std::memcpy(&out, copy, sizeof(T));
+        return true;
+    }
+
+    void store(const T& value)
+    {
+        uint64_t copy[words] = { };
+        std::memcpy(copy, &value, sizeof(T));
+        uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i != words; ++i)
+            payload[i].store(copy[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> sequence { 0 };
+    std::atomic<uint64_t> payload[words];
+};
+
+template<size_t Bytes>
+struct snapshot {
+    uint64_t fields[Bytes / sizeof(uint64_t)];
+};
+
+struct alignas(CACHE_LINE_SIZE) reader_result {
+    bench::latency_histogram latency;
+};
+
+struct options {
+    std::vector<size_t> readers;
+    uint64_t writeIntervalNs { 10000 };
+    uint64_t durationMs { 200 };
+    unsigned sample { 16 };
+};
+
+template<typename Lock, typename T>
+NEVER_INLINE bool read_once(const Lock& lock, T& out) {
+    for (unsigned spins = 0; !lock.try_load(out); ++spins) {
+        if (spins > 128)
+            std::this_thread::yield();
+    }
+    return true;
+}
+
+template<typename Lock, size_t Bytes>
+void run(const char* name, const options& opts, size_t readerCount) {
+    typedef snapshot<Bytes> value;
+    std::unique_ptr<Lock> lock(new Lock);
+    std::vector<reader_result> results(readerCount);
+    std::atomic<bool> stopWriter = false;
+    std::thread writer;
+    if (opts.writeIntervalNs) {
+        writer = std::thread([&] () {
+                value v { };
+                while (!stopWriter.load(std::memory_order_relaxed)) {
+                    for (uint64_t& field : v.fields)
+                        ++field;
+                    lock->store(v);
+                    uint64_t until = bench::now_ns() + opts.writeIntervalNs;
+                    while (bench::now_ns() < until && !stopWriter.load(std::memory_order_relaxed)) { }
+                }
+            });
+    }
+    double mops = bench::run_threads(readerCount, opts.durationMs, [&] (size_t r, const std::atomic<bool>& stop) {
+            uint64_t ops = 0;
+            uint64_t sum = 0;
+            value v;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (ops % opts.sample)
+                    read_once(*lock, v);
+                else {
+                    uint64_t start = bench::cycles();
+                    read_once(*lock, v);
+                    results[r].latency.record(bench::cycles() - start);
+                }
+                sum += v.fields[0];
+                ++ops;
+            }
+            bench::do_not_optimize(sum);
+            return ops;
+        });
+    stopWriter = true;
+    if (writer.joinable())
+        writer.join();
+
+    bench::latency_histogram total;
+    for (const reader_result& result : results)
+        total.merge(result.latency);
+    double nsPerCycle = 1 / bench::cycles_per_ns();
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::setw(8) << Bytes << std::setw(8) << readerCount
+              << std::fixed << std::setprecision(2) << std::setw(12) << mops
+              << std::setw(10) << total.percentile(0.5) * nsPerCycle
+              << std::setw(10) << total.percentile(0.99) * nsPerCycle
+              << std::setw(10) << total.percentile(0.999) * nsPerCycle << '\n';
+}
+
+template<size_t Bytes>
+void run_size(const options& opts) {
+    for (size_t readerCount : opts.readers) {
+        run<seqlock<snapshot<Bytes>>, Bytes>("consume", opts, readerCount);
+        run<acquire_seqlock<snapshot<Bytes>>, Bytes>("acquire", opts, readerCount);
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--readers"))
+            opts.readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--write-interval-ns"))
+            opts.writeIntervalNs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            opts.durationMs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--sample"))
+            opts.sample = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (opts.readers.empty())
+        opts.readers = bench::default_thread_counts();
+
+    std::cout << std::left << std::setw(10) << "# reader" << std::right
+              << std::setw(8) << "bytes" << std::setw(8) << "readers" << std::setw(12) << "Mops/s"
+              << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns" << std::setw(10) << "p999 ns" << '\n';
+    run_size<16>(opts);
+    run_size<64>(opts);
+    run_size<256>(opts);
+    run_size<1024>(opts);
+    return 0;
+}
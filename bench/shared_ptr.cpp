@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Atomic shared pointers: N pinned readers repeatedly read a published config
+// snapshot while M pinned writers replace it, comparing consume_shared_ptr
+// snapshots (and load_shared, which takes a reference) against libstdc++'s
+// atomic shared_ptr free functions and, when built as C++20,
+// std::atomic<std::shared_ptr>.
+//
+// Usage: bench_shared_ptr [--readers 1,2,4] [--writers M] [--write-interval-ns NS]
+//                         [--duration-ms MS]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "bench/bench.h"
+#include "consume_shared_ptr.h"
+
+namespace {
+
+struct Config {
+    explicit Config(uint64_t v) { for (uint64_t& word : words) word = v; }
+    uint64_t words[8];
+};
+
+inline uint64_t read_config(const Config& config) { return config.words[0] + config.words[7]; }
+
+struct ConsumeSnapshot {
+    static constexpr const char* name = "consume_shared_ptr";
+    explicit ConsumeSnapshot(std::shared_ptr<const Config> c) : ptr(std::move(c)) {}
+    uint64_t read() const { return read_config(*ptr.load().operator->()); }
+    void store(std::shared_ptr<const Config> c) { ptr.store(std::move(c)); }
+    consume_shared_ptr<const Config> ptr;
+};
+
+struct ConsumeShared {
+    static constexpr const char* name = "load_shared";
+    explicit ConsumeShared(std::shared_ptr<const Config> c) : ptr(std::move(c)) {}
+    uint64_t read() const { return read_config(*ptr.load_shared()); }
+    void store(std::shared_ptr<const Config> c) { ptr.store(std::move(c)); }
+    consume_shared_ptr<const Config> ptr;
+};
+
+// Deprecated in C++20 in favor of std::atomic<std::shared_ptr>.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+struct FreeFunctions {
+    static constexpr const char* name = "std::atomic_load";
+    explicit FreeFunctions(std::shared_ptr<const Config> c) : ptr(std::move(c)) {}
+    uint64_t read() const { return read_config(*std::atomic_load_explicit(&ptr, std::memory_order_acquire)); }
+    void store(std::shared_ptr<const Config> c) { std::atomic_store_explicit(&ptr, std::move(c), std::memory_order_release); }
+    std::shared_ptr<const Config> ptr;
+};
+#pragma GCC diagnostic pop
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+struct AtomicSharedPtr {
+    static constexpr const char* name = "atomic<shared_ptr>";
+    explicit AtomicSharedPtr(std::shared_ptr<const Config> c) : ptr(std::move(c)) {}
+    uint64_t read() const { return read_config(*ptr.load(std::memory_order_acquire)); }
+    void store(std::shared_ptr<const Config> c) { ptr.store(std::move(c), std::memory_order_release); }
+    std::atomic<std::shared_ptr<const Config>> ptr;
+};
+#endif
+
+struct alignas(CACHE_LINE_SIZE) Counter {
+    uint64_t ops { 0 };
+};
+
+struct Options {
+    std::vector<size_t> readers;
+    size_t writers { 1 };
+    uint64_t writeIntervalNs { 10000 };
+    uint64_t durationMs { 200 };
+};
+
+template<typename Holder>
+NEVER_INLINE void run(const Options& options, size_t readerCount) {
+    Holder holder(std::make_shared<const Config>(0));
+    std::atomic<bool> go = false;
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> ready = 0;
+    std::vector<Counter> reads(readerCount);
+    std::vector<Counter> writes(options.writers);
+    std::vector<std::thread> threads;
+
+    for (size_t r = 0; r != readerCount; ++r) {
+        threads.emplace_back([&, r] () {
+                bench::pin_to_cpu(r);
+                uint64_t sum = 0;
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                while (!stop.load(std::memory_order_relaxed)) {
+                    sum += holder.read();
+                    ++reads[r].ops;
+                }
+                bench::do_not_optimize(sum);
+            });
+    }
+
+    for (size_t w = 0; w != options.writers; ++w) {
+        threads.emplace_back([&, w] () {
+                bench::pin_to_cpu(readerCount + w);
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) { }
+                for (uint64_t v = 1; !stop.load(std::memory_order_relaxed); ++v) {
+                    holder.store(std::make_shared<const Config>(v));
+                    ++writes[w].ops;
+                    uint64_t until = bench::now_ns() + options.writeIntervalNs;
+                    while (bench::now_ns() < until) { }
+                }
+                hazard_pointer_domain::global().reclaim();
+            });
+    }
+
+    while (ready.load() != threads.size()) { }
+    uint64_t start = bench::now_ns();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.durationMs));
+    stop.store(true);
+    uint64_t elapsed = bench::now_ns() - start;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    uint64_t totalReads = 0;
+    uint64_t totalWrites = 0;
+    for (const Counter& counter : reads)
+        totalReads += counter.ops;
+    for (const Counter& counter : writes)
+        totalWrites += counter.ops;
+    double mops = totalReads * 1000.0 / elapsed;
+    std::cout << std::left << std::setw(20) << Holder::name << std::right
+              << std::setw(8) << readerCount << std::setw(8) << options.writers
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << mops << std::setw(12) << mops / readerCount
+              << std::setw(12) << totalWrites * 1000.0 / elapsed << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--readers"))
+            options.readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--writers"))
+            options.writers = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--write-interval-ns"))
+            options.writeIntervalNs = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            options.durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (options.readers.empty()) {
+        size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+        size_t available = cpus > options.writers ? cpus - options.writers : 1;
+        for (size_t n = 1; n < available; n *= 2)
+            options.readers.push_back(n);
+        options.readers.push_back(available);
+    }
+
+    std::cout << std::left << std::setw(20) << "# variant" << std::right
+              << std::setw(8) << "readers" << std::setw(8) << "writers"
+              << std::setw(12) << "Mops/s" << std::setw(12) << "Mops/s/thr"
+              << std::setw(12) << "Mswaps/s" << '\n';
+    for (size_t readerCount : options.readers) {
+        run<ConsumeSnapshot>(options, readerCount);
+        run<ConsumeShared>(options, readerCount);
+        run<FreeFunctions>(options, readerCount);
+#if defined(__cpp_lib_atomic_shared_ptr)
+        run<AtomicSharedPtr>(options, readerCount);
+#endif
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Skip list reads: consume_skip_list, with epoch and QSBR read sections,
+// against the same structure searched with acquire loads on every hop. Reader
+// threads either look up random keys or scan random ranges of --range entries.
+//
+// Usage: bench_skip_list [--keys N] [--range R] [--readers 1,2,4] [--duration-ms MS]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "bench/bench.h"
+#include "skip_list.h"
+
+namespace {
+
+// Same layout and insertion order as consume_skip_list, with acquire loads on
+// every hop and no support for erasure.
+class acquire_skip_list {
+public:
+    static constexpr unsigned max_height = consume_skip_list<uint64_t, uint64_t>::max_height;
+
+    acquire_skip_list() : head(create_node(0, 0, max_height)) {}
+
+    ~acquire_skip_list()
+    {
+        for (node* n = head; n; ) {
+            node* next = n->next[0].load(std::memory_order_relaxed);
+            ::operator delete(n);
+            n = next;
+        }
+    }
+
+    void insert(uint64_t key, uint64_t value)
+    {
+        node* preds[max_height];
+        node* x = head;
+        for (unsigned level = max_height; level--; ) {
+            for (node* next; (next = x->next[level].load(std::memory_order_relaxed)) && next->key < key; )
+                x = next;
+            preds[level] = x;
+        }
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        unsigned h = std::min<unsigned>(1 + count_trailing_zeros(rng | (uint64_t(1) << 63)) / 2, max_height);
+        node* n = create_node(key, value, h);
+        for (unsigned level = 0; level != h; ++level)
+            n->next[level].store(preds[level]->next[level].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (unsigned level = 0; level != h; ++level)
+            preds[level]->next[level].store(n, std::memory_order_release);
+        height = std::max(height, h);
+    }
+
+    bool find(uint64_t key, uint64_t& out) const
+    {
+        node* n = lower_bound(key);
+        if (!n || n->key != key)
+            return false;
+        out = n->value;
+        return true;
+    }
+
+    template<typename Visitor>
+    size_t scan(uint64_t low, uint64_t high, Visitor&& visit) const
+    {
+        size_t visited = 0;
+        for (node* n = lower_bound(low); n && n->key < high; n = n->next[0].load(std::memory_order_acquire), ++visited)
+            visit(n->key, n->value);
+        return visited;
+    }
+
+private:
+    struct node {
+        uint64_t key;
+        uint64_t value;
+        unsigned height;
+        std::atomic<node*> next[1];
+    };
+
+    static node* create_node(uint64_t key, uint64_t value, unsigned height)
+    {
+        node* n = static_cast<node*>(::operator new(sizeof(node) + (height - 1) * sizeof(std::atomic<node*>)));
+        n->key = key;
+        n->value = value;
+        n->height = height;
+        for (unsigned level = 0; level != height; ++level)
+            n->next[level].store(nullptr, std::memory_order_relaxed);
+        return n;
+    }
+
+    node* lower_bound(uint64_t key) const
+    {
+        node* x = head;
+        node* next = nullptr;
+        for (unsigned level = height; level--; ) {
+            while ((next = x->next[level].load(std::memory_order_acquire)) && next->key < key)
+                x = next;
+        }
+        return next;
+    }
+
+    node* head;
+    unsigned height { 1 };
+    uint64_t rng { 0x9e3779b97f4a7c15ull };
+};
+
+template<typename List>
+struct is_qsbr : std::false_type { };
+
+template<typename Key, typename Value, typename Compare>
+struct is_qsbr<consume_skip_list<Key, Value, Compare, rcu_qsbr>> : std::true_type { };
+
+template<typename List>
+NEVER_INLINE double run(const List& list, size_t keys, size_t range, size_t readerCount, uint64_t durationMs) {
+    return bench::run_threads(readerCount, durationMs, [&] (size_t r, const std::atomic<bool>& stop) {
+            uint64_t rng = 0x9e3779b97f4a7c15ull * (r + 1);
+            uint64_t ops = 0;
+            uint64_t sum = 0;
+            if (is_qsbr<List>::value)
+                rcu_register_thread<rcu_qsbr>();
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t key = bench::xorshift(rng) % keys;
+                if (!range) {
+                    uint64_t value = 0;
+                    if (UNLIKELY(!list.find(key, value)))
+                        abort();
+                    sum += value;
+                } else
+                    list.scan(key, key + range, [&] (uint64_t, uint64_t value) { sum += value; });
+                ++ops;
+                if (is_qsbr<List>::value && !(ops % 1024))
+                    rcu_quiescent_state();
+            }
+            if (is_qsbr<List>::value)
+                rcu_unregister_thread<rcu_qsbr>();
+            bench::do_not_optimize(sum);
+            return ops;
+        });
+}
+
+void report(const char* name, const char* operation, size_t readers, double mops) {
+    std::cout << std::left << std::setw(16) << name << std::setw(8) << operation << std::right
+              << std::setw(8) << readers << std::fixed << std::setprecision(2)
+              << std::setw(12) << mops << '\n';
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t keys = 1 << 20;
+    size_t range = 100;
+    std::vector<size_t> readers;
+    uint64_t durationMs = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--keys"))
+            keys = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--range"))
+            range = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--readers"))
+            readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    if (readers.empty())
+        readers = bench::default_thread_counts();
+
+    consume_skip_list<uint64_t, uint64_t> epochList;
+    consume_skip_list<uint64_t, uint64_t, std::less<uint64_t>, rcu_qsbr> qsbrList;
+    acquire_skip_list acquireList;
+    std::vector<size_t> order = bench::random_cycle(keys);
+    for (size_t key : order) {
+        epochList.insert(key, key);
+        qsbrList.insert(key, key);
+        acquireList.insert(key, key);
+    }
+
+    std::cout << std::left << std::setw(16) << "# list" << std::setw(8) << "op" << std::right
+              << std::setw(8) << "readers" << std::setw(12) << "Mops/s" << '\n';
+    std::string scan = "scan" + std::to_string(range);
+    for (size_t readerCount : readers) {
+        for (size_t r : { size_t(0), range }) {
+            const char* operation = r ? scan.c_str() : "lookup";
+            report("consume/epoch", operation, readerCount, run(epochList, keys, r, readerCount, durationMs));
+            report("consume/qsbr", operation, readerCount, run(qsbrList, keys, r, readerCount, durationMs));
+            report("acquire", operation, readerCount, run(acquireList, keys, r, readerCount, durationMs));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// 16-byte loads: chasing versioned pointers ({ Node*, counter } pairs) through
+// consume_load against the same chase with acquire loads of std::atomic, and
+// against an 8-byte consume_load chase of plain pointers. Then N pinned readers
+// hammer one shared 16-byte atomic, which shows what a load costs when it is a
+// locked read-modify-write, as cmpxchg16b is.
+//
+// On x86-64, consume_load only inlines its 16-byte load (a vmovdqa) when built
+// with AVX, as bench_wide_load_avx is. Otherwise both variants call libatomic,
+// which picks vmovdqa or cmpxchg16b at runtime.
+//
+// Usage: bench_wide_load [--hops N] [--sizes 16K,256K,8M,256M] [--readers 1,2,4] [--duration-ms MS]
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+struct Node;
+
+struct alignas(16) versioned {
+    Node* node;
+    uint64_t version;
+};
+
+struct alignas(CACHE_LINE_SIZE) Node {
+    std::atomic<versioned> wide;
+    std::atomic<Node*> narrow;
+};
+
+NEVER_INLINE Node* chase_consume(Node* cur, size_t hops)
+{
+    for (size_t h = 0; h != hops; ++h)
+        cur = consume_load(cur->wide).value().node;
+    return cur;
+}
+
+NEVER_INLINE Node* chase_acquire(Node* cur, size_t hops)
+{
+    for (size_t h = 0; h != hops; ++h)
+        cur = cur->wide.load(std::memory_order_acquire).node;
+    return cur;
+}
+
+NEVER_INLINE Node* chase_narrow(Node* cur, size_t hops)
+{
+    for (size_t h = 0; h != hops; ++h)
+        cur = consume_load(cur->narrow).value();
+    return cur;
+}
+
+typedef Node* (*Chase)(Node*, size_t);
+
+struct Variant {
+    const char* name;
+    Chase chase;
+};
+
+const Variant variants[] = {
+    { "consume_load(16 bytes)", chase_consume },
+    { "load(acquire, 16 bytes)", chase_acquire },
+    { "consume_load(8 bytes)", chase_narrow },
+};
+
+struct alignas(CACHE_LINE_SIZE) Shared {
+    std::atomic<versioned> value;
+};
+
+template<bool consume>
+uint64_t read_shared(const Shared& shared, const std::atomic<bool>& stop)
+{
+    uint64_t ops = 0;
+    uint64_t sum = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        for (unsigned i = 0; i != 64; ++i)
+            sum += consume ? consume_load(shared.value).value().version : shared.value.load(std::memory_order_acquire).version;
+        ops += 64;
+    }
+    bench::do_not_optimize(sum);
+    return ops;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    size_t hops = 1 << 22;
+    std::vector<size_t> sizes = { 16 << 10, 256 << 10, 8 << 20, 256 << 20 };
+    std::vector<size_t> readers = bench::default_thread_counts();
+    uint64_t durationMs = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--hops"))
+            hops = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--sizes"))
+            sizes = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--readers"))
+            readers = bench::parse_list(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--duration-ms"))
+            durationMs = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(26) << "# variant" << std::right
+              << std::setw(8) << "ws" << std::setw(10) << "ns/hop" << std::setw(12) << "cycles/hop" << '\n';
+    for (size_t size : sizes) {
+        size_t count = std::max<size_t>(size / sizeof(Node), 2);
+        std::unique_ptr<Node[]> nodes(new Node[count]);
+        std::vector<size_t> order = bench::random_cycle(count);
+        for (size_t i = 0; i != count; ++i) {
+            Node* next = &nodes[order[(i + 1) % count]];
+            nodes[order[i]].wide.store(versioned { next, i }, std::memory_order_relaxed);
+            nodes[order[i]].narrow.store(next, std::memory_order_relaxed);
+        }
+
+        for (const Variant& variant : variants) {
+            Node* cur = variant.chase(&nodes[0], count);
+            uint64_t startNs = bench::now_ns();
+            uint64_t startCycles = bench::cycles();
+            cur = variant.chase(cur, hops);
+            uint64_t endCycles = bench::cycles();
+            uint64_t endNs = bench::now_ns();
+            bench::do_not_optimize(cur);
+            std::cout << std::left << std::setw(26) << variant.name << std::right
+                      << std::setw(8) << bench::format_size(size)
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(10) << static_cast<double>(endNs - startNs) / hops
+                      << std::setw(12) << static_cast<double>(endCycles - startCycles) / hops << '\n';
+        }
+    }
+
+    Shared shared;
+    shared.value.store(versioned { nullptr, 1 }, std::memory_order_relaxed);
+    std::cout << '\n' << std::left << std::setw(26) << "# shared variant" << std::right
+              << std::setw(8) << "readers" << std::setw(12) << "Mops/s" << std::setw(12) << "Mops/s/thr" << '\n';
+    for (size_t readerCount : readers) {
+        for (bool consume : { true, false }) {
+            double mops = bench::run_threads(readerCount, durationMs, [&] (size_t, const std::atomic<bool>& stop) {
+                    return consume ? read_shared<true>(shared, stop) : read_shared<false>(shared, stop);
+                });
+            std::cout << std::left << std::setw(26) << (consume ? "consume_load(16 bytes)" : "load(acquire, 16 bytes)") << std::right
+                      << std::setw(8) << readerCount
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(12) << mops << std::setw(12) << mops / readerCount << '\n';
+        }
+    }
+    return 0;
+}
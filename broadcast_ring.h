@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef broadcast_ring_h
+#define broadcast_ring_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "consume.h"
+
+// A bounded single-producer, multi-consumer broadcast ring: every consumer
+// receives every message published after it subscribed.
+//
+// The producer writes a slot, then publishes the sequence with a release
+// store. Consumers consume_load the sequence and index the slot array through
+// a dependent_ptr built from the sequence's dependency, so no acquire load is
+// needed on the read side. A batched read covers every slot up to the consumed
+// sequence with that one dependency.
+//
+// Each consumer owns a cursor, padded to its own cache line, which it advances
+// with a release store once it is done with a batch. The producer only
+// overwrites a slot after every cursor has moved past it, so it stalls, rather
+// than drops messages, when the slowest consumer falls Capacity behind. It
+// reloads cursors only when it runs out of known room.
+template<typename T, size_t Capacity>
+class broadcast_ring {
+public:
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of two");
+
+    explicit broadcast_ring(size_t max_consumers = 64);
+    broadcast_ring(const broadcast_ring&) = delete;
+    broadcast_ring& operator=(const broadcast_ring&) = delete;
+
+    // Producer only. Returns false when the slowest consumer is Capacity
+    // messages behind.
+    bool try_publish(const T&);
+    void publish(const T&);
+
+    // Subscribes for as long as it lives. Aborts when max_consumers consumers
+    // are already subscribed.
+    class consumer {
+    public:
+        explicit consumer(broadcast_ring&);
+        ~consumer();
+        consumer(const consumer&) = delete;
+        consumer& operator=(const consumer&) = delete;
+
+        bool try_read(T&);
+
+        // Copies up to max messages into out, with a single consume_load of the
+        // sequence and a single cursor update. Returns how many were read.
+        size_t read(T* out, size_t max);
+
+        // Calls visit(const T&) on up to max messages in place.
+        template<typename Visitor> size_t read(Visitor&&, size_t max);
+
+    private:
+        broadcast_ring& ring;
+        size_t index;
+        uint64_t position;
+    };
+
+private:
+    struct alignas(CACHE_LINE_SIZE) slot {
+        T value;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) cursor {
+        // Next sequence the consumer will read, or UINT64_MAX when unclaimed.
+        std::atomic<uint64_t> position { UINT64_MAX };
+        bool claimed { false };
+    };
+
+    uint64_t min_position(uint64_t seq) const;
+
+    // Read-only after construction, and read by every consumer on every read,
+    // so nothing written at run time shares their line.
+    alignas(CACHE_LINE_SIZE) size_t max_consumers;
+    std::unique_ptr<cursor[]> cursors;
+    std::unique_ptr<slot[]> slots;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head { 0 };
+    // Producer-private: the next sequence and the lowest cursor last seen,
+    // which every publish writes.
+    alignas(CACHE_LINE_SIZE) uint64_t next { 0 };
+    uint64_t gate { 0 };
+    // Only taken to subscribe and unsubscribe.
+    alignas(CACHE_LINE_SIZE) std::mutex cursors_lock;
+};
+
+#include "broadcast_ring_impl.h"
+
+#endif
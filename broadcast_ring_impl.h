@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef broadcast_ring_impl_h
+#define broadcast_ring_impl_h
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+template<typename T, size_t Capacity>
+inline broadcast_ring<T, Capacity>::broadcast_ring(size_t max_consumers)
+    : max_consumers(max_consumers)
+    , cursors(new cursor[max_consumers])
+    , slots(new slot[Capacity])
+{
+}
+
+// Unclaimed cursors sit at UINT64_MAX, so they never hold the producer back.
+template<typename T, size_t Capacity>
+inline uint64_t broadcast_ring<T, Capacity>::min_position(uint64_t seq) const
+{
+    // Pairs with the fence in consumer's constructor: either this sees the new
+    // cursor, or the new consumer sees every sequence published so far.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t lowest = seq;
+    for (size_t i = 0; i != max_consumers; ++i)
+        lowest = std::min(lowest, cursors[i].position.load(std::memory_order_acquire));
+    return lowest;
+}
+
+template<typename T, size_t Capacity>
+inline bool broadcast_ring<T, Capacity>::try_publish(const T& value)
+{
+    uint64_t seq = next;
+    if (seq - gate >= Capacity) {
+        gate = min_position(seq);
+        if (seq - gate >= Capacity)
+            return false;
+    }
+    slots[seq & (Capacity - 1)].value = value;
+    next = seq + 1;
+    head.store(seq + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T, size_t Capacity>
+inline void broadcast_ring<T, Capacity>::publish(const T& value)
+{
+    for (unsigned spins = 0; !try_publish(value); ++spins) {
+        if (spins > 128)
+            std::this_thread::yield();
+    }
+}
+
+template<typename T, size_t Capacity>
+inline broadcast_ring<T, Capacity>::consumer::consumer(broadcast_ring& ring)
+    : ring(ring)
+{
+    {
+        std::lock_guard<std::mutex> locker(ring.cursors_lock);
+        for (index = 0; index != ring.max_consumers && ring.cursors[index].claimed; ++index) { }
+        if (index == ring.max_consumers)
+            abort();
+        ring.cursors[index].claimed = true;
+    }
+    // The producer may have skipped this cursor while computing its gate, in
+    // which case it can overwrite anything before the sequence it had reached.
+    // Starting from a sequence loaded after the fence avoids those slots.
+    cursor& c = ring.cursors[index];
+    c.position.store(ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    position = ring.head.load(std::memory_order_relaxed);
+    c.position.store(position, std::memory_order_relaxed);
+}
+
+template<typename T, size_t Capacity>
+inline broadcast_ring<T, Capacity>::consumer::~consumer()
+{
+    std::lock_guard<std::mutex> locker(ring.cursors_lock);
+    ring.cursors[index].position.store(UINT64_MAX, std::memory_order_release);
+    ring.cursors[index].claimed = false;
+}
+
+template<typename T, size_t Capacity>
+template<typename Visitor>
+inline size_t broadcast_ring<T, Capacity>::consumer::read(Visitor&& visit, size_t max)
+{
+    dependent<uint64_t> seq = consume_load(ring.head);
+    size_t available = static_cast<size_t>(__value(seq) - position);
+    if (!available)
+        return 0;
+    size_t count = available < max ? available : max;
+    dependent_ptr<slot> slots(ring.slots.get(), seq.dependency());
+    for (size_t i = 0; i != count; ++i)
+        visit(static_cast<const T&>(__pointer(slots)[(position + i) & (Capacity - 1)].value));
+    position += count;
+    ring.cursors[index].position.store(position, std::memory_order_release);
+    return count;
+}
+
+template<typename T, size_t Capacity>
+inline size_t broadcast_ring<T, Capacity>::consumer::read(T* out, size_t max)
+{
+    return read([&] (const T& value) { *out++ = value; }, max);
+}
+
+template<typename T, size_t Capacity>
+inline bool broadcast_ring<T, Capacity>::consumer::try_read(T& out)
+{
+    return read(&out, 1);
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef btree_h
+#define btree_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "consume.h"
+#include "node_arena.h"
+#include "rcu.h"
+
+// An ordered read-mostly map, as a B+tree whose searches take no locks and
+// execute no fences. Compared to consume_skip_list, it stores entries densely
+// and scans them from contiguous arrays.
+//
+// Every node starts with a cache-line-aligned array of up to `fanout` sorted
+// keys. Lookups consume the root and then hop down with consume_load(T**,
+// dependency); each node's keys are counted against the search key with SSE2
+// or NEON compares for 32-bit integer keys under std::less, AVX2 compares for
+// 64-bit ones, and a branch-free loop otherwise. The key array is addressed from the dependent
+// node pointer, so the count, the chosen child and the next hop all stay in
+// the chain. Leaves are linked to their successors, and range scans follow
+// those links instead of climbing back up the tree.
+//
+// Published nodes are immutable, except for the sibling links. Writers,
+// serialized by a mutex, copy the path from the root to the leaf they change,
+// splitting full nodes on the way back up, publish the new root with one
+// release store, point the preceding leaf at the copy, and reclaim the
+// replaced nodes through RCU. Lookups see either the old tree or the new one;
+// a scan crossing leaves sees each leaf as of when it reaches it. Nodes
+// aren't merged when they underflow, but leaves which empty are dropped.
+//
+// Nodes come from node_arena. Readers must be inside an RCU read section of
+// the tree's flavor while they use results from lookup() or while scanning;
+// find() and scan() enter one themselves.
+template<typename Key, typename Value, typename Compare = std::less<Key>, typename Flavor = rcu_epoch>
+class consume_btree {
+public:
+    // Keys per node: 128 bytes' worth, two lines on most cores, and at least 4.
+    static constexpr unsigned fanout = sizeof(Key) > 32 ? 4 : 128 / sizeof(Key);
+
+    consume_btree();
+    ~consume_btree();
+    consume_btree(const consume_btree&) = delete;
+    consume_btree& operator=(const consume_btree&) = delete;
+
+    // Readers.
+
+    // The value for key, or null. The pointer carries the search's dependency
+    // chain, and stays valid until the enclosing read section ends.
+    dependent_ptr<const Value> lookup(const Key&) const;
+
+    // Copies the value for key into out, within its own read section.
+    bool find(const Key&, Value& out) const;
+
+    // Calls visit(key, value) in order for every entry in [low, high), within
+    // its own read section, and returns the number of entries visited.
+    template<typename Visitor> size_t scan(const Key& low, const Key& high, Visitor&&) const;
+
+    // Writers.
+
+    // Returns false, leaving the tree unchanged, if key is already present.
+    bool insert(const Key&, const Value&);
+    // Returns false, leaving the tree unchanged, if key is absent.
+    bool replace(const Key&, const Value&);
+    bool erase(const Key&);
+
+    size_t size() const;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) node {
+        Key keys[fanout] { };
+        uint32_t count { 0 };
+        // Zero for leaves.
+        uint32_t level { 0 };
+    };
+
+    // Child i holds the keys in [keys[i - 1], keys[i]).
+    struct inner : node {
+        node* children[fanout + 1] { };
+    };
+
+    struct leaf : node {
+        leaf* next { nullptr };
+        Value values[fanout] { };
+    };
+
+    // A writer's way down: the inner nodes, and the child taken in each.
+    struct step {
+        inner* parent;
+        unsigned index;
+    };
+
+    // What replaces a node on the way back up: nothing, one node, or two
+    // nodes split at a separator.
+    struct replacement {
+        node* left;
+        node* right;
+        Key separator;
+    };
+
+    static std::atomic<leaf*>& as_atomic(leaf*&);
+    static void destroy(node*);
+    static void destroy_tree(node*);
+    dependent_ptr<leaf> find_leaf(const Key&) const;
+
+    leaf* descend(const Key&, std::vector<step>&) const;
+    static leaf* predecessor(const std::vector<step>&);
+    void commit(std::vector<step>&, leaf* old, replacement);
+
+    std::atomic<node*> root;
+    size_t count { 0 };
+    mutable std::mutex writer_lock;
+    Compare less;
+};
+
+#include "btree_impl.h"
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef btree_impl_h
+#define btree_impl_h
+
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if CPU(ARM64) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+#if CPU(ARM64)
+constexpr bool __btree_unsigned_compares = true;
+#else
+constexpr bool __btree_unsigned_compares = false;
+#endif
+
+// How many of a node's first count keys are less than key or, with OrEqual,
+// not greater. Keys are sorted, so that's the index of the first key which
+// isn't. All N keys are read, so the array must be N long; only the first
+// count are counted.
+template<bool OrEqual, unsigned N, typename Key, typename Compare>
+inline unsigned __btree_rank(const Key* keys, unsigned count, const Key& key, const Compare& less)
+{
+    unsigned rank = 0;
+    for (unsigned i = 0; i != count; ++i)
+        rank += OrEqual ? !less(key, keys[i]) : less(keys[i], key);
+    return rank;
+}
+
+// Integer keys under std::less compare a vector at a time. Each flavor of
+// compare is either signed or unsigned only, so keys of the other signedness
+// are flipped at the top bit first, which preserves their order. Matching
+// lanes are all ones, so subtracting them counts them, and lanes past count
+// are masked off by comparing their index against it.
+#if defined(__SSE2__) || (CPU(ARM64) && defined(__ARM_NEON))
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank32(const uint32_t* keys, unsigned count, uint32_t key, uint32_t flip)
+{
+    static_assert(!(N % 4), "Nodes hold whole vectors of keys");
+#if defined(__SSE2__)
+    __m128i flips = _mm_set1_epi32(static_cast<int>(flip));
+    __m128i k = _mm_set1_epi32(static_cast<int>(key ^ flip));
+    __m128i limit = _mm_set1_epi32(static_cast<int>(count));
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i rank = _mm_setzero_si128();
+    for (unsigned i = 0; i != N; i += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flips);
+        __m128i valid = _mm_cmpgt_epi32(limit, index);
+        __m128i matches = OrEqual ? _mm_andnot_si128(_mm_cmpgt_epi32(v, k), valid) : _mm_and_si128(_mm_cmpgt_epi32(k, v), valid);
+        rank = _mm_sub_epi32(rank, matches);
+        index = _mm_add_epi32(index, _mm_set1_epi32(4));
+    }
+    rank = _mm_add_epi32(rank, _mm_shuffle_epi32(rank, _MM_SHUFFLE(1, 0, 3, 2)));
+    rank = _mm_add_epi32(rank, _mm_shuffle_epi32(rank, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<unsigned>(_mm_cvtsi128_si32(rank));
+#else
+    static const uint32_t lanes[4] = { 0, 1, 2, 3 };
+    uint32x4_t flips = vdupq_n_u32(flip);
+    uint32x4_t k = vdupq_n_u32(key ^ flip);
+    uint32x4_t limit = vdupq_n_u32(count);
+    uint32x4_t index = vld1q_u32(lanes);
+    uint32x4_t rank = vdupq_n_u32(0);
+    for (unsigned i = 0; i != N; i += 4) {
+        uint32x4_t v = veorq_u32(vld1q_u32(keys + i), flips);
+        uint32x4_t matches = OrEqual ? vcleq_u32(v, k) : vcltq_u32(v, k);
+        rank = vsubq_u32(rank, vandq_u32(matches, vcltq_u32(index, limit)));
+        index = vaddq_u32(index, vdupq_n_u32(4));
+    }
+    return vaddvq_u32(rank);
+#endif
+}
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank(const uint32_t* keys, unsigned count, const uint32_t& key, const std::less<uint32_t>&)
+{
+    return __btree_rank32<OrEqual, N>(keys, count, key, __btree_unsigned_compares ? 0 : 1u << 31);
+}
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank(const int32_t* keys, unsigned count, const int32_t& key, const std::less<int32_t>&)
+{
+    return __btree_rank32<OrEqual, N>(reinterpret_cast<const uint32_t*>(keys), count, static_cast<uint32_t>(key), __btree_unsigned_compares ? 1u << 31 : 0);
+}
+
+#endif
+
+// Two 64-bit lanes don't beat the scalar loop, which compiles to a compare and
+// an add with carry per key, but four do.
+#if defined(__AVX2__)
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank64(const uint64_t* keys, unsigned count, uint64_t key, uint64_t flip)
+{
+    static_assert(!(N % 4), "Nodes hold whole vectors of keys");
+    __m256i flips = _mm256_set1_epi64x(static_cast<long long>(flip));
+    __m256i k = _mm256_set1_epi64x(static_cast<long long>(key ^ flip));
+    __m256i limit = _mm256_set1_epi64x(count);
+    __m256i index = _mm256_setr_epi64x(0, 1, 2, 3);
+    __m256i rank = _mm256_setzero_si256();
+    for (unsigned i = 0; i != N; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), flips);
+        __m256i valid = _mm256_cmpgt_epi64(limit, index);
+        __m256i matches = OrEqual ? _mm256_andnot_si256(_mm256_cmpgt_epi64(v, k), valid) : _mm256_and_si256(_mm256_cmpgt_epi64(k, v), valid);
+        rank = _mm256_sub_epi64(rank, matches);
+        index = _mm256_add_epi64(index, _mm256_set1_epi64x(4));
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(rank), _mm256_extracti128_si256(rank, 1));
+    return static_cast<unsigned>(_mm_cvtsi128_si64(_mm_add_epi64(half, _mm_unpackhi_epi64(half, half))));
+}
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank(const uint64_t* keys, unsigned count, const uint64_t& key, const std::less<uint64_t>&)
+{
+    return __btree_rank64<OrEqual, N>(keys, count, key, 1ull << 63);
+}
+
+template<bool OrEqual, unsigned N>
+inline unsigned __btree_rank(const int64_t* keys, unsigned count, const int64_t& key, const std::less<int64_t>&)
+{
+    return __btree_rank64<OrEqual, N>(reinterpret_cast<const uint64_t*>(keys), count, static_cast<uint64_t>(key), 0);
+}
+
+#endif
+
+} // anonymous namespace
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline consume_btree<Key, Value, Compare, Flavor>::consume_btree()
+    : root(arena_new<leaf>())
+{
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline consume_btree<Key, Value, Compare, Flavor>::~consume_btree()
+{
+    destroy_tree(root.load(std::memory_order_relaxed));
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline std::atomic<typename consume_btree<Key, Value, Compare, Flavor>::leaf*>& consume_btree<Key, Value, Compare, Flavor>::as_atomic(leaf*& link)
+{
+    static_assert(sizeof(leaf*) == sizeof(std::atomic<leaf*>), "The cast below relies on this fact");
+    return reinterpret_cast<std::atomic<leaf*>&>(link);
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline void consume_btree<Key, Value, Compare, Flavor>::destroy(node* n)
+{
+    if (n->level)
+        arena_delete(static_cast<inner*>(n));
+    else
+        arena_delete(static_cast<leaf*>(n));
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline void consume_btree<Key, Value, Compare, Flavor>::destroy_tree(node* n)
+{
+    if (n->level) {
+        inner* in = static_cast<inner*>(n);
+        for (unsigned i = 0; i <= in->count; ++i)
+            destroy_tree(in->children[i]);
+    }
+    destroy(n);
+}
+
+// The leaf whose range holds key. Only the child links need consume_load:
+// everything else in a published inner node is read through its dependent
+// pointer, including the keys that pick the child.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline dependent_ptr<typename consume_btree<Key, Value, Compare, Flavor>::leaf> consume_btree<Key, Value, Compare, Flavor>::find_leaf(const Key& key) const
+{
+    dependent_ptr<node> n = consume_load(root);
+    while (__pointer(n)->level) {
+        inner* in = static_cast<inner*>(__pointer(n));
+        unsigned i = __btree_rank<true, fanout>(in->keys, in->count, key, less);
+        n = consume_load(&in->children[i], n.dependency());
+    }
+    return dependent_ptr<leaf>(static_cast<leaf*>(__pointer(n)), n.dependency());
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline dependent_ptr<const Value> consume_btree<Key, Value, Compare, Flavor>::lookup(const Key& key) const
+{
+    dependent_ptr<leaf> l = find_leaf(key);
+    leaf* raw = __pointer(l);
+    unsigned i = __btree_rank<false, fanout>(raw->keys, raw->count, key, less);
+    if (i == raw->count || less(key, raw->keys[i]))
+        return nullptr;
+    return dependent_ptr<const Value>(&raw->values[i], l.dependency());
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_btree<Key, Value, Compare, Flavor>::find(const Key& key, Value& out) const
+{
+    rcu_read_guard<Flavor> guard;
+    dependent_ptr<const Value> value = lookup(key);
+    if (!__pointer(value))
+        return false;
+    out = *__pointer(value);
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+template<typename Visitor>
+inline size_t consume_btree<Key, Value, Compare, Flavor>::scan(const Key& low, const Key& high, Visitor&& visit) const
+{
+    rcu_read_guard<Flavor> guard;
+    size_t visited = 0;
+    dependent_ptr<leaf> l = find_leaf(low);
+    unsigned i = __btree_rank<false, fanout>(__pointer(l)->keys, __pointer(l)->count, low, less);
+    for (;;) {
+        leaf* raw = __pointer(l);
+        for (; i != raw->count; ++i, ++visited) {
+            if (!less(raw->keys[i], high))
+                return visited;
+            visit(raw->keys[i], raw->values[i]);
+        }
+        l = consume_load(&raw->next, l.dependency());
+        if (!__pointer(l))
+            return visited;
+        i = 0;
+    }
+}
+
+// Writers only. Fills path with the inner nodes above key's leaf.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline typename consume_btree<Key, Value, Compare, Flavor>::leaf* consume_btree<Key, Value, Compare, Flavor>::descend(const Key& key, std::vector<step>& path) const
+{
+    node* n = root.load(std::memory_order_relaxed);
+    while (n->level) {
+        inner* in = static_cast<inner*>(n);
+        unsigned i = __btree_rank<true, fanout>(in->keys, in->count, key, less);
+        path.push_back(step { in, i });
+        n = in->children[i];
+    }
+    return static_cast<leaf*>(n);
+}
+
+// The leaf before the path's leaf, or null: the rightmost leaf under the
+// nearest left sibling of any node on the path.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline typename consume_btree<Key, Value, Compare, Flavor>::leaf* consume_btree<Key, Value, Compare, Flavor>::predecessor(const std::vector<step>& path)
+{
+    for (size_t depth = path.size(); depth--; ) {
+        if (!path[depth].index)
+            continue;
+        node* n = path[depth].parent->children[path[depth].index - 1];
+        while (n->level)
+            n = static_cast<inner*>(n)->children[n->count];
+        return static_cast<leaf*>(n);
+    }
+    return nullptr;
+}
+
+// Replaces the path's leaf, old, with r, copying the inner nodes above it and
+// splitting or dropping them as needed, publishes the new root, relinks the
+// preceding leaf, and retires every replaced node behind one grace period.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline void consume_btree<Key, Value, Compare, Flavor>::commit(std::vector<step>& path, leaf* old, replacement r)
+{
+    std::vector<node*> retired { old };
+    std::vector<node*> created;
+    leaf* pred = predecessor(path);
+    leaf* successor = old->next;
+    if (r.left) {
+        leaf* left = static_cast<leaf*>(r.left);
+        if (r.right) {
+            left->next = static_cast<leaf*>(r.right);
+            static_cast<leaf*>(r.right)->next = old->next;
+        } else
+            left->next = old->next;
+        successor = left;
+    }
+
+    for (size_t depth = path.size(); depth--; ) {
+        inner* parent = path[depth].parent;
+        unsigned i = path[depth].index;
+        retired.push_back(parent);
+        if (!r.left) {
+            // The child was dropped. So is a parent left without children.
+            if (!parent->count)
+                continue;
+            inner* copy = arena_new<inner>(*parent);
+            created.push_back(copy);
+            unsigned k = i ? i - 1 : 0;
+            std::copy(parent->keys + k + 1, parent->keys + parent->count, copy->keys + k);
+            std::copy(parent->children + i + 1, parent->children + parent->count + 1, copy->children + i);
+            --copy->count;
+            r = replacement { copy, nullptr, Key() };
+            continue;
+        }
+        if (!r.right) {
+            inner* copy = arena_new<inner>(*parent);
+            created.push_back(copy);
+            copy->children[i] = r.left;
+            r = replacement { copy, nullptr, Key() };
+            continue;
+        }
+
+        // The child split: its right half goes after it, behind the separator.
+        // Build the parent's keys and children with the insertion, then copy
+        // them into one node or split them over two.
+        Key keys[fanout + 1];
+        node* children[fanout + 2];
+        std::copy(parent->keys, parent->keys + i, keys);
+        keys[i] = r.separator;
+        std::copy(parent->keys + i, parent->keys + parent->count, keys + i + 1);
+        std::copy(parent->children, parent->children + i, children);
+        children[i] = r.left;
+        children[i + 1] = r.right;
+        std::copy(parent->children + i + 1, parent->children + parent->count + 1, children + i + 2);
+        unsigned total = parent->count + 1;
+
+        inner* left = arena_new<inner>();
+        created.push_back(left);
+        left->level = parent->level;
+        if (total <= fanout) {
+            std::copy(keys, keys + total, left->keys);
+            std::copy(children, children + total + 1, left->children);
+            left->count = total;
+            r = replacement { left, nullptr, Key() };
+            continue;
+        }
+        // The middle key moves up rather than staying in either half.
+        unsigned half = total / 2;
+        inner* right = arena_new<inner>();
+        created.push_back(right);
+        right->level = parent->level;
+        std::copy(keys, keys + half, left->keys);
+        std::copy(children, children + half + 1, left->children);
+        left->count = half;
+        std::copy(keys + half + 1, keys + total, right->keys);
+        std::copy(children + half + 1, children + total + 1, right->children);
+        right->count = total - half - 1;
+        r = replacement { left, right, keys[half] };
+    }
+
+    // The root is never dropped: it has at least two children once a commit
+    // is done, so dropping one still leaves a copy. It grows a level on a
+    // split, and loses levels while left with one child, since inner nodes
+    // below it may be down to a single child too.
+    node* top = r.left;
+    if (r.right) {
+        inner* grown = arena_new<inner>();
+        grown->level = r.left->level + 1;
+        grown->keys[0] = r.separator;
+        grown->children[0] = r.left;
+        grown->children[1] = r.right;
+        grown->count = 1;
+        created.push_back(grown);
+        top = grown;
+    }
+    while (top->level && !top->count) {
+        // Nodes this commit built were never published, so they can go right
+        // away. A sibling left as the only child may still have readers.
+        node* child = static_cast<inner*>(top)->children[0];
+        if (std::find(created.begin(), created.end(), top) != created.end())
+            destroy(top);
+        else
+            retired.push_back(top);
+        top = child;
+    }
+
+    rcu_assign_pointer(root, top);
+    if (pred)
+        as_atomic(pred->next).store(successor, std::memory_order_release);
+
+    struct deferred : rcu_head {
+        std::vector<node*> nodes;
+    };
+    deferred* d = new deferred;
+    d->nodes.swap(retired);
+    call_rcu<Flavor>(d, [] (rcu_head* head) {
+            deferred* d = static_cast<deferred*>(head);
+            for (node* n : d->nodes)
+                destroy(n);
+            delete d;
+        });
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_btree<Key, Value, Compare, Flavor>::insert(const Key& key, const Value& value)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    std::vector<step> path;
+    leaf* old = descend(key, path);
+    unsigned pos = __btree_rank<false, fanout>(old->keys, old->count, key, less);
+    if (pos != old->count && !less(key, old->keys[pos]))
+        return false;
+
+    // Entry i of the leaf with the new entry inserted at pos.
+    auto keyAt = [&] (unsigned i) -> const Key& { return i < pos ? old->keys[i] : i == pos ? key : old->keys[i - 1]; };
+    auto valueAt = [&] (unsigned i) -> const Value& { return i < pos ? old->values[i] : i == pos ? value : old->values[i - 1]; };
+    unsigned total = old->count + 1;
+    unsigned half = total <= fanout ? total : total / 2;
+    leaf* left = arena_new<leaf>();
+    for (unsigned i = 0; i != half; ++i) {
+        left->keys[i] = keyAt(i);
+        left->values[i] = valueAt(i);
+    }
+    left->count = half;
+    leaf* right = nullptr;
+    if (half != total) {
+        right = arena_new<leaf>();
+        for (unsigned i = half; i != total; ++i) {
+            right->keys[i - half] = keyAt(i);
+            right->values[i - half] = valueAt(i);
+        }
+        right->count = total - half;
+    }
+    commit(path, old, replacement { left, right, right ? right->keys[0] : Key() });
+    ++count;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_btree<Key, Value, Compare, Flavor>::replace(const Key& key, const Value& value)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    std::vector<step> path;
+    leaf* old = descend(key, path);
+    unsigned pos = __btree_rank<false, fanout>(old->keys, old->count, key, less);
+    if (pos == old->count || less(key, old->keys[pos]))
+        return false;
+    leaf* copy = arena_new<leaf>(*old);
+    copy->values[pos] = value;
+    commit(path, old, replacement { copy, nullptr, Key() });
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_btree<Key, Value, Compare, Flavor>::erase(const Key& key)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    std::vector<step> path;
+    leaf* old = descend(key, path);
+    unsigned pos = __btree_rank<false, fanout>(old->keys, old->count, key, less);
+    if (pos == old->count || less(key, old->keys[pos]))
+        return false;
+    // The root leaf stays even when empty.
+    leaf* copy = nullptr;
+    if (old->count > 1 || path.empty()) {
+        copy = arena_new<leaf>(*old);
+        std::copy(old->keys + pos + 1, old->keys + old->count, copy->keys + pos);
+        std::copy(old->values + pos + 1, old->values + old->count, copy->values + pos);
+        --copy->count;
+    }
+    commit(path, old, replacement { copy, nullptr, Key() });
+    --count;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline size_t consume_btree<Key, Value, Compare, Flavor>::size() const
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    return count;
+}
+
+#endif
@@ -23,9 +23,29 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include <thread>
+#include <vector>
+#include "broadcast_ring.h"
+#include "btree.h"
 #include "consume.h"
+#include "consume_shared_ptr.h"
+#include "dependent_memory.h"
+#include "dependent_span.h"
+#include "hash_map.h"
+#include "hazard_pointer.h"
+#include "node_arena.h"
+#include "publish_batch.h"
+#include "radix_tree.h"
+#include "rcu.h"
+#include "seqlock.h"
+#include "skip_list.h"
+#include "tagged_ptr.h"
 
 #define CHECK_EQ(GOT, EXPECT) do {                                      \
         auto got = (GOT);                                               \
@@ -37,6 +57,15 @@
         }                                                               \
     } while (false)
 
+// Dependencies travel inside the values, at no cost in size.
+static_assert(sizeof(dependent<uint8_t>) == sizeof(uint8_t), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent<uint16_t>) == sizeof(uint16_t), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent<uint32_t>) == sizeof(uint32_t), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent<uint64_t>) == sizeof(uint64_t), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent<float>) == sizeof(float), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent<double>) == sizeof(double), "dependent<T> must be as small as T");
+static_assert(sizeof(dependent_ptr<uint32_t>) == sizeof(uint32_t*), "dependent_ptr<T> must be as small as T*");
+
 template<typename T>
 NEVER_INLINE dependent<T> test(const std::atomic<T> &location) {
     COMPILER_FENCE();
@@ -45,7 +74,7 @@ NEVER_INLINE dependent<T> test(const std::atomic<T> &location) {
     // Reach into the implementation to check the value is zero. This is
     // important when creating chains because the offset provided by the
     // dependency must be zero.
-    CHECK_EQ(bit_cast<unsigned>(loaded.dependency), 0u);
+    CHECK_EQ(bit_cast<unsigned>(loaded.dependency()), 0u);
     return loaded;
 }
 
@@ -61,44 +90,44 @@ int main() {
     {
         std::atomic<uint8_t> value = 42;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42u);
+        CHECK_EQ(consumed.value(), 42u);
     }
 
     {
         std::atomic<uint16_t> value = 42;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42u);
+        CHECK_EQ(consumed.value(), 42u);
     }
 
     {
         std::atomic<uint32_t> value = 42;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42u);
+        CHECK_EQ(consumed.value(), 42u);
     }
 
     {
         std::atomic<uint64_t> value = 42;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42u);
+        CHECK_EQ(consumed.value(), 42u);
     }
 
     {
         std::atomic<float> value = 42.f;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42.f);
+        CHECK_EQ(consumed.value(), 42.f);
     }
 
     {
         std::atomic<double> value = 42.;
         auto consumed = test(value);
-        CHECK_EQ(consumed.value, 42.);
+        CHECK_EQ(consumed.value(), 42.);
     }
 
     {
         const char* hello = "hello";
         std::atomic<const char**> ptr = &hello;
         auto consumed = test(ptr);
-        CHECK_EQ((*consumed).value, hello);
+        CHECK_EQ((*consumed).value(), hello);
     }
 
     {
@@ -107,6 +136,101 @@ int main() {
         CHECK_EQ(consumed.value(), &main);
     }
 
+    {
+        uint32_t leaf = 42;
+        uint32_t* middle = &leaf;
+        std::atomic<uint32_t**> root = &middle;
+        dependent_ptr<uint32_t*> consumed = test(root);
+        dependent_ptr<uint32_t> chained = consume_load(consumed);
+        CHECK_EQ(chained.value(), &leaf);
+        CHECK_EQ(consume_load(chained).value(), 42u);
+        CHECK_EQ(consume_load(&middle, consumed.dependency()).value(), &leaf);
+        CHECK_EQ(consume_load(&leaf, chained.dependency()).value(), 42u);
+        CHECK_EQ(dependent<uint32_t>(7, chained.dependency()).value(), 7u);
+        CHECK_EQ(dependent<double>(0.5, chained.dependency()).value(), 0.5);
+        CHECK_EQ(dependent_ptr<uint32_t>(dependent<uintptr_t>(reinterpret_cast<uintptr_t>(&leaf), chained.dependency())).value(), &leaf);
+    }
+
+    {
+        // Member projection follows fields without spelling out dependencies.
+        struct node { node* next; uint64_t key; std::atomic<node*> link; std::atomic<uint32_t> count; };
+        node last { nullptr, 3, { nullptr }, { 30 } };
+        node middle { &last, 2, { &last }, { 20 } };
+        node first { &middle, 1, { &middle }, { 10 } };
+        std::atomic<node*> head(&first);
+        dependent_ptr<node> p = consume_load(head);
+        CHECK_EQ(p.field(&node::key).value(), 1u);
+        CHECK_EQ(p.member(&node::next).member(&node::next).value(), &last);
+        CHECK_EQ(p.member(&node::link).field(&node::count).value(), 20u);
+        CHECK_EQ(p.member(&node::next).member(&node::link).field(&node::key).value(), 3u);
+        CHECK_EQ(p.field(&node::next).value(), &middle);
+        dependent_ptr<const node> constant = p.value();
+        CHECK_EQ(constant.member(&node::next).field(&node::key).value(), 2u);
+        CHECK_EQ(constant.field(&node::count).value(), 10u);
+    }
+
+    {
+        // Prefetching leaves the pointer alone, and prefetch_through is member.
+        struct node { node* next; uint64_t key; std::atomic<node*> link; };
+        node last { nullptr, 2, { nullptr } };
+        node first { &last, 1, { &last } };
+        std::atomic<node*> head(&first);
+        dependent_ptr<node> p = consume_load(head);
+        p.prefetch();
+        p.prefetch(4);
+        p.prefetch(&node::key);
+        CHECK_EQ(p.value(), &first);
+        CHECK_EQ(p.prefetch_through(&node::next).field(&node::key).value(), 2u);
+        CHECK_EQ(p.prefetch_through(&node::link, 2).value(), &last);
+        CHECK_EQ(p.member(&node::next).prefetch_through(&node::next).value(), nullptr);
+    }
+
+    {
+        // 128-bit values depend on both halves, and still yield a zero.
+        struct versioned { uint64_t address; uint64_t version; };
+        uint32_t leaf = 42;
+        dependency d(versioned { reinterpret_cast<uintptr_t>(&leaf), 7 });
+        CHECK_EQ(bit_cast<unsigned>(d), 0u);
+        CHECK_EQ(consume_load(&leaf, d).value(), 42u);
+    }
+
+    {
+        // 16-byte atomics and small structs are consumed whole, and their
+        // dependencies order later loads.
+        struct alignas(16) versioned { uint32_t* ptr; uint64_t version; };
+        struct packed { uint16_t a; uint16_t b; uint32_t c; };
+        uint32_t leaf = 42;
+        std::atomic<versioned> root(versioned { &leaf, 7 });
+        dependent<versioned> consumed = consume_load(root);
+        CHECK_EQ(consumed.value().ptr, &leaf);
+        CHECK_EQ(consumed.value().version, 7u);
+        CHECK_EQ(consume_load(consumed.value().ptr, consumed.dependency()).value(), 42u);
+        CHECK_EQ(dependent<versioned>(consumed.value(), consumed.dependency()).value().ptr, &leaf);
+        versioned copy = consumed.value();
+        CHECK_EQ(consume_load(&copy, consumed.dependency()).value().version, 7u);
+        std::atomic<packed> small(packed { 1, 2, 3 });
+        dependent<packed> fields = consume_load(small);
+        CHECK_EQ(fields.value().c, 3u);
+        CHECK_EQ(consume_load(&leaf, fields.dependency()).value(), 42u);
+    }
+
+    {
+        // 16-byte loads are never torn.
+        struct alignas(16) pair { uint64_t low; uint64_t high; };
+        std::atomic<pair> shared(pair { 0, ~uint64_t(0) });
+        std::atomic<bool> done = false;
+        std::thread writer([&] () {
+                for (uint64_t i = 1; i != 100000; ++i)
+                    shared.store(pair { i, ~i }, std::memory_order_release);
+                done.store(true);
+            });
+        while (!done.load()) {
+            pair read = consume_load(shared).value();
+            CHECK_EQ(read.high, ~read.low);
+        }
+        writer.join();
+    }
+
     {
         std::atomic<bool> ready = false;
         constexpr size_t num = 1024;
@@ -118,10 +242,19 @@ int main() {
             });
         do {
             auto consumed = test(ready);
-            if (consumed.value) {
-                dependent_ptr<uint32_t> dependent_vec(vec, consumed.dependency);
+            if (consumed.value()) {
+                dependent_ptr<uint32_t> dependent_vec(vec, consumed.dependency());
                 for (size_t i = 0; i != num; ++i)
-                    CHECK_EQ(dependent_vec[i].value, i * 2);
+                    CHECK_EQ(dependent_vec[i].value(), i * 2);
+                // The same reads, with the dependency derived once.
+                dependent_span<const uint32_t> span(dependent_span<uint32_t>(vec, num, consumed.dependency()));
+                size_t i = 0;
+                for (uint32_t element : span)
+                    CHECK_EQ(element, i++ * 2);
+                CHECK_EQ(std::accumulate(span.begin(), span.end(), uint64_t(0)), uint64_t(num) * (num - 1));
+                CHECK_EQ(span.subspan(10, 4).back(), 26u);
+                CHECK_EQ(span.last(1)[0], (num - 1) * 2);
+                CHECK_EQ(*span.rbegin(), (num - 1) * 2);
                 break;
             }
         } while (true);
@@ -129,5 +262,838 @@ int main() {
         delete[] vec;
     }
 
+    {
+        // Epoch RCU: a node is never poisoned while a reader can reach it.
+        struct Node { uint64_t value; };
+        constexpr uint64_t poison = ~0ull;
+        std::atomic<Node*> root = new Node { 0 };
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int r = 0; r != 2; ++r) {
+            readers.emplace_back([&] () {
+                    while (!done.load(std::memory_order_relaxed)) {
+                        rcu_read_guard<> guard;
+                        dependent_ptr<Node> node = consume_load(root);
+                        CHECK_EQ(node->value == poison, false);
+                    }
+                });
+        }
+        for (uint64_t i = 1; i != 256; ++i) {
+            Node* old = root.load(std::memory_order_relaxed);
+            rcu_assign_pointer(root, new Node { i });
+            synchronize_rcu();
+            old->value = poison;
+            delete old;
+        }
+        done = true;
+        for (std::thread& reader : readers)
+            reader.join();
+        delete root.load();
+    }
+
+    {
+        // QSBR RCU with batched call_rcu.
+        struct Node {
+            rcu_head head;
+            uint64_t value;
+        };
+        constexpr uint64_t poison = ~0ull;
+        static std::atomic<unsigned> reclaimed;
+        reclaimed = 0;
+        auto reclaim = [] (rcu_head* head) {
+            Node* node = reinterpret_cast<Node*>(head);
+            node->value = poison;
+            delete node;
+            reclaimed.fetch_add(1);
+        };
+        std::atomic<Node*> root = new Node { { }, 0 };
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int r = 0; r != 2; ++r) {
+            readers.emplace_back([&] () {
+                    rcu_register_thread<rcu_qsbr>();
+                    while (!done.load(std::memory_order_relaxed)) {
+                        rcu_read_lock<rcu_qsbr>();
+                        dependent_ptr<Node> node = consume_load(root);
+                        CHECK_EQ(node->value == poison, false);
+                        rcu_read_unlock<rcu_qsbr>();
+                        rcu_quiescent_state();
+                    }
+                    rcu_unregister_thread<rcu_qsbr>();
+                });
+        }
+        constexpr unsigned updates = 1024;
+        for (uint64_t i = 1; i <= updates; ++i) {
+            Node* old = root.exchange(new Node { { }, i }, std::memory_order_release);
+            call_rcu<rcu_qsbr>(&old->head, reclaim);
+        }
+        rcu_barrier<rcu_qsbr>();
+        CHECK_EQ(reclaimed.load(), updates);
+        done = true;
+        for (std::thread& reader : readers)
+            reader.join();
+        delete root.load();
+    }
+
+    {
+        // Hazard pointers: protected nodes are never poisoned, hand-over-hand
+        // protection follows fields, and retired nodes are all reclaimed once
+        // unprotected.
+        struct Node {
+            uint64_t value;
+            Node* next;
+        };
+        constexpr uint64_t poison = ~0ull;
+        static std::atomic<unsigned> reclaimed;
+        reclaimed = 0;
+        auto reclaim = [] (void* ptr) {
+            Node* node = static_cast<Node*>(ptr);
+            node->value = poison;
+            delete node;
+            reclaimed.fetch_add(1);
+        };
+        Node tail { 7, nullptr };
+        std::atomic<Node*> root = new Node { 0, &tail };
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int r = 0; r != 2; ++r) {
+            readers.emplace_back([&] () {
+                    hazard_pointer hp;
+                    hazard_pointer next;
+                    while (!done.load(std::memory_order_relaxed)) {
+                        dependent_ptr<Node> node = hp.protect(root);
+                        CHECK_EQ(node->value == poison, false);
+                        dependent_ptr<Node> field = next.protect(dependent_ptr<Node*>(&node->next, node.dependency()));
+                        CHECK_EQ(field->value, 7u);
+                    }
+                });
+        }
+        constexpr unsigned updates = 1024;
+        for (uint64_t i = 1; i <= updates; ++i) {
+            Node* old = root.exchange(new Node { i, &tail }, std::memory_order_release);
+            hazard_pointer_domain::global().retire(old, reclaim);
+        }
+        done = true;
+        for (std::thread& reader : readers)
+            reader.join();
+        hazard_pointer_domain::global().reclaim();
+        CHECK_EQ(reclaimed.load(), updates);
+        delete root.load();
+    }
+
+    {
+        // Hash map: lookups stay correct while a writer grows the table.
+        consume_hash_map<uint64_t, uint64_t> map(2);
+        constexpr uint64_t keys = 4096;
+        std::atomic<bool> done = false;
+        std::thread reader([&] () {
+                while (!done.load(std::memory_order_relaxed)) {
+                    for (uint64_t k = 0; k < keys; k += 7) {
+                        uint64_t value;
+                        if (map.find(k, value))
+                            CHECK_EQ(value, k * 3);
+                    }
+                }
+            });
+        for (uint64_t k = 0; k != keys; ++k)
+            CHECK_EQ(map.insert(k, k * 3), true);
+        done = true;
+        reader.join();
+        CHECK_EQ(map.size(), keys);
+        CHECK_EQ(map.bucket_count() >= keys, true);
+        CHECK_EQ(map.insert(5, 0), false);
+        for (uint64_t k = 0; k != keys; k += 2)
+            CHECK_EQ(map.erase(k), true);
+        CHECK_EQ(map.erase(0), false);
+        map.insert_or_assign(1, 42);
+        map.insert_or_assign(2, 43);
+        uint64_t value = 0;
+        CHECK_EQ(map.find(0, value), false);
+        CHECK_EQ(map.find(1, value) && value == 42, true);
+        CHECK_EQ(map.find(2, value) && value == 43, true);
+        CHECK_EQ(map.find(3, value) && value == 9, true);
+        CHECK_EQ(map.size(), keys / 2 + 1);
+
+        // Concurrent insert_or_assign on overlapping keys: every key ends up
+        // with one of its writers' values, and nothing is lost or duplicated.
+        consume_hash_map<uint64_t, uint64_t> shared;
+        constexpr uint64_t rounds = 16;
+        std::vector<std::thread> writers;
+        for (uint64_t t = 0; t != 2; ++t) {
+            writers.emplace_back([&, t] () {
+                    // Thread 0 writes [0, 2/3 keys), thread 1 [1/3 keys, keys).
+                    for (uint64_t round = 1; round <= rounds; ++round) {
+                        for (uint64_t k = t * keys / 3; k != (t + 2) * keys / 3; ++k)
+                            shared.insert_or_assign(k, round * 2 + t);
+                    }
+                });
+        }
+        for (std::thread& writer : writers)
+            writer.join();
+        CHECK_EQ(shared.size(), keys);
+        for (uint64_t k = 0; k != keys; ++k) {
+            CHECK_EQ(shared.find(k, value), true);
+            if (k < keys / 3)
+                CHECK_EQ(value, rounds * 2);
+            else if (k >= 2 * keys / 3)
+                CHECK_EQ(value, rounds * 2 + 1);
+            else
+                CHECK_EQ(value == rounds * 2 || value == rounds * 2 + 1, true);
+        }
+        rcu_barrier();
+    }
+
+    {
+        // Skip list: searches and scans stay ordered while a writer inserts.
+        consume_skip_list<uint64_t, uint64_t> list;
+        constexpr uint64_t keys = 2048;
+        std::atomic<bool> done = false;
+        std::thread reader([&] () {
+                while (!done.load(std::memory_order_relaxed)) {
+                    uint64_t previous = 0;
+                    list.scan(0, keys, [&] (uint64_t key, uint64_t value) {
+                            CHECK_EQ(key >= previous, true);
+                            CHECK_EQ(value, key + 1);
+                            previous = key;
+                        });
+                }
+            });
+        for (uint64_t i = 0; i != keys; ++i)
+            CHECK_EQ(list.insert((i * 733) % keys, (i * 733) % keys + 1), true);
+        done = true;
+        reader.join();
+        CHECK_EQ(list.size(), keys);
+        CHECK_EQ(list.insert(3, 0), false);
+        uint64_t value = 0;
+        CHECK_EQ(list.find(100, value) && value == 101, true);
+        for (uint64_t k = 0; k != keys; k += 2)
+            CHECK_EQ(list.erase(k), true);
+        CHECK_EQ(list.find(100, value), false);
+        uint64_t sum = 0;
+        CHECK_EQ(list.scan(10, 20, [&] (uint64_t key, uint64_t) { sum += key; }), 5u);
+        CHECK_EQ(sum, 11u + 13 + 15 + 17 + 19);
+        rcu_barrier();
+    }
+
+    {
+        // Radix tree: longest-prefix matches across expanded and aligned
+        // prefixes, while a writer grows nodes through every layout.
+        consume_radix_tree<uint32_t> tree;
+        auto address = [] (uint8_t a, uint8_t b, uint8_t c, uint8_t d) { return std::vector<uint8_t> { a, b, c, d }; };
+        tree.insert(address(0, 0, 0, 0).data(), 0, 1);
+        std::atomic<bool> done = false;
+        std::thread reader([&] () {
+                while (!done.load(std::memory_order_relaxed)) {
+                    for (unsigned b = 0; b < 256; b += 7) {
+                        uint32_t value = 0;
+                        unsigned bits = 0;
+                        CHECK_EQ(tree.lookup(address(10, uint8_t(b), 3, 4).data(), 4, value, &bits), true);
+                        CHECK_EQ(value == 1 ? bits == 0 : value == 100 + b && bits == 24, true);
+                    }
+                }
+            });
+        for (unsigned b = 0; b != 256; ++b)
+            tree.insert(address(10, uint8_t(b), 3, 0).data(), 24, 100 + b);
+        done = true;
+        reader.join();
+        CHECK_EQ(tree.size(), 257u);
+
+        tree.insert(address(10, 1, 0, 0).data(), 16, 3);
+        tree.insert(address(10, 0, 0, 0).data(), 8, 2);
+        tree.insert(address(10, 1, 23, 0).data(), 20, 4);
+        tree.insert(address(10, 1, 20, 0).data(), 24, 5);
+        auto match = [&] (std::vector<uint8_t> key, unsigned expectBits) {
+            uint32_t value = 0;
+            unsigned bits = 0;
+            tree.lookup(key.data(), key.size(), value, &bits);
+            CHECK_EQ(bits, expectBits);
+            return value;
+        };
+        CHECK_EQ(match(address(10, 1, 20, 5), 24), 5u);
+        CHECK_EQ(match(address(10, 1, 21, 1), 20), 4u);
+        CHECK_EQ(match(address(10, 1, 40, 1), 16), 3u);
+        CHECK_EQ(match(address(10, 2, 0, 0), 8), 2u);
+        CHECK_EQ(match(address(11, 0, 0, 0), 0), 1u);
+        CHECK_EQ(tree.erase(address(10, 1, 20, 0).data(), 24), true);
+        CHECK_EQ(match(address(10, 1, 20, 5), 20), 4u);
+        CHECK_EQ(tree.erase(address(10, 1, 16, 0).data(), 20), true);
+        CHECK_EQ(tree.erase(address(10, 1, 16, 0).data(), 20), false);
+        CHECK_EQ(match(address(10, 1, 20, 5), 16), 3u);
+        for (unsigned b = 0; b != 256; ++b)
+            CHECK_EQ(tree.erase(address(10, uint8_t(b), 3, 0).data(), 24), true);
+        CHECK_EQ(match(address(10, 7, 3, 0), 8), 2u);
+        CHECK_EQ(tree.size(), 3u);
+        rcu_barrier();
+    }
+
+    {
+        // Broadcast ring: every consumer sees every message, in order, while
+        // the producer laps a small ring many times.
+        struct message {
+            uint64_t seq;
+            uint64_t check;
+        };
+        broadcast_ring<message, 16> ring(4);
+        constexpr uint64_t messages = 100000;
+        std::vector<std::thread> consumers;
+        std::atomic<unsigned> subscribed = 0;
+        for (unsigned c = 0; c != 2; ++c) {
+            consumers.emplace_back([&, c] () {
+                    broadcast_ring<message, 16>::consumer consumer(ring);
+                    ++subscribed;
+                    message batch[8];
+                    for (uint64_t next = 0; next != messages; ) {
+                        size_t count = c ? consumer.read(batch, 8) : consumer.try_read(batch[0]);
+                        for (size_t i = 0; i != count; ++i, ++next) {
+                            CHECK_EQ(batch[i].seq, next);
+                            CHECK_EQ(batch[i].check, next * 3);
+                        }
+                        if (!count)
+                            std::this_thread::yield();
+                    }
+                });
+        }
+        while (subscribed.load() != consumers.size())
+            std::this_thread::yield();
+        for (uint64_t seq = 0; seq != messages; ++seq)
+            ring.publish(message { seq, seq * 3 });
+        for (std::thread& consumer : consumers)
+            consumer.join();
+        message late { 0, 0 };
+        broadcast_ring<message, 16>::consumer consumer(ring);
+        CHECK_EQ(consumer.try_read(late), false);
+        ring.publish(message { 7, 21 });
+        CHECK_EQ(consumer.try_read(late) && late.check == 21, true);
+    }
+
+    {
+        // Seqlock: readers never observe a torn snapshot.
+        struct snapshot {
+            uint64_t fields[16];
+        };
+        snapshot initial { };
+        seqlock<snapshot> lock(initial);
+        constexpr uint64_t updates = 20000;
+        std::vector<std::thread> readers;
+        for (unsigned r = 0; r != 2; ++r) {
+            readers.emplace_back([&] () {
+                    for (uint64_t previous = 0; previous != updates; ) {
+                        snapshot s = lock.load();
+                        for (uint64_t field : s.fields)
+                            CHECK_EQ(field, s.fields[0]);
+                        CHECK_EQ(s.fields[0] >= previous, true);
+                        previous = s.fields[0];
+                    }
+                });
+        }
+        for (uint64_t u = 1; u <= updates; ++u) {
+            snapshot s;
+            for (uint64_t& field : s.fields)
+                field = u;
+            lock.store(s);
+        }
+        for (std::thread& reader : readers)
+            reader.join();
+        snapshot last { };
+        CHECK_EQ(lock.try_load(last) && last.fields[15] == updates, true);
+    }
+
+    {
+        // Bulk copies and comparisons agree with memcpy and memcmp at every
+        // length and alignment the vector paths distinguish.
+        uint8_t source[160];
+        for (size_t i = 0; i != sizeof(source); ++i)
+            source[i] = static_cast<uint8_t>(i * 7 + 1);
+        std::atomic<uint8_t*> published(source);
+        for (size_t offset = 0; offset != 4; ++offset) {
+            for (size_t bytes = 0; bytes <= 128; ++bytes) {
+                dependent_ptr<uint8_t> src = consume_load(published);
+                dependent_ptr<const uint8_t> at(src.value() + offset);
+                uint8_t copy[130];
+                std::memset(copy, 0xee, sizeof(copy));
+                dependent_memcpy(copy + 1, at, bytes);
+                CHECK_EQ(std::memcmp(copy + 1, source + offset, bytes), 0);
+                CHECK_EQ(copy[0] == 0xee && copy[bytes + 1] == 0xee, true);
+                CHECK_EQ(dependent_memcmp(at, copy + 1, bytes), 0);
+                if (bytes) {
+                    copy[bytes] ^= 0x80;
+                    CHECK_EQ(dependent_memcmp(at, copy + 1, bytes), std::memcmp(source + offset, copy + 1, bytes) < 0 ? -1 : 1);
+                    copy[1] += 1;
+                    CHECK_EQ(dependent_memcmp(at, copy + 1, bytes), std::memcmp(source + offset, copy + 1, bytes) < 0 ? -1 : 1);
+                }
+            }
+        }
+        uint32_t words[5];
+        dependent_memcpy(words, dependent_ptr<const uint32_t>(reinterpret_cast<const uint32_t*>(source)), 5);
+        CHECK_EQ(dependent_memcmp(dependent_ptr<const uint32_t>(words), reinterpret_cast<const uint32_t*>(source), 5), 0);
+    }
+
+    {
+        // Tags round-trip through both places, and don't disturb the pointer.
+        struct alignas(8) item { uint64_t value; };
+        item first { 1 };
+        atomic_tagged_ptr<item, 3, 8> tagged(&first, 0x5a5);
+        auto consumed = consume_load(tagged);
+        CHECK_EQ(consumed.ptr().value(), &first);
+        CHECK_EQ(consumed.tag().value(), 0x5a5u);
+        CHECK_EQ(consumed->value, 1u);
+        CHECK_EQ(consume_load(&consumed.ptr()->value, consumed.dependency()).value(), 1u);
+        CHECK_EQ(tagged.compare_exchange_tag(consumed, 7), true);
+        CHECK_EQ(tagged.compare_exchange_tag(consumed, 8), false);
+        CHECK_EQ(consume_load(tagged).tag().value(), 7u);
+        CHECK_EQ(consume_load(tagged).ptr().value(), &first);
+    }
+
+    {
+        // A Treiber stack whose head carries an ABA counter, shared by threads
+        // which pop and push back nodes from a pool that's never freed.
+        struct alignas(64) node { atomic_tagged_ptr<node, 6> next; uint64_t value; };
+        constexpr size_t count = 64;
+        std::vector<node> pool(count);
+        atomic_tagged_ptr<node, 6> head;
+        for (size_t i = 0; i != count; ++i) {
+            pool[i].value = i;
+            pool[i].next.store(consume_load(head).ptr().value(), 0, std::memory_order_relaxed);
+            head.store(&pool[i], 0);
+        }
+        auto worker = [&] () {
+            for (unsigned i = 0; i != 20000; ++i) {
+                node* popped;
+                for (;;) {
+                    auto top = consume_load(head);
+                    popped = top.ptr().value();
+                    auto next = consume_load(&popped->next, top.dependency());
+                    if (head.compare_exchange(top, next.ptr().value(), top.tag().value() + 1))
+                        break;
+                }
+                for (;;) {
+                    auto top = consume_load(head);
+                    popped->next.store(top.ptr().value(), 0, std::memory_order_relaxed);
+                    if (head.compare_exchange(top, popped, top.tag().value() + 1))
+                        break;
+                }
+            }
+        };
+        std::thread other(worker);
+        worker();
+        other.join();
+        uint64_t seen = 0;
+        for (auto top = consume_load(head); top.ptr().value(); top = consume_load(&top->next, top.dependency()))
+            seen |= uint64_t(1) << top->value;
+        CHECK_EQ(seen, ~uint64_t(0));
+    }
+
+    {
+        // Harris-style deletion: a node is marked in its next pointer before
+        // being unlinked, and traversals skip marked nodes.
+        struct alignas(8) node { atomic_tagged_ptr<node, 1> next; uint64_t key; };
+        node third { { nullptr }, 3 };
+        node second { { &third }, 2 };
+        node first { { &second }, 1 };
+        auto mark = consume_load(second.next);
+        CHECK_EQ(second.next.compare_exchange_tag(mark, 1), true);
+        CHECK_EQ(second.next.fetch_or_low_tag(1) & 1, 1u);
+        uint64_t sum = 0;
+        for (auto p = consume_load(first.next); p.ptr().value(); ) {
+            auto next = consume_load(&p->next, p.dependency());
+            if (!next.tag().value())
+                sum += p->key;
+            p = next;
+        }
+        CHECK_EQ(sum, 3u);
+        auto link = consume_load(first.next);
+        CHECK_EQ(first.next.compare_exchange(link, &third, 0), true);
+        CHECK_EQ(consume_load(first.next)->key, 3u);
+    }
+
+    {
+        // Batched publication: nothing is visible before the commit, and
+        // readers consuming any slot see a fully initialized record.
+        struct record { uint64_t words[4]; };
+        std::atomic<record*> slots[8];
+        std::atomic<uint32_t> generation(0);
+        std::atomic<uint8_t> flag(0);
+        record initial { { 0, 0, 0, 0 } };
+        for (std::atomic<record*>& slot : slots)
+            slot.store(&initial, std::memory_order_relaxed);
+        {
+            publish_batch batch;
+            batch.stage(generation, 1u);
+            batch.stage(flag, uint8_t(0xa5));
+            CHECK_EQ(batch.size(), 2u);
+            CHECK_EQ(generation.load(), 0u);
+            batch.commit();
+            CHECK_EQ(batch.empty(), true);
+            CHECK_EQ(generation.load(), 1u);
+            CHECK_EQ(flag.load(), 0xa5);
+            batch.stage(generation, 2u);
+        }
+        CHECK_EQ(generation.load(), 2u);
+        {
+            // Structs are stored through their own atomic, not an integer one.
+            struct extent { uint16_t offset; uint16_t length; };
+            std::atomic<extent> range(extent { 0, 0 });
+            publish_batch batch;
+            batch.stage(range, extent { 3, 4 });
+            batch.commit();
+            CHECK_EQ(range.load().offset, 3u);
+            CHECK_EQ(range.load().length, 4u);
+        }
+
+        constexpr uint64_t rounds = 2000;
+        std::vector<std::unique_ptr<record>> records;
+        std::atomic<bool> done(false);
+        std::thread reader([&] () {
+                while (!done.load(std::memory_order_relaxed)) {
+                    for (std::atomic<record*>& slot : slots) {
+                        dependent_ptr<record> r = consume_load(slot);
+                        for (uint64_t word : r->words)
+                            CHECK_EQ(word, r->words[0]);
+                    }
+                }
+            });
+        publish_batch batch(8);
+        for (uint64_t round = 1; round <= rounds; ++round) {
+            for (std::atomic<record*>& slot : slots) {
+                records.emplace_back(new record { { round, round, round, round } });
+                batch.stage(slot, records.back().get());
+            }
+            batch.commit();
+        }
+        done.store(true);
+        reader.join();
+        CHECK_EQ(consume_load(slots[7])->words[3], rounds);
+    }
+
+    {
+        // consume_shared_ptr: snapshots keep replaced objects alive, and
+        // every object is destroyed once its last owner lets go.
+        struct config {
+            config(uint64_t v, std::atomic<int>& live) : values { v, v, v, v }, live(live) { ++live; }
+            ~config() { --live; }
+            uint64_t values[4];
+            std::atomic<int>& live;
+        };
+        std::atomic<int> live(0);
+        {
+            consume_shared_ptr<const config> empty;
+            CHECK_EQ(static_cast<bool>(empty.load()), false);
+            CHECK_EQ(empty.load_shared() == nullptr, true);
+
+            consume_shared_ptr<const config> published(std::make_shared<const config>(1, live));
+            {
+                auto first = published.load();
+                CHECK_EQ(first->values[0], 1u);
+                std::shared_ptr<const config> old = published.exchange(std::make_shared<const config>(2, live));
+                CHECK_EQ(old.get(), first.get().value());
+                old.reset();
+                hazard_pointer_domain::global().reclaim();
+                CHECK_EQ(first->values[3], 1u);
+                CHECK_EQ(published.load()->values[0], 2u);
+            }
+            std::shared_ptr<const config> kept = published.load_shared();
+            published.store(nullptr);
+            CHECK_EQ(static_cast<bool>(published.load()), false);
+            CHECK_EQ(kept->values[0], 2u);
+
+            constexpr uint64_t swaps = 5000;
+            published.store(std::make_shared<const config>(0, live));
+            std::atomic<bool> done(false);
+            std::thread reader([&] () {
+                    uint64_t previous = 0;
+                    while (!done.load(std::memory_order_relaxed)) {
+                        auto s = published.load();
+                        for (uint64_t value : s->values)
+                            CHECK_EQ(value, s->values[0]);
+                        CHECK_EQ(s->values[0] >= previous, true);
+                        previous = s->values[0];
+                    }
+                });
+            for (uint64_t v = 1; v <= swaps; ++v)
+                published.store(std::make_shared<const config>(v, live));
+            done.store(true);
+            reader.join();
+            CHECK_EQ(published.load_shared()->values[1], swaps);
+        }
+        hazard_pointer_domain::global().reclaim();
+        CHECK_EQ(live.load(), 0);
+    }
+
+    {
+        // Node arena: blocks are line-aligned and don't overlap, zeroed
+        // blocks are zero even when recycled, and blocks freed on another
+        // thread come back through the depot.
+        struct item { uint64_t words[5]; };
+        std::vector<item*> items;
+        for (unsigned i = 0; i != 100; ++i) {
+            items.push_back(arena_new<item>());
+            CHECK_EQ(reinterpret_cast<uintptr_t>(items.back()) % node_arena::line_size, 0u);
+            for (uint64_t& word : items.back()->words)
+                word = ~uint64_t(0);
+        }
+        std::vector<item*> sorted(items);
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t i = 1; i != sorted.size(); ++i)
+            CHECK_EQ(reinterpret_cast<uintptr_t>(sorted[i]) - reinterpret_cast<uintptr_t>(sorted[i - 1]) >= sizeof(item), true);
+        std::thread reclaimer([&] () {
+                for (item* it : items)
+                    arena_delete(it);
+                node_arena::global().flush();
+            });
+        reclaimer.join();
+        node_arena& arena = node_arena::global();
+        std::thread recycler([&] () {
+                // A thread without a slab yet starts from the depot.
+                for (unsigned i = 0; i != 100; ++i) {
+                    uint64_t* zeroed = static_cast<uint64_t*>(arena.allocate_zeroed(sizeof(item)));
+                    CHECK_EQ(std::binary_search(sorted.begin(), sorted.end(), reinterpret_cast<item*>(zeroed)), true);
+                    for (unsigned w = 0; w != 5; ++w)
+                        CHECK_EQ(zeroed[w], 0u);
+                }
+            });
+        recycler.join();
+        void* large = arena.allocate(4096);
+        CHECK_EQ(reinterpret_cast<uintptr_t>(large) % node_arena::line_size, 0u);
+        arena.deallocate(large, 4096);
+        void* lines[3] = { arena.allocate(1), arena.allocate(65), arena.allocate(node_arena::max_size) };
+        CHECK_EQ(reinterpret_cast<uintptr_t>(lines[1]) % node_arena::line_size, 0u);
+        arena.deallocate(lines[0], 1);
+        arena.deallocate(lines[1], 65);
+        arena.deallocate(lines[2], node_arena::max_size);
+    }
+
+#if defined(CONSUME_INSTRUMENTATION)
+    {
+        // Instrumentation counts loads, chains and escapes per call site.
+        consume_instrumentation& instrumentation = consume_instrumentation::global();
+        struct node { node* next; uint64_t key; };
+        node third { nullptr, 3 };
+        node second { &third, 2 };
+        node first { &second, 1 };
+        std::atomic<node*> head(&first);
+        std::thread([&] () {
+                instrumentation.reset();
+                for (unsigned i = 0; i != 10; ++i) {
+                    dependent_ptr<node> p = consume_load(head);
+                    p = consume_load(&p->next, p.dependency());
+                    p = consume_load(dependent_ptr<node*>(&p->next, p.dependency()));
+                    CHECK_EQ(p.value(), &third);
+                }
+                dependent_ptr<node> raw = &first;
+                raw = &second;
+            }).join();
+        consume_instrumentation::report r = instrumentation.collect();
+        auto events = [&] (consume_event e) { return r.events[static_cast<size_t>(e)]; };
+        CHECK_EQ(events(consume_event::load_atomic_pointer), 10u);
+        CHECK_EQ(events(consume_event::load_pointer_with_dependency), 10u);
+        CHECK_EQ(events(consume_event::load_dependent_pointer), 10u);
+        CHECK_EQ(events(consume_event::raw_pointer_assignment), 1u);
+        CHECK_EQ(events(consume_event::value_escape) >= 10, true);
+        CHECK_EQ(events(consume_event::arrow_escape) >= 20, true);
+        CHECK_EQ(events(consume_event::dependency_creation) >= 20, true);
+        CHECK_EQ(r.chain_lengths[2], 10u);
+        uint64_t atomicLoads = 0;
+        for (const consume_instrumentation::site_count& site : r.sites) {
+            if (site.event == consume_event::load_atomic_pointer)
+                atomicLoads += site.count;
+        }
+        CHECK_EQ(atomicLoads, 10u);
+        std::ostringstream dump;
+        instrumentation.dump(dump);
+        CHECK_EQ(dump.str().find("consume_load(T**, dependency)") != std::string::npos, true);
+    }
+    {
+        // Member projection extends the chain it starts from: a consumed head,
+        // three links, one of them atomic, and a field make chains of five.
+        consume_instrumentation& instrumentation = consume_instrumentation::global();
+        struct node { node* next; std::atomic<node*> link; uint64_t key; };
+        node fourth { nullptr, { nullptr }, 4 };
+        node third { &fourth, { nullptr }, 3 };
+        node second { nullptr, { &third }, 2 };
+        node first { &second, { nullptr }, 1 };
+        std::atomic<node*> head(&first);
+        uint64_t keys = 0;
+        std::thread([&] () {
+                instrumentation.reset();
+                for (unsigned i = 0; i != 10; ++i)
+                    keys += consume_load(head).member(&node::next).member(&node::link).member(&node::next).field(&node::key).value();
+            }).join();
+        CHECK_EQ(keys, 40u);
+        consume_instrumentation::report r = instrumentation.collect();
+        auto events = [&] (consume_event e) { return r.events[static_cast<size_t>(e)]; };
+        CHECK_EQ(events(consume_event::load_atomic_pointer), 10u);
+        CHECK_EQ(events(consume_event::load_atomic_value), 0u);
+        CHECK_EQ(events(consume_event::load_dependent_pointer), 30u);
+        CHECK_EQ(events(consume_event::load_dependent_value), 10u);
+        CHECK_EQ(r.chain_lengths[3], 10u);
+        for (size_t c = 0; c != consume_instrumentation::chain_buckets; ++c) {
+            if (c != 3)
+                CHECK_EQ(r.chain_lengths[c], 0u);
+        }
+    }
+    {
+        // Tagged links extend chains too, and compare-and-swap isn't an escape.
+        consume_instrumentation& instrumentation = consume_instrumentation::global();
+        struct alignas(8) node { atomic_tagged_ptr<node, 1> next; uint64_t key; };
+        node second { nullptr, 2 };
+        node first { &second, 1 };
+        atomic_tagged_ptr<node, 1> head(&first);
+        std::thread([&] () {
+                instrumentation.reset();
+                for (unsigned i = 0; i != 10; ++i) {
+                    auto link = consume_load(head);
+                    link = consume_load(&link->next, link.dependency());
+                    CHECK_EQ(first.next.compare_exchange_tag(link, i & 1), true);
+                }
+            }).join();
+        consume_instrumentation::report r = instrumentation.collect();
+        auto events = [&] (consume_event e) { return r.events[static_cast<size_t>(e)]; };
+        CHECK_EQ(events(consume_event::load_atomic_pointer), 10u);
+        CHECK_EQ(events(consume_event::load_pointer_with_dependency), 10u);
+        CHECK_EQ(events(consume_event::value_escape), 0u);
+        CHECK_EQ(events(consume_event::arrow_escape), 10u);
+        CHECK_EQ(r.chain_lengths[1], 10u);
+    }
+    {
+        // The library's own lookups read through dependent pointers without
+        // escaping, so only the caller's code is reported.
+        consume_instrumentation& instrumentation = consume_instrumentation::global();
+        consume_hash_map<uint64_t, uint64_t> map;
+        consume_skip_list<uint64_t, uint64_t> list;
+        consume_btree<uint64_t, uint64_t> tree;
+        consume_radix_tree<uint32_t> prefixes;
+        const uint8_t address[4] = { 10, 1, 2, 3 };
+        for (uint64_t k = 0; k != 64; ++k) {
+            map.insert(k, k + 1);
+            list.insert(k, k + 1);
+            tree.insert(k, k + 1);
+        }
+        prefixes.insert(address, 16, 7);
+        seqlock<uint64_t> lock(5);
+        consume_shared_ptr<uint64_t> shared(std::make_shared<uint64_t>(9));
+        uint64_t sum = 0;
+        std::thread([&] () {
+                instrumentation.reset();
+                for (uint64_t k = 0; k != 64; ++k) {
+                    uint64_t value = 0;
+                    CHECK_EQ(map.find(k, value) && value == k + 1, true);
+                    CHECK_EQ(list.find(k, value) && value == k + 1, true);
+                    CHECK_EQ(tree.find(k, value) && value == k + 1, true);
+                }
+                auto add = [&] (uint64_t, uint64_t value) { sum += value; };
+                CHECK_EQ(list.scan(0, 64, add), 64u);
+                CHECK_EQ(tree.scan(0, 64, add), 64u);
+                uint32_t prefix = 0;
+                CHECK_EQ(prefixes.lookup(address, 4, prefix) && prefix == 7, true);
+                CHECK_EQ(lock.load(), 5u);
+                consume_shared_ptr<uint64_t>::snapshot snapshot(shared);
+                CHECK_EQ(*snapshot.share(), 9u);
+            }).join();
+        CHECK_EQ(sum, 2 * 64 * 65 / 2u);
+        consume_instrumentation::report r = instrumentation.collect();
+        auto events = [&] (consume_event e) { return r.events[static_cast<size_t>(e)]; };
+        CHECK_EQ(events(consume_event::load_atomic_pointer) >= 2 * 64, true);
+        CHECK_EQ(events(consume_event::value_escape), 0u);
+        CHECK_EQ(events(consume_event::arrow_escape), 0u);
+        CHECK_EQ(events(consume_event::raw_pointer_assignment), 0u);
+    }
+#endif
+
+    {
+        // B+tree: lookups and scans stay ordered while a writer splits nodes
+        // over several levels, then erasure empties leaves until the tree
+        // collapses back to its root.
+        consume_btree<uint64_t, uint64_t> tree;
+        constexpr uint64_t keys = 8192;
+        std::atomic<bool> done = false;
+        std::thread reader([&] () {
+                uint64_t value = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    uint64_t previous = 0;
+                    tree.scan(0, keys, [&] (uint64_t key, uint64_t value) {
+                            CHECK_EQ(key >= previous, true);
+                            CHECK_EQ(value, key + 1);
+                            previous = key;
+                        });
+                    for (uint64_t k = 0; k < keys; k += 97)
+                        CHECK_EQ(!tree.find(k, value) || value == k + 1, true);
+                }
+            });
+        for (uint64_t i = 0; i != keys; ++i)
+            CHECK_EQ(tree.insert((i * 733) % keys, (i * 733) % keys + 1), true);
+        done = true;
+        reader.join();
+        CHECK_EQ(tree.size(), keys);
+        CHECK_EQ(tree.insert(3, 0), false);
+        CHECK_EQ(tree.scan(0, keys, [] (uint64_t, uint64_t) { }), keys);
+        uint64_t value = 0;
+        CHECK_EQ(tree.find(100, value) && value == 101, true);
+        CHECK_EQ(tree.replace(100, 7) && tree.find(100, value) && value == 7, true);
+        CHECK_EQ(tree.replace(keys, 7), false);
+        for (uint64_t k = 0; k != keys; k += 2)
+            CHECK_EQ(tree.erase(k), true);
+        CHECK_EQ(tree.erase(0), false);
+        CHECK_EQ(tree.find(100, value), false);
+        uint64_t sum = 0;
+        CHECK_EQ(tree.scan(10, 20, [&] (uint64_t key, uint64_t) { sum += key; }), 5u);
+        CHECK_EQ(sum, 11u + 13 + 15 + 17 + 19);
+        for (uint64_t k = 1; k < keys - 2; k += 2)
+            CHECK_EQ(tree.erase(k), true);
+        CHECK_EQ(tree.size(), 1u);
+        CHECK_EQ(tree.scan(0, keys, [&] (uint64_t key, uint64_t) { CHECK_EQ(key, keys - 1); }), 1u);
+        CHECK_EQ(tree.erase(keys - 1), true);
+        CHECK_EQ(tree.scan(0, keys, [] (uint64_t, uint64_t) { }), 0u);
+        CHECK_EQ(tree.insert(5, 6) && tree.find(5, value) && value == 6, true);
+
+        // Signed keys take the vector compares too, and other comparators the
+        // scalar loop.
+        consume_btree<int32_t, int32_t> signedTree;
+        for (int32_t k = -500; k != 500; ++k)
+            CHECK_EQ(signedTree.insert(k * 3, k), true);
+        int32_t signedValue = 0;
+        CHECK_EQ(signedTree.find(-1497, signedValue) && signedValue == -499, true);
+        CHECK_EQ(signedTree.find(-1496, signedValue), false);
+        CHECK_EQ(signedTree.scan(-6, 6, [] (int32_t, int32_t) { }), 4u);
+        consume_btree<uint64_t, uint64_t, std::greater<uint64_t>> descending;
+        for (uint64_t k = 0; k != 1000; ++k)
+            CHECK_EQ(descending.insert(k, k), true);
+        uint64_t previous = 1000;
+        CHECK_EQ(descending.scan(999, 0, [&] (uint64_t key, uint64_t) { CHECK_EQ(key, previous - 1); previous = key; }), 999u);
+        rcu_barrier();
+    }
+
+    {
+        // B+tree: erasing whole subtrees while a reader scans leaves inner
+        // nodes down to one child, and then collapses the root through them.
+        consume_btree<uint64_t, uint64_t> tree;
+        constexpr uint64_t keys = 16384;
+        constexpr uint64_t stride = 1024;
+        for (uint64_t k = 0; k != keys; ++k)
+            CHECK_EQ(tree.insert(k, k + 1), true);
+        std::atomic<bool> done = false;
+        std::thread reader([&] () {
+                uint64_t value = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    uint64_t previous = 0;
+                    tree.scan(0, keys, [&] (uint64_t key, uint64_t value) {
+                            CHECK_EQ(key >= previous, true);
+                            CHECK_EQ(value, key + 1);
+                            previous = key;
+                        });
+                    CHECK_EQ(tree.find(keys - stride, value) && value == keys - stride + 1, true);
+                }
+            });
+        for (uint64_t k = 0; k != keys; ++k) {
+            if (k % stride)
+                CHECK_EQ(tree.erase(k), true);
+        }
+        for (uint64_t k = 0; k != keys - stride; k += stride)
+            CHECK_EQ(tree.erase(k), true);
+        done = true;
+        reader.join();
+        CHECK_EQ(tree.size(), 1u);
+        rcu_barrier();
+    }
+
     return 0;
 }
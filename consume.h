@@ -29,32 +29,95 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <type_traits>
 #include "helpers.h"
 
+// Defining CONSUME_INSTRUMENTATION counts consume operations per call site,
+// see consume_instrumentation.h. Otherwise the hooks compile to nothing.
+#if defined(CONSUME_INSTRUMENTATION)
+#include "consume_instrumentation.h"
+#else
+#define CONSUME_RECORD(event) do { } while (false)
+#endif
+
 // See https://wg21.link/p0750 consume for proposed wording.
 
-class dependency;
+// Ordering policies, for A/B testing a program's consume-based code against
+// conventional orderings without touching call sites.
+//
+// dependency_ordering is the default: consume loads are relaxed loads and
+// dependencies are real, so readers execute no fences. Under acquire_ordering
+// and seq_cst_ordering, every consume_load becomes an acquire or seq_cst load
+// and dependencies are constant zeros, which the compiler folds away.
+//
+// The policy is chosen for the whole program by defining CONSUME_ORDERING,
+// for example -DCONSUME_ORDERING=acquire_ordering, because a dependency chain
+// only orders anything if every link in it follows the same policy.
+struct dependency_ordering {
+    static constexpr std::memory_order load_order = std::memory_order_relaxed;
+    static constexpr bool carries_dependencies = true;
+};
+
+struct acquire_ordering {
+    static constexpr std::memory_order load_order = std::memory_order_acquire;
+    static constexpr bool carries_dependencies = false;
+};
+
+struct seq_cst_ordering {
+    static constexpr std::memory_order load_order = std::memory_order_seq_cst;
+    static constexpr bool carries_dependencies = false;
+};
 
-// A value and its dependency.
-// FIXME: should this be opaque, to allow T to carry the dependency implicitly?
-template<typename T, typename Dependency = dependency>
-struct dependent {
-    T value;
-    Dependency dependency;
+#if !defined(CONSUME_ORDERING)
+#define CONSUME_ORDERING dependency_ordering
+#endif
+typedef CONSUME_ORDERING consume_ordering;
 
+class dependency;
+
+// A value which was obtained through a consume load operation, or computed from
+// one. Like dependent_ptr, the value carries its own dependency: the type is
+// opaque, sizeof(dependent<T>) == sizeof(T), and the dependency is only
+// materialized when asked for. A dependent<T> therefore fits in the same
+// register as T, and passes and returns like T does.
+//
+// T must be trivially copyable and 1, 2, 4, 8 or 16 bytes wide. 16-byte values,
+// such as a pointer paired with an ABA counter, carry their dependency in their
+// first 8 bytes.
+template<typename T>
+class dependent {
+public:
     dependent() = delete;
-    dependent(T value, Dependency dependency) : value(value), dependency(dependency) {}
-    dependent(T value) : value(value), dependency(value) {}
+
+    // Combines the dependency into the value, extending its chain to the
+    // value.
+    dependent(T, dependency);
+
+    // The value heads its own chain, for example because it was just loaded.
+    dependent(T);
+
+    // The value, whose chain extends to the result.
+    T value() const;
+
+    // A pure dependency from the value.
+    class dependency dependency() const;
+
+private:
+    // The library's own access to the value, which instrumentation doesn't
+    // count as an escape.
+    template<typename U> friend U __value(const dependent<U>&);
+
+    // Exposition only:
+    T val;
 };
 
 // A dependent_ptr contains a pointer which was obtained through a consume load
 // operation. It supports a restricted set of operations compared to regular
 // pointers, which allows it to continue carrying its dependency.
 //
-// dependent_ptr differs from dependent<T*> by having a single data member, and
-// by acting similarly to how regular pointers act. A dependent_ptr is a useful
-// abstraction because it closely matches the low-level details of modern
-// ISA-specific dependencies.
+// dependent_ptr differs from dependent<T*> by acting similarly to how regular
+// pointers act. A dependent_ptr is a useful abstraction because it closely
+// matches the low-level details of modern ISA-specific dependencies.
 template<typename T>
 class dependent_ptr {
 public:
@@ -105,6 +168,28 @@ public:
     // the chain to cover the result.
     T* operator->() const;
 
+    // Member projection. The member's address is computed from the pointer,
+    // so the load of the member is in the chain, and so is the loaded value:
+    // p.member(&Node::next) is the next link, and p.field(&Node::key) a field.
+    // Members may be plain or std::atomic.
+    template<typename U, typename C> dependent_ptr<U> member(U* C::*) const;
+    template<typename U, typename C> dependent_ptr<U> member(std::atomic<U*> C::*) const;
+    template<typename U, typename C> dependent<U> field(U C::*) const;
+    template<typename U, typename C> dependent<U> field(std::atomic<U> C::*) const;
+
+    // Prefetching. A prefetch's address is computed from the pointer, like a
+    // member access, so issuing one neither leaves nor extends the chain.
+    // prefetch() hints at the pointee's first `lines` cache lines, and
+    // prefetch(&C::m) at the line holding one of its members.
+    // prefetch_through(&C::next, lines) consumes a pointer member like member()
+    // does and prefetches its target's first lines, which is how a traversal
+    // reaches further ahead: through child links, or through jump pointers to
+    // a node k hops down a list.
+    void prefetch(size_t lines = 1) const;
+    template<typename U, typename C> void prefetch(U C::*) const;
+    template<typename U, typename C> dependent_ptr<U> prefetch_through(U* C::*, size_t lines = 1) const;
+    template<typename U, typename C> dependent_ptr<U> prefetch_through(std::atomic<U*> C::*, size_t lines = 1) const;
+
     // Dereferencing and Address-Of
 
     // Dereferencing a dependent pointer extends the chain to the resulting value.
@@ -119,7 +204,7 @@ public:
     T* value() const;
 
     // A pure dependency from the dependent_ptr.
-    dependency dependency() const;
+    class dependency dependency() const;
 
     // Comparisons aren't needed because the T* themselves can be compared
     // without breaking the dependency chain of the dependent_ptr. This is
@@ -128,6 +213,10 @@ public:
     // process.
 
 private:
+    // The library's own access to the pointer, which instrumentation doesn't
+    // count as an escape.
+    template<typename U> friend U* __pointer(const dependent_ptr<U>&);
+
     // Exposition only:
     T* ptr { nullptr };
 };
@@ -177,13 +266,15 @@ intptr_t operator|(intptr_t, dependency);
 template<typename T> dependent_ptr<T> consume_load(const std::atomic<T*>&);
 template<typename T> dependent<T> consume_load(const std::atomic<T>&);
 
-// Subsequent dependent operations.
+// Subsequent dependent operations. A 16-byte T loaded through a pointer must be
+// 16-byte aligned.
 template<typename T> dependent_ptr<T> consume_load(dependent_ptr<T*>);
 template<typename T> dependent<T> consume_load(dependent_ptr<T>);
 template<typename T> dependent_ptr<T> consume_load(T**, dependency);
 template<typename T> dependent<T> consume_load(T*, dependency);
 
 #include "consume_dependency_impl.h"
+#include "consume_dependent_impl.h"
 #include "consume_dependent_ptr_impl.h"
 #include "consume_load_impl.h"
 
@@ -28,13 +28,31 @@
 
 namespace {
 
+// A 16-byte value's two words, in memory order.
+struct __halves {
+    uint64_t low;
+    uint64_t high;
+};
+
+// One word which depends on both of a 16-byte value's halves.
+template<typename T>
+inline uint64_t __fold_halves(T value)
+{
+    __halves h = bit_cast<__halves>(value);
+    return h.low | h.high;
+}
+
 template<typename T, typename std::enable_if<sizeof(T) == 8>::type* = nullptr>
 inline dependency::dependency_type __create_dependency(T value) {
+    if (!consume_ordering::carries_dependencies)
+        return 0;
     dependency::dependency_type dep;
 #if CPU(ARM64)
     asm volatile("eor %w[dep], %w[in], %w[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint64_t>(value)));
 #elif CPU(ARM)
     asm volatile("eor %[dep], %[in], %[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint64_t>(value)));
+#elif CPU(PPC64) || CPU(RISCV64)
+    asm volatile("xor %[dep], %[in], %[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint64_t>(value)));
 #elif CPU(X86) || CPU(X86_64)
     dep = bit_cast<uint64_t>(value) ^ bit_cast<uint64_t>(value); // Any zero will do for x86
     std::atomic_signal_fence(std::memory_order_acquire);
@@ -46,11 +64,15 @@ inline dependency::dependency_type __create_dependency(T value) {
 
 template<typename T, typename std::enable_if<sizeof(T) == 4>::type* = nullptr>
 inline dependency::dependency_type __create_dependency(T value) {
+    if (!consume_ordering::carries_dependencies)
+        return 0;
     dependency::dependency_type dep;
 #if CPU(ARM64)
     asm volatile("eor %w[dep], %w[in], %w[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint32_t>(value)));
 #elif CPU(ARM)
     asm volatile("eor %[dep], %[in], %[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint32_t>(value)));
+#elif CPU(PPC64) || CPU(RISCV64)
+    asm volatile("xor %[dep], %[in], %[in]" : [dep] "=r"(dep) : [in] "r"(bit_cast<uint32_t>(value)));
 #elif CPU(X86) || CPU(X86_64)
     dep = bit_cast<uint32_t>(value) ^ bit_cast<uint32_t>(value); // Any zero will do for x86.
     std::atomic_signal_fence(std::memory_order_acquire);
@@ -60,6 +82,11 @@ inline dependency::dependency_type __create_dependency(T value) {
     return dep;
 }
 
+// 128-bit values, such as a pointer paired with a counter. Both halves feed the
+// dependency, so it doesn't matter which one holds the pointer.
+template<typename T, typename std::enable_if<sizeof(T) == 16>::type* = nullptr>
+inline dependency::dependency_type __create_dependency(T value) { return __create_dependency(__fold_halves(value)); }
+
 template <typename T, typename std::enable_if<sizeof(T) == 2>::type* = nullptr>
 inline dependency::dependency_type __create_dependency(T value) { return __create_dependency(static_cast<uint32_t>(value)); }
 
@@ -68,16 +95,16 @@ inline dependency::dependency_type __create_dependency(T value) { return __creat
 
 } // anonymous namespace
 
-template<typename T> dependency::dependency(T value) : dep(__create_dependency(value)) {}
+template<typename T> dependency::dependency(T value) : dep(__create_dependency(value)) { CONSUME_RECORD(dependency_creation); }
 
-inline dependency dependency::operator|(dependency d) { return dep + d.dep; }
+inline dependency dependency::operator|(dependency d) { CONSUME_RECORD(dependency_combination); return dep + d.dep; }
 
-template<typename T> inline dependency operator|(dependency lhs, dependent_ptr<T> rhs) { return lhs.dep + dependency(rhs.value()).dep; }
-template<typename T> inline dependency operator|(dependent_ptr<T> lhs, dependency rhs) { return dependency(lhs.value()).dep + rhs.dep; }
+template<typename T> inline dependency operator|(dependency lhs, dependent_ptr<T> rhs) { CONSUME_RECORD(dependency_combination); return lhs.dep + rhs.dependency().dep; }
+template<typename T> inline dependency operator|(dependent_ptr<T> lhs, dependency rhs) { CONSUME_RECORD(dependency_combination); return lhs.dependency().dep + rhs.dep; }
 
-inline uintptr_t operator|(dependency lhs, uintptr_t rhs) { return lhs.dep | rhs; }
-inline uintptr_t operator|(uintptr_t lhs, dependency rhs) { return lhs | rhs.dep; }
-inline intptr_t operator|(dependency lhs, intptr_t rhs) { return lhs.dep | rhs; }
-inline intptr_t operator|(intptr_t lhs, dependency rhs) { return lhs | rhs.dep; }
+inline uintptr_t operator|(dependency lhs, uintptr_t rhs) { CONSUME_RECORD(dependency_combination); return lhs.dep | rhs; }
+inline uintptr_t operator|(uintptr_t lhs, dependency rhs) { CONSUME_RECORD(dependency_combination); return lhs | rhs.dep; }
+inline intptr_t operator|(dependency lhs, intptr_t rhs) { CONSUME_RECORD(dependency_combination); return lhs.dep | rhs; }
+inline intptr_t operator|(intptr_t lhs, dependency rhs) { CONSUME_RECORD(dependency_combination); return lhs | rhs.dep; }
 
 #endif
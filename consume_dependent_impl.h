@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consume_dependent_impl_h
+#define consume_dependent_impl_h
+
+namespace {
+
+template<size_t> struct __dependent_bits;
+template<> struct __dependent_bits<1> { typedef uint8_t type; };
+template<> struct __dependent_bits<2> { typedef uint16_t type; };
+template<> struct __dependent_bits<4> { typedef uint32_t type; };
+template<> struct __dependent_bits<8> { typedef uint64_t type; };
+
+// The dependency is zero at runtime, but the compiler can't know that, so the
+// result's bits depend on it.
+template<typename T, typename std::enable_if<sizeof(T) <= 8>::type* = nullptr>
+inline T __with_dependency(T value, dependency d)
+{
+    typedef typename __dependent_bits<sizeof(T)>::type bits;
+    return bit_cast<T>(static_cast<bits>(bit_cast<bits>(value) | static_cast<bits>(d | uintptr_t(0))));
+}
+
+// 16-byte values carry their dependency in their first word: both words come
+// from the same load, so either one orders what follows.
+template<typename T, typename std::enable_if<sizeof(T) == 16>::type* = nullptr>
+inline T __with_dependency(T value, dependency d)
+{
+    __halves h = bit_cast<__halves>(value);
+    h.low |= d | uintptr_t(0);
+    return bit_cast<T>(h);
+}
+
+template<typename T, typename std::enable_if<sizeof(T) <= 8>::type* = nullptr>
+inline T __dependency_word(T value) { return value; }
+
+template<typename T, typename std::enable_if<sizeof(T) == 16>::type* = nullptr>
+inline uint64_t __dependency_word(T value) { return __fold_halves(value); }
+
+} // anonymous namespace
+
+template<typename T>
+inline dependent<T>::dependent(T value, class dependency d) : val(__with_dependency(value, d))
+{
+    static_assert(sizeof(dependent) == sizeof(T), "dependent<T> must be as small as T");
+}
+
+template<typename T>
+inline dependent<T>::dependent(T value) : val(value)
+{
+    static_assert(sizeof(dependent) == sizeof(T), "dependent<T> must be as small as T");
+}
+
+template<typename T> inline T dependent<T>::value() const { CONSUME_RECORD(value_escape); return val; }
+
+template<typename T> inline T __value(const dependent<T>& d) { return d.val; }
+
+template<typename T> inline class dependency dependent<T>::dependency() const { using shadowed = class dependency; return shadowed(__dependency_word(val)); }
+
+#endif
@@ -31,29 +31,103 @@ template<typename T> inline dependent_ptr<T>::dependent_ptr(std::nullptr_t ptr)
 
 template<typename T> inline dependent_ptr<T>::dependent_ptr(T* ptr, class dependency d) : ptr(reinterpret_cast<T*>((d | dependent_ptr<T>(ptr)) | reinterpret_cast<uintptr_t>(ptr))) {}
 template<typename T> inline dependent_ptr<T>::dependent_ptr(std::nullptr_t ptr, class dependency d) : dependent_ptr(static_cast<T*>(ptr), d) {}
-template<typename T> inline dependent_ptr<T>::dependent_ptr(dependent<uintptr_t> d) : dependent_ptr(reinterpret_cast<T*>(d.value), d.dependency) {}
-template<typename T> inline dependent_ptr<T>::dependent_ptr(dependent<intptr_t> d) : dependent_ptr(reinterpret_cast<T*>(d.value), d.dependency) {}
+// The integer already carries the dependency.
+template<typename T> inline dependent_ptr<T>::dependent_ptr(dependent<uintptr_t> d) : ptr(reinterpret_cast<T*>(__value(d))) {}
+template<typename T> inline dependent_ptr<T>::dependent_ptr(dependent<intptr_t> d) : ptr(reinterpret_cast<T*>(__value(d))) {}
 
 template<typename T> inline dependent_ptr<T>::dependent_ptr(const dependent_ptr<T>& rhs) : ptr(rhs.ptr) {}
 
-template<typename T> inline dependent_ptr<T>& dependent_ptr<T>::operator=(T* rhs) { ptr = rhs; return *this; }
+template<typename T> inline dependent_ptr<T>& dependent_ptr<T>::operator=(T* rhs) { CONSUME_RECORD(raw_pointer_assignment); ptr = rhs; return *this; }
 template<typename T> inline dependent_ptr<T>& dependent_ptr<T>::operator=(std::nullptr_t rhs) { ptr = rhs; return *this; }
 
-template<typename T> inline dependent_ptr<T>& dependent_ptr<T>::operator=(const dependent_ptr<T>& rhs) { ptr = rhs; return *this; }
+template<typename T> inline dependent_ptr<T>& dependent_ptr<T>::operator=(const dependent_ptr<T>& rhs) { ptr = rhs.ptr; return *this; }
 
 template<typename T> inline dependent<uintptr_t> dependent_ptr<T>::to_uintptr_t() const { return dependent<uintptr_t>(reinterpret_cast<uintptr_t>(ptr)); }
 template<typename T> inline dependent<intptr_t> dependent_ptr<T>::to_intptr_t() const { return dependent<intptr_t>(reinterpret_cast<intptr_t>(ptr)); }
 
 template<typename T> inline dependent<T> dependent_ptr<T>::operator[](size_t offset) const { return dependent<T>(*(ptr + offset)); }
 
-template<typename T> inline T* dependent_ptr<T>::operator->() const { return ptr; }
+template<typename T> inline T* dependent_ptr<T>::operator->() const { CONSUME_RECORD(arrow_escape); return ptr; }
 
-template<typename T> inline dependent<T> dependent_ptr<T>::operator*() const { using shadowed = class dependency; return dependent<T>(*ptr, shadowed(ptr)); }
+// The member's address is computed from ptr, so consuming it needs no further
+// dependency.
+template<typename T> template<typename U, typename C>
+inline dependent_ptr<U> dependent_ptr<T>::member(U* C::* m) const
+{
+    static_assert(std::is_base_of<C, typename std::remove_cv<T>::type>::value, "Not a member of T");
+    return consume_load(dependent_ptr<U*>(const_cast<U**>(&(ptr->*m))));
+}
+
+template<typename T> template<typename U, typename C>
+inline dependent_ptr<U> dependent_ptr<T>::member(std::atomic<U*> C::* m) const
+{
+    static_assert(std::is_base_of<C, typename std::remove_cv<T>::type>::value, "Not a member of T");
+    static_assert(sizeof(U*) == sizeof(std::atomic<U*>), "The cast below relies on this fact");
+    return consume_load(dependent_ptr<U*>(reinterpret_cast<U**>(const_cast<std::atomic<U*>*>(&(ptr->*m)))));
+}
+
+template<typename T> template<typename U, typename C>
+inline dependent<U> dependent_ptr<T>::field(U C::* m) const
+{
+    static_assert(std::is_base_of<C, typename std::remove_cv<T>::type>::value, "Not a member of T");
+    // Pointer fields consume as a dependent_ptr, whose value is just as
+    // dependent.
+    return dependent<U>(__value(consume_load(dependent_ptr<U>(const_cast<U*>(&(ptr->*m))))));
+}
+
+template<typename T> template<typename U, typename C>
+inline dependent<U> dependent_ptr<T>::field(std::atomic<U> C::* m) const
+{
+    static_assert(std::is_base_of<C, typename std::remove_cv<T>::type>::value, "Not a member of T");
+    static_assert(sizeof(U) == sizeof(std::atomic<U>), "The cast below relies on this fact");
+    return dependent<U>(__value(consume_load(dependent_ptr<U>(reinterpret_cast<U*>(const_cast<std::atomic<U>*>(&(ptr->*m)))))));
+}
+
+// Prefetches don't fault, so neither null nor a pointer past the end of the
+// pointee's allocation needs to be excluded.
+template<typename T>
+inline void dependent_ptr<T>::prefetch(size_t lines) const
+{
+    const char* address = reinterpret_cast<const char*>(ptr);
+    for (size_t line = 0; line != lines; ++line)
+        PREFETCH(address + line * CACHE_LINE_SIZE);
+}
+
+template<typename T> template<typename U, typename C>
+inline void dependent_ptr<T>::prefetch(U C::* m) const
+{
+    static_assert(std::is_base_of<C, typename std::remove_cv<T>::type>::value, "Not a member of T");
+    PREFETCH(&(ptr->*m));
+}
+
+template<typename T> template<typename U, typename C>
+inline dependent_ptr<U> dependent_ptr<T>::prefetch_through(U* C::* m, size_t lines) const
+{
+    dependent_ptr<U> target = member(m);
+    target.prefetch(lines);
+    return target;
+}
+
+template<typename T> template<typename U, typename C>
+inline dependent_ptr<U> dependent_ptr<T>::prefetch_through(std::atomic<U*> C::* m, size_t lines) const
+{
+    dependent_ptr<U> target = member(m);
+    target.prefetch(lines);
+    return target;
+}
+
+// The load is through ptr, so the loaded value already extends ptr's chain.
+template<typename T> inline dependent<T> dependent_ptr<T>::operator*() const { return dependent<T>(*ptr); }
 
 template<typename T> inline dependent_ptr<T*> dependent_ptr<T>::operator&() const { return dependent_ptr<T*>(&ptr); }
 
-template<typename T> inline T* dependent_ptr<T>::value() const { return ptr; }
+template<typename T> inline T* dependent_ptr<T>::value() const { CONSUME_RECORD(value_escape); return ptr; }
+
+template<typename T> inline T* __pointer(const dependent_ptr<T>& p) { return p.ptr; }
+
+// Pointer fields consume as a dependent_ptr, see field().
+template<typename T> inline T* __value(const dependent_ptr<T>& p) { return __pointer(p); }
 
-template<typename T> inline dependency dependent_ptr<T>::dependency() const { using shadowed = class dependency; return shadowed(ptr); }
+template<typename T> inline class dependency dependent_ptr<T>::dependency() const { using shadowed = class dependency; return shadowed(ptr); }
 
 #endif
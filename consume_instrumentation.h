@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consume_instrumentation_h
+#define consume_instrumentation_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "helpers.h"
+
+// Instrumentation of consume operations, for finding where a program loads
+// through consume, how long its chains get, and where it drops them.
+//
+// Only compiled in when CONSUME_INSTRUMENTATION is defined, in every
+// translation unit, and otherwise every hook expands to nothing. Each hook
+// counts one event against its call site: the return address of an
+// out-of-line recording call, which once the API is inlined is an address in
+// the calling function. report::site_count gives it relative to its module, so
+// that `addr2line -f -i -e <module> <offset>` names the caller. Unoptimized
+// builds don't inline the API, and attribute events to the API itself.
+//
+// Counters live in per-thread buffers which only their thread writes, so
+// recording takes no locks and no RMW. collect() and dump() sum all buffers,
+// including those of exited threads, and may run concurrently with recording.
+//
+// Chain lengths are tracked per thread: a load from a std::atomic starts a
+// chain, and each load through a dependent pointer extends the thread's
+// current chain. Interleaved chains on one thread are therefore merged.
+
+enum class consume_event : unsigned {
+    // consume_load overloads.
+    load_atomic_pointer,
+    load_atomic_value,
+    load_dependent_pointer,
+    load_dependent_value,
+    load_pointer_with_dependency,
+    load_value_with_dependency,
+    // Dependency construction, and operator| on dependencies.
+    dependency_creation,
+    dependency_combination,
+    // Chain breaks: assigning a raw pointer to a dependent_ptr, and raw values
+    // escaping through value() or operator->.
+    raw_pointer_assignment,
+    value_escape,
+    arrow_escape,
+};
+
+class consume_instrumentation {
+public:
+    static constexpr size_t event_count = static_cast<size_t>(consume_event::arrow_escape) + 1;
+    // Chains of length 1, 2, 3-4, 5-8, ..., 65 and longer.
+    static constexpr size_t chain_buckets = 8;
+    static constexpr size_t sites_per_thread = 1024;
+
+    struct site_count {
+        const void* site;
+        consume_event event;
+        uint64_t count;
+        // The module containing the site and the site's offset in it, when
+        // they can be found.
+        const char* module;
+        uintptr_t offset;
+    };
+
+    struct report {
+        // Sorted by decreasing count.
+        std::vector<site_count> sites;
+        uint64_t events[event_count];
+        uint64_t chain_lengths[chain_buckets];
+        // Events which didn't fit in their thread's buffer, and only count in
+        // events.
+        uint64_t dropped;
+    };
+
+    static consume_instrumentation& global();
+    static const char* name(consume_event);
+
+    report collect();
+    void dump(std::ostream&);
+
+    // Zeroes every counter. Increments racing with a reset may survive it.
+    void reset();
+
+    // Recording, called by the hooks.
+    void record(const void* site, consume_event);
+
+    ~consume_instrumentation();
+
+private:
+    consume_instrumentation() = default;
+    consume_instrumentation(const consume_instrumentation&) = delete;
+    consume_instrumentation& operator=(const consume_instrumentation&) = delete;
+
+    struct slot {
+        std::atomic<const void*> site { nullptr };
+        std::atomic<unsigned> event { 0 };
+        std::atomic<uint64_t> count { 0 };
+    };
+
+    struct alignas(CACHE_LINE_SIZE) buffer {
+        slot slots[sites_per_thread];
+        std::atomic<uint64_t> events[event_count] {};
+        std::atomic<uint64_t> chain_lengths[chain_buckets] {};
+        std::atomic<uint64_t> dropped { 0 };
+        std::atomic<bool> in_use { false };
+        // Only accessed by the owning thread.
+        unsigned depth { 0 };
+    };
+
+    struct local {
+        buffer* owned { nullptr };
+        ~local();
+    };
+
+    static local& self();
+    static void bump(std::atomic<uint64_t>&);
+    static void end_chain(buffer&);
+    buffer* acquire_buffer();
+
+    static consume_instrumentation global_instance;
+
+    std::mutex registry_lock;
+    std::vector<buffer*> registry;
+};
+
+// Out of line, so that its return address is the hook's call site. A template
+// rather than an inline function, which GCC won't also mark noinline.
+template<consume_event> NEVER_INLINE void __consume_record();
+
+#define CONSUME_RECORD(event) __consume_record<consume_event::event>()
+
+#include "consume_instrumentation_impl.h"
+
+#endif
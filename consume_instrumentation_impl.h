@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consume_instrumentation_impl_h
+#define consume_instrumentation_impl_h
+
+#include <algorithm>
+#include <iomanip>
+
+#if OS(LINUX) || OS(DARWIN)
+#include <dlfcn.h>
+#endif
+
+inline consume_instrumentation consume_instrumentation::global_instance;
+
+inline consume_instrumentation& consume_instrumentation::global() { return global_instance; }
+
+inline const char* consume_instrumentation::name(consume_event event)
+{
+    static const char* const names[event_count] = {
+        "consume_load(atomic<T*>)",
+        "consume_load(atomic<T>)",
+        "consume_load(dependent_ptr<T*>)",
+        "consume_load(dependent_ptr<T>)",
+        "consume_load(T**, dependency)",
+        "consume_load(T*, dependency)",
+        "dependency creation",
+        "dependency operator|",
+        "raw pointer assignment",
+        "value() escape",
+        "operator-> escape",
+    };
+    return names[static_cast<size_t>(event)];
+}
+
+// Threads have exited by now, so no buffer is in use.
+inline consume_instrumentation::~consume_instrumentation()
+{
+    for (buffer* b : registry)
+        delete b;
+}
+
+inline consume_instrumentation::local::~local()
+{
+    if (!owned)
+        return;
+    end_chain(*owned);
+    owned->in_use.store(false, std::memory_order_release);
+}
+
+inline consume_instrumentation::local& consume_instrumentation::self()
+{
+    static thread_local local l;
+    return l;
+}
+
+// Only the owning thread increments, so a load and a store suffice.
+inline void consume_instrumentation::bump(std::atomic<uint64_t>& counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+inline void consume_instrumentation::end_chain(buffer& b)
+{
+    if (!b.depth)
+        return;
+    size_t bucket = 0;
+    for (unsigned longer = b.depth - 1; longer; longer >>= 1)
+        ++bucket;
+    bump(b.chain_lengths[std::min(bucket, chain_buckets - 1)]);
+    b.depth = 0;
+}
+
+// Buffers are recycled once their thread exits, and never freed while the
+// instrumentation lives, so collection can read them without synchronizing
+// with owners.
+inline consume_instrumentation::buffer* consume_instrumentation::acquire_buffer()
+{
+    std::lock_guard<std::mutex> locker(registry_lock);
+    for (buffer* b : registry) {
+        bool expected = false;
+        if (!b->in_use.load(std::memory_order_relaxed) && b->in_use.compare_exchange_strong(expected, true))
+            return b;
+    }
+    buffer* b = new buffer;
+    b->in_use.store(true, std::memory_order_relaxed);
+    registry.push_back(b);
+    return b;
+}
+
+inline void consume_instrumentation::record(const void* site, consume_event event)
+{
+    local& l = self();
+    if (UNLIKELY(!l.owned))
+        l.owned = acquire_buffer();
+    buffer& b = *l.owned;
+    unsigned e = static_cast<unsigned>(event);
+    bump(b.events[e]);
+
+    switch (event) {
+    case consume_event::load_atomic_pointer:
+    case consume_event::load_atomic_value:
+        end_chain(b);
+        b.depth = 1;
+        break;
+    case consume_event::load_dependent_pointer:
+    case consume_event::load_dependent_value:
+    case consume_event::load_pointer_with_dependency:
+    case consume_event::load_value_with_dependency:
+        ++b.depth;
+        break;
+    default:
+        break;
+    }
+
+    // Open addressing with a short probe: a site which doesn't fit is only
+    // counted in the totals.
+    size_t hash = (reinterpret_cast<uintptr_t>(site) ^ e) * 0x9e3779b97f4a7c15ull >> 32;
+    for (size_t probe = 0; probe != 16; ++probe) {
+        slot& s = b.slots[(hash + probe) % sites_per_thread];
+        const void* current = s.site.load(std::memory_order_relaxed);
+        if (current == site && s.event.load(std::memory_order_relaxed) == e) {
+            bump(s.count);
+            return;
+        }
+        if (!current) {
+            s.event.store(e, std::memory_order_relaxed);
+            s.count.store(1, std::memory_order_relaxed);
+            // Publishes the slot to collect().
+            s.site.store(site, std::memory_order_release);
+            return;
+        }
+    }
+    bump(b.dropped);
+}
+
+inline consume_instrumentation::report consume_instrumentation::collect()
+{
+    report r { };
+    {
+        std::lock_guard<std::mutex> locker(registry_lock);
+        for (buffer* b : registry) {
+            for (slot& s : b->slots) {
+                const void* site = s.site.load(std::memory_order_acquire);
+                if (!site)
+                    continue;
+                uint64_t count = s.count.load(std::memory_order_relaxed);
+                if (count)
+                    r.sites.push_back(site_count { site, static_cast<consume_event>(s.event.load(std::memory_order_relaxed)), count, nullptr, reinterpret_cast<uintptr_t>(site) });
+            }
+            for (size_t e = 0; e != event_count; ++e)
+                r.events[e] += b->events[e].load(std::memory_order_relaxed);
+            for (size_t c = 0; c != chain_buckets; ++c)
+                r.chain_lengths[c] += b->chain_lengths[c].load(std::memory_order_relaxed);
+            r.dropped += b->dropped.load(std::memory_order_relaxed);
+        }
+    }
+
+    // The same site may have been recorded by several threads.
+    std::sort(r.sites.begin(), r.sites.end(), [] (const site_count& a, const site_count& b) {
+            return a.site != b.site ? a.site < b.site : a.event < b.event;
+        });
+    std::vector<site_count> merged;
+    for (const site_count& s : r.sites) {
+        if (!merged.empty() && merged.back().site == s.site && merged.back().event == s.event)
+            merged.back().count += s.count;
+        else
+            merged.push_back(s);
+    }
+    std::stable_sort(merged.begin(), merged.end(), [] (const site_count& a, const site_count& b) { return a.count > b.count; });
+#if OS(LINUX) || OS(DARWIN)
+    for (site_count& s : merged) {
+        Dl_info info;
+        if (dladdr(s.site, &info) && info.dli_fbase) {
+            s.module = info.dli_fname;
+            s.offset = reinterpret_cast<uintptr_t>(s.site) - reinterpret_cast<uintptr_t>(info.dli_fbase);
+        }
+    }
+#endif
+    r.sites = std::move(merged);
+    return r;
+}
+
+inline void consume_instrumentation::dump(std::ostream& out)
+{
+    report r = collect();
+    out << "# consume instrumentation\n";
+    for (size_t e = 0; e != event_count; ++e)
+        out << std::left << std::setw(34) << name(static_cast<consume_event>(e)) << std::right << std::setw(16) << r.events[e] << '\n';
+    static const char* const lengths[chain_buckets] = { "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65+" };
+    out << "# chain length, chains\n";
+    for (size_t c = 0; c != chain_buckets; ++c)
+        out << std::left << std::setw(34) << lengths[c] << std::right << std::setw(16) << r.chain_lengths[c] << '\n';
+    out << "# event, count, site\n";
+    for (const site_count& s : r.sites) {
+        out << std::left << std::setw(34) << name(s.event) << std::right << std::setw(16) << s.count << "  ";
+        if (s.module)
+            out << s.module << "+0x" << std::hex << s.offset << std::dec << '\n';
+        else
+            out << s.site << '\n';
+    }
+    if (r.dropped)
+        out << "# " << r.dropped << " events from sites which didn't fit in their thread's buffer\n";
+}
+
+inline void consume_instrumentation::reset()
+{
+    std::lock_guard<std::mutex> locker(registry_lock);
+    for (buffer* b : registry) {
+        for (slot& s : b->slots)
+            s.count.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& counter : b->events)
+            counter.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& counter : b->chain_lengths)
+            counter.store(0, std::memory_order_relaxed);
+        b->dropped.store(0, std::memory_order_relaxed);
+    }
+}
+
+template<consume_event event>
+NEVER_INLINE void __consume_record()
+{
+#if COMPILER(GCC_OR_CLANG)
+    consume_instrumentation::global().record(__builtin_return_address(0), event);
+#else
+    consume_instrumentation::global().record(nullptr, event);
+#endif
+}
+
+#endif
@@ -26,44 +26,107 @@
 #ifndef consume_load_impl_h
 #define consume_load_impl_h
 
+namespace {
+
+template<typename T, typename std::enable_if<sizeof(T) != 16>::type* = nullptr>
+inline T __consume_load_value(const std::atomic<T>& atom) { return atom.load(consume_ordering::load_order); }
+
+// 16-byte loads are inlined where an instruction sequence is known to be
+// atomic: vmovdqa when built with AVX, and on AArch64 a plain ldp when built
+// with CONSUME_LSE2 for ARMv8.4 cores, otherwise an ldxp/stxp loop, which
+// writes the value back and so can't read read-only memory. Elsewhere, and for
+// x86-64 without AVX, they go through std::atomic and so libatomic, which picks
+// vmovdqa or lock cmpxchg16b at runtime. The policies without dependencies also
+// use std::atomic, as code which doesn't consume would.
+template<typename T, typename std::enable_if<sizeof(T) == 16>::type* = nullptr>
+inline T __consume_load_value(const std::atomic<T>& atom)
+{
+    static_assert(alignof(std::atomic<T>) == 16, "16-byte atomics must be 16-byte aligned");
+    if (!consume_ordering::carries_dependencies)
+        return atom.load(consume_ordering::load_order);
+#if CPU(X86_64) && defined(__AVX__)
+    typedef uint64_t words __attribute__((vector_size(16)));
+    words v;
+    asm volatile("vmovdqa %[mem], %[v]" : [v] "=x"(v) : [mem] "m"(atom));
+    return bit_cast<T>(__halves { v[0], v[1] });
+#elif CPU(ARM64) && defined(CONSUME_LSE2)
+    __halves h;
+    asm volatile("ldp %[low], %[high], %[mem]" : [low] "=r"(h.low), [high] "=r"(h.high) : [mem] "Q"(atom));
+    return bit_cast<T>(h);
+#elif CPU(ARM64)
+    __halves h;
+    unsigned failed;
+    asm volatile("1: ldxp %[low], %[high], %[mem]\n"
+                 "   stxp %w[failed], %[low], %[high], %[mem]\n"
+                 "   cbnz %w[failed], 1b"
+        : [low] "=&r"(h.low), [high] "=&r"(h.high), [failed] "=&r"(failed), [mem] "+Q"(const_cast<std::atomic<T>&>(atom)));
+    return bit_cast<T>(h);
+#else
+    return atom.load(std::memory_order_relaxed);
+#endif
+}
+
+// Loads through a dependent pointer, shared by the overloads below so that
+// each call is instrumented once.
+template<typename T>
+inline dependent_ptr<T> __consume_load_through(dependent_ptr<T*> dep)
+{
+    static_assert(sizeof(T*) == sizeof(std::atomic<T*>), "The cast below relies on this fact");
+    std::atomic<T*> *atom = reinterpret_cast<std::atomic<T*>*>(__pointer(dep));
+    return dependent_ptr<T>(atom->load(consume_ordering::load_order));
+}
+
+template<typename T>
+inline dependent<T> __consume_load_through(dependent_ptr<T> dep)
+{
+    static_assert(sizeof(T) == sizeof(std::atomic<T>), "The cast below relies on this fact");
+    static_assert(sizeof(T) != 16 || alignof(T) == 16, "16-byte values must be 16-byte aligned to be consumed");
+    std::atomic<T> *atom = reinterpret_cast<std::atomic<T>*>(__pointer(dep));
+    return dependent<T>(__consume_load_value(*atom));
+}
+
+} // anonymous namespace
+
 template<typename T>
 inline dependent_ptr<T> consume_load(const std::atomic<T*>& atom)
 {
-    return dependent_ptr<T>(atom.load(std::memory_order_relaxed));
+    CONSUME_RECORD(load_atomic_pointer);
+    return dependent_ptr<T>(atom.load(consume_ordering::load_order));
 }
 
 template<typename T>
 inline dependent<T> consume_load(const std::atomic<T>& atom)
 {
-    return dependent<T>(atom.load(std::memory_order_relaxed));
+    CONSUME_RECORD(load_atomic_value);
+    return dependent<T>(__consume_load_value(atom));
 }
 
 template<typename T>
 inline dependent_ptr<T> consume_load(dependent_ptr<T*> dep)
 {
-    static_assert(sizeof(dep) == sizeof(std::atomic<T**>), "The cast below relies on this fact");
-    std::atomic<T**> *atom = reinterpret_cast<std::atomic<T**>*>(&dep);
-    return dependent_ptr<T>(atom->load(std::memory_order_relaxed));
+    CONSUME_RECORD(load_dependent_pointer);
+    return __consume_load_through(dep);
 }
 
 template<typename T>
 inline dependent<T> consume_load(dependent_ptr<T> dep)
 {
-    static_assert(sizeof(dep) == sizeof(std::atomic<T*>), "The cast below relies on this fact");
-    std::atomic<T*> *atom = reinterpret_cast<std::atomic<T*>*>(&dep);
-    return dependent<T>(atom->load(std::memory_order_relaxed));
+    CONSUME_RECORD(load_dependent_value);
+    return __consume_load_through(dep);
 }
 
 template<typename T>
 inline dependent_ptr<T> consume_load(T** loc, dependency dep)
 {
-    return consume_load(dependent_ptr<T*>(loc, dep));
+    CONSUME_RECORD(load_pointer_with_dependency);
+    return __consume_load_through(dependent_ptr<T*>(loc, dep));
 }
 
 template<typename T>
 inline dependent<T> consume_load(T* loc, dependency dep)
 {
-    return consume_load(dependent_ptr<T>(loc, dep));
+    CONSUME_RECORD(load_value_with_dependency);
+    return __consume_load_through(dependent_ptr<T>(loc, dep));
 }
 
 #endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consume_shared_ptr_h
+#define consume_shared_ptr_h
+
+#include <atomic>
+#include <memory>
+#include "consume.h"
+#include "hazard_pointer.h"
+
+// An atomic std::shared_ptr whose readers take neither a lock nor a reference
+// count, for read-mostly snapshots such as configuration or routing tables.
+//
+// Each published shared_ptr is owned by an immutable control node. A reader
+// protects the current node with a hazard pointer, which consume loads it and
+// validates the protection, and then consumes the object pointer through the
+// dependent node pointer, so both the node and the object are reached through
+// dependencies. Reference counting is deferred rather than avoided: the
+// hazard pointer stands in for the reader's reference, and a replaced node is
+// retired to the hazard pointer domain, which drops the node's reference once
+// no reader protects it. A read therefore costs two stores to the reader's own
+// slot and a few loads, and never writes to a line other readers share.
+//
+// A snapshot protects its object for as long as it lives, and uses one of the
+// thread's hazard_pointer_domain::slots_per_thread slots. share() converts it
+// into an ordinary shared_ptr, at the price of one increment of the shared
+// count, for objects which must outlive the snapshot or leave the thread.
+template<typename T>
+class consume_shared_ptr {
+    struct node;
+
+public:
+    class snapshot {
+    public:
+        explicit snapshot(const consume_shared_ptr&);
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+
+        // The object, reached through the node's dependency.
+        dependent_ptr<T> get() const;
+        T* operator->() const;
+        explicit operator bool() const;
+
+        std::shared_ptr<T> share() const;
+
+    private:
+        hazard_pointer hazard;
+        dependent_ptr<node> owner;
+        dependent_ptr<T> object;
+    };
+
+    consume_shared_ptr() = default;
+    explicit consume_shared_ptr(std::shared_ptr<T>);
+    consume_shared_ptr(const consume_shared_ptr&) = delete;
+    consume_shared_ptr& operator=(const consume_shared_ptr&) = delete;
+    ~consume_shared_ptr();
+
+    // Readers.
+    snapshot load() const;
+    std::shared_ptr<T> load_shared() const;
+
+    // Writers. Stores are release stores, so the object's initialization is
+    // ordered before readers can reach it.
+    void store(std::shared_ptr<T>);
+    std::shared_ptr<T> exchange(std::shared_ptr<T>);
+
+private:
+    struct node {
+        // The object pointer is kept next to the owner, so that readers never
+        // look inside the shared_ptr.
+        T* object;
+        std::shared_ptr<T> owner;
+    };
+
+    static node* make_node(std::shared_ptr<T>);
+
+    std::atomic<node*> current { nullptr };
+};
+
+#include "consume_shared_ptr_impl.h"
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consume_shared_ptr_impl_h
+#define consume_shared_ptr_impl_h
+
+#include <utility>
+
+// Empty shared_ptrs are published as a null node, so that readers of an empty
+// consume_shared_ptr don't dereference anything.
+template<typename T>
+inline typename consume_shared_ptr<T>::node* consume_shared_ptr<T>::make_node(std::shared_ptr<T> ptr)
+{
+    if (!ptr)
+        return nullptr;
+    T* object = ptr.get();
+    return new node { object, std::move(ptr) };
+}
+
+template<typename T>
+inline consume_shared_ptr<T>::consume_shared_ptr(std::shared_ptr<T> ptr) : current(make_node(std::move(ptr))) {}
+
+// No reader may still be using the pointer, so the node is freed directly.
+template<typename T>
+inline consume_shared_ptr<T>::~consume_shared_ptr() { delete current.load(std::memory_order_relaxed); }
+
+template<typename T>
+inline consume_shared_ptr<T>::snapshot::snapshot(const consume_shared_ptr& source)
+    : owner(hazard.protect(source.current))
+    , object(__pointer(owner) ? owner.member(&node::object) : dependent_ptr<T>(nullptr))
+{
+}
+
+template<typename T>
+inline dependent_ptr<T> consume_shared_ptr<T>::snapshot::get() const { return object; }
+
+template<typename T>
+inline T* consume_shared_ptr<T>::snapshot::operator->() const { return object.operator->(); }
+
+template<typename T>
+inline consume_shared_ptr<T>::snapshot::operator bool() const { return __pointer(object); }
+
+template<typename T>
+inline std::shared_ptr<T> consume_shared_ptr<T>::snapshot::share() const
+{
+    return __pointer(owner) ? __pointer(owner)->owner : std::shared_ptr<T>();
+}
+
+template<typename T>
+inline typename consume_shared_ptr<T>::snapshot consume_shared_ptr<T>::load() const { return snapshot(*this); }
+
+template<typename T>
+inline std::shared_ptr<T> consume_shared_ptr<T>::load_shared() const { return load().share(); }
+
+template<typename T>
+inline void consume_shared_ptr<T>::store(std::shared_ptr<T> ptr)
+{
+    node* old = current.exchange(make_node(std::move(ptr)), std::memory_order_acq_rel);
+    if (old)
+        hazard_retire(old);
+}
+
+template<typename T>
+inline std::shared_ptr<T> consume_shared_ptr<T>::exchange(std::shared_ptr<T> ptr)
+{
+    node* old = current.exchange(make_node(std::move(ptr)), std::memory_order_acq_rel);
+    if (!old)
+        return std::shared_ptr<T>();
+    // Readers only read the node, so the writer which unpublished it may copy
+    // the owner before retiring it.
+    std::shared_ptr<T> previous = old->owner;
+    hazard_retire(old);
+    return previous;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef dependent_memory_h
+#define dependent_memory_h
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "consume.h"
+#include "dependent_span.h"
+
+// Bulk copies and comparisons out of buffers reached through a dependent
+// pointer, for example snapshotting a published key blob right after
+// consuming its pointer.
+//
+// Every load is a wide vector load (AVX2, SSE2 or NEON when available) whose
+// address is computed from the dependent pointer, so the whole buffer is
+// ordered after the consume_load without a fence, and without relying on a
+// library memcpy to keep the address dependency.
+
+// Copies bytes from src to dst, which must not overlap.
+void dependent_memcpy(void* dst, dependent_ptr<const uint8_t> src, size_t bytes);
+
+// Compares bytes of src against a private buffer, with memcmp's result.
+int dependent_memcmp(dependent_ptr<const uint8_t> src, const void* other, size_t bytes);
+
+// Typed forms, counting elements of a trivially copyable T.
+template<typename T> void dependent_memcpy(typename std::remove_const<T>::type* dst, dependent_ptr<T> src, size_t count);
+template<typename T> void dependent_memcpy(typename std::remove_const<T>::type* dst, dependent_span<T> src);
+template<typename T> int dependent_memcmp(dependent_ptr<T> src, const typename std::remove_const<T>::type* other, size_t count);
+
+#include "dependent_memory_impl.h"
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef dependent_memory_impl_h
+#define dependent_memory_impl_h
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Both helpers take the source address out of a dependent pointer, and only
+// compute load addresses from it.
+
+// Short tails use a pair of overlapping loads, the second ending at the last
+// byte, rather than a byte loop.
+inline void __dependent_memcpy(uint8_t* to, const uint8_t* from, size_t bytes)
+{
+#if defined(__AVX2__)
+    if (bytes >= 32) {
+        size_t i = 0;
+        for (; i + 32 <= bytes; i += 32)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i)));
+        if (i != bytes)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + bytes - 32), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + bytes - 32)));
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    if (bytes >= 16) {
+        size_t i = 0;
+        for (; i + 64 <= bytes; i += 64) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i + 32));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i + 48));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i), a);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i + 16), b);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i + 32), c);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i + 48), d);
+        }
+        for (; i + 16 <= bytes; i += 16)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i)));
+        if (i != bytes)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + bytes - 16), _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + bytes - 16)));
+        return;
+    }
+#elif defined(__ARM_NEON)
+    if (bytes >= 16) {
+        size_t i = 0;
+        for (; i + 64 <= bytes; i += 64) {
+            uint8x16_t a = vld1q_u8(from + i);
+            uint8x16_t b = vld1q_u8(from + i + 16);
+            uint8x16_t c = vld1q_u8(from + i + 32);
+            uint8x16_t d = vld1q_u8(from + i + 48);
+            vst1q_u8(to + i, a);
+            vst1q_u8(to + i + 16, b);
+            vst1q_u8(to + i + 32, c);
+            vst1q_u8(to + i + 48, d);
+        }
+        for (; i + 16 <= bytes; i += 16)
+            vst1q_u8(to + i, vld1q_u8(from + i));
+        if (i != bytes)
+            vst1q_u8(to + bytes - 16, vld1q_u8(from + bytes - 16));
+        return;
+    }
+#endif
+    for (; bytes >= 8; bytes -= 8, from += 8, to += 8) {
+        uint64_t word;
+        std::memcpy(&word, from, 8);
+        std::memcpy(to, &word, 8);
+    }
+    if (bytes >= 4) {
+        uint32_t head, tail;
+        std::memcpy(&head, from, 4);
+        std::memcpy(&tail, from + bytes - 4, 4);
+        std::memcpy(to, &head, 4);
+        std::memcpy(to + bytes - 4, &tail, 4);
+        return;
+    }
+    for (size_t i = 0; i != bytes; ++i)
+        to[i] = from[i];
+}
+
+inline int __dependent_memcmp(const uint8_t* lhs, const uint8_t* rhs, size_t bytes)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i)));
+        uint32_t differ = ~static_cast<uint32_t>(_mm256_movemask_epi8(equal));
+        if (differ) {
+            size_t at = i + count_trailing_zeros(differ);
+            return lhs[at] < rhs[at] ? -1 : 1;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    // Four vectors per iteration while they match; the single-vector loop
+    // below locates the first difference.
+    for (; i + 64 <= bytes; i += 64) {
+        __m128i equal = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i))),
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i + 16)))),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i + 32))),
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i + 48)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i + 48)))));
+        if (_mm_movemask_epi8(equal) != 0xffff)
+            break;
+    }
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i)));
+        unsigned differ = ~static_cast<unsigned>(_mm_movemask_epi8(equal)) & 0xffff;
+        if (differ) {
+            size_t at = i + count_trailing_zeros(differ);
+            return lhs[at] < rhs[at] ? -1 : 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= bytes; i += 16) {
+        // A nibble per byte, as in radix_tree_impl.h.
+        uint8x16_t equal = vceqq_u8(vld1q_u8(lhs + i), vld1q_u8(rhs + i));
+        uint64_t differ = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        if (differ) {
+            size_t at = i + count_trailing_zeros(differ) / 4;
+            return lhs[at] < rhs[at] ? -1 : 1;
+        }
+    }
+#endif
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t left, right;
+        std::memcpy(&left, lhs + i, 8);
+        std::memcpy(&right, rhs + i, 8);
+        if (left != right)
+            break;
+    }
+    for (; i != bytes; ++i) {
+        if (lhs[i] != rhs[i])
+            return lhs[i] < rhs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+} // anonymous namespace
+
+inline void dependent_memcpy(void* dst, dependent_ptr<const uint8_t> src, size_t bytes)
+{
+    __dependent_memcpy(static_cast<uint8_t*>(dst), __pointer(src), bytes);
+}
+
+inline int dependent_memcmp(dependent_ptr<const uint8_t> src, const void* other, size_t bytes)
+{
+    return __dependent_memcmp(__pointer(src), static_cast<const uint8_t*>(other), bytes);
+}
+
+template<typename T>
+inline void dependent_memcpy(typename std::remove_const<T>::type* dst, dependent_ptr<T> src, size_t count)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "dependent_memcpy copies bytes");
+    __dependent_memcpy(reinterpret_cast<uint8_t*>(dst), reinterpret_cast<const uint8_t*>(__pointer(src)), count * sizeof(T));
+}
+
+template<typename T>
+inline void dependent_memcpy(typename std::remove_const<T>::type* dst, dependent_span<T> src)
+{
+    dependent_memcpy(dst, src.data(), src.size());
+}
+
+template<typename T>
+inline int dependent_memcmp(dependent_ptr<T> src, const typename std::remove_const<T>::type* other, size_t count)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "dependent_memcmp compares bytes");
+    return __dependent_memcmp(reinterpret_cast<const uint8_t*>(__pointer(src)), reinterpret_cast<const uint8_t*>(other), count * sizeof(T));
+}
+
+#endif
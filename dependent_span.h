@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef dependent_span_h
+#define dependent_span_h
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include "consume.h"
+
+// A contiguous range of elements reached through a dependent pointer, such as
+// a published array. The range's base address carries the dependency, and so
+// does every element address computed from it: the dependency is derived once
+// for the whole range instead of once per element.
+//
+// Iterators are plain pointers, so spans work with range-for and standard
+// algorithms, and compilers are free to vectorize loops over them. Element
+// accesses are in the dependency chain and, per dependent_ptr::value(), extend
+// the chain to the values read.
+template<typename T>
+class dependent_span {
+public:
+    typedef T element_type;
+    typedef typename std::remove_cv<T>::type value_type;
+    typedef size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T& reference;
+    typedef T* pointer;
+    typedef T* iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    // Elements [0, size) of an array whose address already carries a
+    // dependency, typically from consume_load.
+    dependent_span(dependent_ptr<T> data, size_t size);
+
+    // Elements [0, size) of an array, ordered after the dependency.
+    dependent_span(T* data, size_t size, dependency);
+
+    // From a span of non-const elements.
+    template<typename U, typename = typename std::enable_if<std::is_convertible<U(*)[], T(*)[]>::value>::type>
+    dependent_span(const dependent_span<U>&);
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+
+    reference operator[](size_t) const;
+    reference front() const;
+    reference back() const;
+    size_t size() const;
+    size_t size_bytes() const;
+    bool empty() const;
+
+    // The base address, with the chain extending to it.
+    dependent_ptr<T> data() const;
+
+    // Sub-ranges share the dependency.
+    dependent_span first(size_t count) const;
+    dependent_span last(size_t count) const;
+    dependent_span subspan(size_t offset, size_t count) const;
+
+private:
+    // Exposition only:
+    T* ptr;
+    size_t count;
+};
+
+#include "dependent_span_impl.h"
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef dependent_span_impl_h
+#define dependent_span_impl_h
+
+template<typename T>
+inline dependent_span<T>::dependent_span(dependent_ptr<T> data, size_t size) : ptr(__pointer(data)), count(size) {}
+
+template<typename T>
+inline dependent_span<T>::dependent_span(T* data, size_t size, dependency d) : ptr(__pointer(dependent_ptr<T>(data, d))), count(size) {}
+
+template<typename T>
+template<typename U, typename>
+inline dependent_span<T>::dependent_span(const dependent_span<U>& other) : ptr(__pointer(other.data())), count(other.size()) {}
+
+template<typename T>
+inline typename dependent_span<T>::iterator dependent_span<T>::begin() const { return ptr; }
+template<typename T>
+inline typename dependent_span<T>::iterator dependent_span<T>::end() const { return ptr + count; }
+template<typename T>
+inline typename dependent_span<T>::reverse_iterator dependent_span<T>::rbegin() const { return reverse_iterator(end()); }
+template<typename T>
+inline typename dependent_span<T>::reverse_iterator dependent_span<T>::rend() const { return reverse_iterator(begin()); }
+
+template<typename T>
+inline T& dependent_span<T>::operator[](size_t index) const { return ptr[index]; }
+template<typename T>
+inline T& dependent_span<T>::front() const { return ptr[0]; }
+template<typename T>
+inline T& dependent_span<T>::back() const { return ptr[count - 1]; }
+template<typename T>
+inline size_t dependent_span<T>::size() const { return count; }
+template<typename T>
+inline size_t dependent_span<T>::size_bytes() const { return count * sizeof(T); }
+template<typename T>
+inline bool dependent_span<T>::empty() const { return !count; }
+
+template<typename T>
+inline dependent_ptr<T> dependent_span<T>::data() const { return dependent_ptr<T>(ptr); }
+
+template<typename T>
+inline dependent_span<T> dependent_span<T>::first(size_t n) const { return dependent_span(dependent_ptr<T>(ptr), n); }
+template<typename T>
+inline dependent_span<T> dependent_span<T>::last(size_t n) const { return dependent_span(dependent_ptr<T>(ptr + count - n), n); }
+template<typename T>
+inline dependent_span<T> dependent_span<T>::subspan(size_t offset, size_t n) const { return dependent_span(dependent_ptr<T>(ptr + offset), n); }
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include "consume.h"
+#include "rcu.h"
+
+// A read-mostly hash map whose lookups take no locks and execute no fences.
+//
+// Lookups consume the table pointer, then reach the bucket, every chain link
+// and the matching entry through dependencies carried from that first load.
+// Writers are serialized by a mutex, publish new nodes with release stores,
+// and reclaim unlinked nodes through RCU. Growing the table copies every node
+// into a new table which is published in one store, so readers see either the
+// old table or the new one and never a half-moved chain; the old table is
+// freed after a grace period.
+//
+// Readers must be inside an RCU read section of the map's flavor while they
+// use results from lookup(); find() enters one itself.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Flavor = rcu_epoch>
+class consume_hash_map {
+public:
+    explicit consume_hash_map(size_t initial_buckets = 16, double max_load_factor = 1.0);
+    ~consume_hash_map();
+    consume_hash_map(const consume_hash_map&) = delete;
+    consume_hash_map& operator=(const consume_hash_map&) = delete;
+
+    // Readers.
+
+    // The value for key, or null. The pointer carries the lookup's dependency
+    // chain, and stays valid until the enclosing read section ends.
+    dependent_ptr<const Value> lookup(const Key&) const;
+
+    // Copies the value for key into out, within its own read section.
+    bool find(const Key&, Value& out) const;
+
+    // Writers.
+
+    // Returns false, leaving the map unchanged, if key is already present.
+    bool insert(const Key&, const Value&);
+
+    // Replaces the node holding key, if any, instead of mutating it in place.
+    void insert_or_assign(const Key&, const Value&);
+
+    bool erase(const Key&);
+
+    size_t size() const;
+    size_t bucket_count() const;
+
+private:
+    struct node {
+        node* next;
+        size_t hash;
+        Key key;
+        Value value;
+    };
+
+    struct table {
+        rcu_head head;
+        size_t mask;
+        node* buckets[1];
+    };
+
+    static table* create_table(size_t buckets);
+    static void destroy_table(table*);
+    static std::atomic<node*>& as_atomic(node*&);
+    node** find_link(table*, size_t hash, const Key&) const;
+    void insert_locked(table*, size_t hash, const Key&, const Value&);
+    void grow(table*);
+
+    std::atomic<table*> current;
+    double max_load_factor;
+    size_t count { 0 };
+    mutable std::mutex writer_lock;
+    Hash hasher;
+};
+
+#include "hash_map_impl.h"
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hash_map_impl_h
+#define hash_map_impl_h
+
+#include <new>
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline consume_hash_map<Key, Value, Hash, Flavor>::consume_hash_map(size_t initial_buckets, double max_load_factor)
+    : max_load_factor(max_load_factor)
+{
+    size_t buckets = 1;
+    while (buckets < initial_buckets)
+        buckets *= 2;
+    current.store(create_table(buckets), std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline consume_hash_map<Key, Value, Hash, Flavor>::~consume_hash_map()
+{
+    destroy_table(current.load(std::memory_order_relaxed));
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline typename consume_hash_map<Key, Value, Hash, Flavor>::table* consume_hash_map<Key, Value, Hash, Flavor>::create_table(size_t buckets)
+{
+    void* memory = ::operator new(sizeof(table) + (buckets - 1) * sizeof(node*));
+    table* t = new (memory) table;
+    t->mask = buckets - 1;
+    for (size_t i = 0; i != buckets; ++i)
+        t->buckets[i] = nullptr;
+    return t;
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline void consume_hash_map<Key, Value, Hash, Flavor>::destroy_table(table* t)
+{
+    for (size_t i = 0; i <= t->mask; ++i) {
+        for (node* n = t->buckets[i]; n; ) {
+            node* next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+    t->~table();
+    ::operator delete(t);
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline std::atomic<typename consume_hash_map<Key, Value, Hash, Flavor>::node*>& consume_hash_map<Key, Value, Hash, Flavor>::as_atomic(node*& link)
+{
+    static_assert(sizeof(node*) == sizeof(std::atomic<node*>), "The cast below relies on this fact");
+    return reinterpret_cast<std::atomic<node*>&>(link);
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline dependent_ptr<const Value> consume_hash_map<Key, Value, Hash, Flavor>::lookup(const Key& key) const
+{
+    size_t hash = hasher(key);
+    dependent_ptr<table> t = consume_load(current);
+    dependent_ptr<node> n = consume_load(&__pointer(t)->buckets[hash & __pointer(t)->mask], t.dependency());
+    while (__pointer(n)) {
+        if (__pointer(n)->hash == hash && __pointer(n)->key == key)
+            return dependent_ptr<const Value>(&__pointer(n)->value, n.dependency());
+        n = consume_load(&__pointer(n)->next, n.dependency());
+    }
+    return nullptr;
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline bool consume_hash_map<Key, Value, Hash, Flavor>::find(const Key& key, Value& out) const
+{
+    rcu_read_guard<Flavor> guard;
+    dependent_ptr<const Value> value = lookup(key);
+    if (!__pointer(value))
+        return false;
+    out = *__pointer(value);
+    return true;
+}
+
+// Writers only. Returns the link which points at key's node, or the null link
+// terminating its chain.
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline typename consume_hash_map<Key, Value, Hash, Flavor>::node** consume_hash_map<Key, Value, Hash, Flavor>::find_link(table* t, size_t hash, const Key& key) const
+{
+    node** link = &t->buckets[hash & t->mask];
+    while (*link && !((*link)->hash == hash && (*link)->key == key))
+        link = &(*link)->next;
+    return link;
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline bool consume_hash_map<Key, Value, Hash, Flavor>::insert(const Key& key, const Value& value)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    table* t = current.load(std::memory_order_relaxed);
+    size_t hash = hasher(key);
+    if (*find_link(t, hash, key))
+        return false;
+    insert_locked(t, hash, key, value);
+    return true;
+}
+
+// Writers only, with writer_lock held and key absent.
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline void consume_hash_map<Key, Value, Hash, Flavor>::insert_locked(table* t, size_t hash, const Key& key, const Value& value)
+{
+    node** bucket = &t->buckets[hash & t->mask];
+    as_atomic(*bucket).store(new node { *bucket, hash, key, value }, std::memory_order_release);
+    if (++count > max_load_factor * (t->mask + 1))
+        grow(t);
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline void consume_hash_map<Key, Value, Hash, Flavor>::insert_or_assign(const Key& key, const Value& value)
+{
+    std::unique_lock<std::mutex> locker(writer_lock);
+    table* t = current.load(std::memory_order_relaxed);
+    size_t hash = hasher(key);
+    node** link = find_link(t, hash, key);
+    if (node* old = *link) {
+        as_atomic(*link).store(new node { old->next, hash, key, value }, std::memory_order_release);
+        locker.unlock();
+        rcu_delete<Flavor>(old);
+        return;
+    }
+    insert_locked(t, hash, key, value);
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline bool consume_hash_map<Key, Value, Hash, Flavor>::erase(const Key& key)
+{
+    node* old;
+    {
+        std::lock_guard<std::mutex> locker(writer_lock);
+        node** link = find_link(current.load(std::memory_order_relaxed), hasher(key), key);
+        old = *link;
+        if (!old)
+            return false;
+        as_atomic(*link).store(old->next, std::memory_order_release);
+        --count;
+    }
+    rcu_delete<Flavor>(old);
+    return true;
+}
+
+// Nodes are copied rather than moved: readers may be traversing the old
+// chains, whose links must stay intact until a grace period has elapsed.
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline void consume_hash_map<Key, Value, Hash, Flavor>::grow(table* old)
+{
+    table* t = create_table(2 * (old->mask + 1));
+    for (size_t i = 0; i <= old->mask; ++i) {
+        for (node* n = old->buckets[i]; n; n = n->next) {
+            node** bucket = &t->buckets[n->hash & t->mask];
+            *bucket = new node { *bucket, n->hash, n->key, n->value };
+        }
+    }
+    current.store(t, std::memory_order_release);
+    call_rcu<Flavor>(&old->head, [] (rcu_head* head) { destroy_table(reinterpret_cast<table*>(head)); });
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline size_t consume_hash_map<Key, Value, Hash, Flavor>::size() const
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    return count;
+}
+
+template<typename Key, typename Value, typename Hash, typename Flavor>
+inline size_t consume_hash_map<Key, Value, Hash, Flavor>::bucket_count() const
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    return current.load(std::memory_order_relaxed)->mask + 1;
+}
+
+#endif
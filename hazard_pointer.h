@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hazard_pointer_h
+#define hazard_pointer_h
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "consume.h"
+
+// Hazard pointers, for reclaiming nodes which long-running readers reach
+// through consume_load. Unlike RCU, a stalled reader only pins the nodes it
+// protects, so the number of unreclaimed nodes stays bounded.
+//
+// A reader publishes the pointer it's about to dereference in a hazard pointer
+// slot, then re-reads the source to validate that the node was still reachable
+// after publication. Both loads are consume loads, and the returned
+// dependent_ptr carries the dependency of the validating load, so protection
+// never forces an acquire reload. The slot store is ordered before that reload
+// by a light fence which is only a compiler fence when membarrier is available;
+// reclaimers pay for the full barrier instead.
+//
+// Retired nodes are batched per thread, and each scan runs once the batch
+// outgrows twice the number of slots, so reclamation costs amortized constant
+// time per node and each thread holds at most that many unreclaimed nodes.
+
+class hazard_pointer;
+
+class hazard_pointer_domain {
+public:
+    static constexpr unsigned slots_per_thread = 8;
+
+    // Hazard pointers all belong to a single process-wide domain.
+    static hazard_pointer_domain& global();
+
+    // Invokes deleter(ptr) once no hazard pointer protects ptr. The node must
+    // already be unreachable from any source a reader could protect it from.
+    void retire(void* ptr, void (*deleter)(void*));
+    template<typename T> void retire(T*);
+
+    // Scans the calling thread's retired nodes, regardless of batch size.
+    void reclaim();
+
+    ~hazard_pointer_domain();
+
+private:
+    friend class hazard_pointer;
+
+    hazard_pointer_domain();
+    hazard_pointer_domain(const hazard_pointer_domain&) = delete;
+    hazard_pointer_domain& operator=(const hazard_pointer_domain&) = delete;
+
+    struct alignas(CACHE_LINE_SIZE) record {
+        std::atomic<const void*> slots[slots_per_thread] {};
+        std::atomic<bool> in_use { false };
+        // Only accessed by the owning thread.
+        unsigned free_mask { 0 };
+    };
+
+    struct retired {
+        void* ptr;
+        void (*deleter)(void*);
+    };
+
+    struct local {
+        record* owned { nullptr };
+        std::vector<retired> retired_list;
+        ~local();
+    };
+
+    static local& self();
+    record* acquire_record();
+    void scan(std::vector<retired>&);
+
+    static hazard_pointer_domain global_domain;
+
+    bool has_membarrier;
+    std::atomic<size_t> record_count { 0 };
+    std::mutex registry_lock;
+    std::vector<record*> registry;
+    std::vector<retired> orphans;
+};
+
+// A single hazard pointer slot, owned by the constructing thread. Each thread
+// can own up to hazard_pointer_domain::slots_per_thread at once.
+class hazard_pointer {
+public:
+    hazard_pointer();
+    ~hazard_pointer();
+    hazard_pointer(const hazard_pointer&) = delete;
+    hazard_pointer& operator=(const hazard_pointer&) = delete;
+
+    // Protects the node currently published in the source, and returns it
+    // with the dependency of the load which validated protection.
+    template<typename T> dependent_ptr<T> protect(const std::atomic<T*>&);
+
+    // Same, for a source field within a node which is itself protected, as in
+    // hand-over-hand traversal. The dependency of the field's address carries
+    // through to the result.
+    template<typename T> dependent_ptr<T> protect(dependent_ptr<T*>);
+
+    // Single attempt: protects ptr, which was previously consume loaded from
+    // the source, and returns true if the source still holds it. Otherwise
+    // updates ptr to the source's new value and returns false.
+    template<typename T> bool try_protect(dependent_ptr<T>&, const std::atomic<T*>&);
+
+    // Protects a node without validation, for nodes known to be protected by
+    // another hazard pointer. Null clears protection.
+    void reset_protection(const void* = nullptr);
+
+private:
+    std::atomic<const void*>* slot;
+    unsigned index;
+    bool has_membarrier;
+};
+
+// Retires the node in the global domain.
+template<typename T> void hazard_retire(T*);
+
+#include "hazard_pointer_impl.h"
+
+#endif
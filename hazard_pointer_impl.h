@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hazard_pointer_impl_h
+#define hazard_pointer_impl_h
+
+#include <algorithm>
+#include <cstdlib>
+#include "membarrier.h"
+
+// A namespace-scope object rather than a function-local static: the latter's
+// initialization guard would put an acquire load on the protection path.
+inline hazard_pointer_domain hazard_pointer_domain::global_domain;
+
+inline hazard_pointer_domain& hazard_pointer_domain::global() { return global_domain; }
+
+inline hazard_pointer_domain::hazard_pointer_domain() : has_membarrier(__register_membarrier()) {}
+
+// Threads have exited by now, so nothing can be protected.
+inline hazard_pointer_domain::~hazard_pointer_domain()
+{
+    for (const retired& r : orphans)
+        r.deleter(r.ptr);
+    for (record* rec : registry)
+        delete rec;
+}
+
+inline hazard_pointer_domain::local::~local()
+{
+    hazard_pointer_domain& domain = global();
+    if (owned) {
+        for (std::atomic<const void*>& slot : owned->slots)
+            slot.store(nullptr, std::memory_order_release);
+        owned->in_use.store(false, std::memory_order_release);
+    }
+    if (retired_list.empty())
+        return;
+    domain.scan(retired_list);
+    std::lock_guard<std::mutex> locker(domain.registry_lock);
+    domain.orphans.insert(domain.orphans.end(), retired_list.begin(), retired_list.end());
+}
+
+inline hazard_pointer_domain::local& hazard_pointer_domain::self()
+{
+    static thread_local local l;
+    return l;
+}
+
+// Records are recycled once their thread exits, and are never freed while the
+// domain lives, so scans can read them without synchronizing with owners.
+inline hazard_pointer_domain::record* hazard_pointer_domain::acquire_record()
+{
+    std::lock_guard<std::mutex> locker(registry_lock);
+    for (record* rec : registry) {
+        bool expected = false;
+        if (!rec->in_use.load(std::memory_order_relaxed) && rec->in_use.compare_exchange_strong(expected, true)) {
+            rec->free_mask = (1u << slots_per_thread) - 1;
+            return rec;
+        }
+    }
+    record* rec = new record;
+    rec->in_use.store(true, std::memory_order_relaxed);
+    rec->free_mask = (1u << slots_per_thread) - 1;
+    registry.push_back(rec);
+    record_count.fetch_add(1, std::memory_order_relaxed);
+    return rec;
+}
+
+inline void hazard_pointer_domain::scan(std::vector<retired>& list)
+{
+    // Pairs with the light fence between publishing a hazard pointer and
+    // validating it: either the reader's validation sees the node unlinked, or
+    // this scan sees the hazard pointer.
+    __heavy_fence(has_membarrier);
+
+    std::vector<const void*> hazards;
+    {
+        std::lock_guard<std::mutex> locker(registry_lock);
+        hazards.reserve(registry.size() * slots_per_thread);
+        for (record* rec : registry) {
+            for (std::atomic<const void*>& slot : rec->slots) {
+                if (const void* hazard = slot.load(std::memory_order_relaxed))
+                    hazards.push_back(hazard);
+            }
+        }
+        list.insert(list.end(), orphans.begin(), orphans.end());
+        orphans.clear();
+    }
+    std::sort(hazards.begin(), hazards.end());
+
+    auto protectedEnd = std::partition(list.begin(), list.end(), [&] (const retired& r) {
+            return std::binary_search(hazards.begin(), hazards.end(), r.ptr);
+        });
+    std::vector<retired> reclaimable(protectedEnd, list.end());
+    list.erase(protectedEnd, list.end());
+    for (const retired& r : reclaimable)
+        r.deleter(r.ptr);
+}
+
+inline void hazard_pointer_domain::retire(void* ptr, void (*deleter)(void*))
+{
+    std::vector<retired>& list = self().retired_list;
+    list.push_back(retired { ptr, deleter });
+    size_t threshold = std::max<size_t>(64, 2 * slots_per_thread * record_count.load(std::memory_order_relaxed));
+    if (list.size() >= threshold)
+        scan(list);
+}
+
+template<typename T>
+inline void hazard_pointer_domain::retire(T* ptr)
+{
+    retire(const_cast<void*>(static_cast<const void*>(ptr)), [] (void* p) { delete static_cast<T*>(p); });
+}
+
+inline void hazard_pointer_domain::reclaim() { scan(self().retired_list); }
+
+inline hazard_pointer::hazard_pointer()
+{
+    hazard_pointer_domain::local& l = hazard_pointer_domain::self();
+    if (UNLIKELY(!l.owned))
+        l.owned = hazard_pointer_domain::global().acquire_record();
+    if (UNLIKELY(!l.owned->free_mask))
+        abort(); // More than slots_per_thread live hazard pointers on this thread.
+    index = count_trailing_zeros(l.owned->free_mask);
+    l.owned->free_mask &= ~(1u << index);
+    slot = &l.owned->slots[index];
+    has_membarrier = hazard_pointer_domain::global().has_membarrier;
+}
+
+inline hazard_pointer::~hazard_pointer()
+{
+    slot->store(nullptr, std::memory_order_release);
+    hazard_pointer_domain::self().owned->free_mask |= 1u << index;
+}
+
+template<typename T>
+inline bool hazard_pointer::try_protect(dependent_ptr<T>& ptr, const std::atomic<T*>& src)
+{
+    slot->store(__pointer(ptr), std::memory_order_relaxed);
+    __light_fence(has_membarrier);
+    dependent_ptr<T> validated = consume_load(src);
+    bool stable = __pointer(validated) == __pointer(ptr);
+    ptr = validated;
+    return stable;
+}
+
+template<typename T>
+inline dependent_ptr<T> hazard_pointer::protect(const std::atomic<T*>& src)
+{
+    dependent_ptr<T> ptr = consume_load(src);
+    while (!try_protect(ptr, src)) { }
+    return ptr;
+}
+
+template<typename T>
+inline dependent_ptr<T> hazard_pointer::protect(dependent_ptr<T*> src)
+{
+    dependent_ptr<T> ptr = consume_load(src);
+    for (;;) {
+        slot->store(__pointer(ptr), std::memory_order_relaxed);
+        __light_fence(has_membarrier);
+        dependent_ptr<T> validated = consume_load(src);
+        if (__pointer(validated) == __pointer(ptr))
+            return validated;
+        ptr = validated;
+    }
+}
+
+inline void hazard_pointer::reset_protection(const void* ptr) { slot->store(ptr, std::memory_order_release); }
+
+template<typename T> inline void hazard_retire(T* ptr) { hazard_pointer_domain::global().retire(ptr); }
+
+#endif
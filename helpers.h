@@ -63,6 +63,20 @@ inline To bit_cast(const From& from) noexcept {
 #if defined(arm)  || defined(__arm__)  || defined(ARM)  || defined(_ARM_)
 #define WTF_CPU_ARM 1
 #endif
+#if defined(__powerpc64__) || defined(__ppc64__)
+#define WTF_CPU_PPC64 1
+#endif
+#if defined(__riscv) && defined(__riscv_xlen) && __riscv_xlen == 64
+#define WTF_CPU_RISCV64 1
+#endif
+
+#define OS(WTF_FEATURE) (defined WTF_OS_##WTF_FEATURE  && WTF_OS_##WTF_FEATURE)
+#if defined(__linux__)
+#define WTF_OS_LINUX 1
+#endif
+#if defined(__APPLE__)
+#define WTF_OS_DARWIN 1
+#endif
 
 #define COMPILER(WTF_FEATURE) (defined WTF_COMPILER_##WTF_FEATURE  && WTF_COMPILER_##WTF_FEATURE)
 #if defined(__GNUC__)
@@ -89,4 +103,57 @@ inline To bit_cast(const From& from) noexcept {
 #define UNLIKELY(x) (x)
 #endif
 
+// The cache line size, which prefetches step by and which allocations readers
+// share are rounded to. POWER and Apple's ARM64 cores have 128-byte lines.
+#if !defined(CACHE_LINE_SIZE) && (CPU(PPC64) || (CPU(ARM64) && OS(DARWIN)))
+#define CACHE_LINE_SIZE 128
+#endif
+#if !defined(CACHE_LINE_SIZE)
+#define CACHE_LINE_SIZE 64
+#endif
+
+// A read prefetch into all cache levels: prefetcht0 on x86, prfm pldl1keep on
+// ARM.
+#if !defined(PREFETCH) && COMPILER(GCC_OR_CLANG)
+#define PREFETCH(address) __builtin_prefetch((address), 0, 3)
+#endif
+#if !defined(PREFETCH)
+#define PREFETCH(address) ((void)(address))
+#endif
+
+// The index of the lowest set bit of a non-zero unsigned integer.
+template<typename T>
+inline unsigned count_trailing_zeros(T value)
+{
+    static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value && sizeof(T) <= 8, "Only for unsigned integers");
+#if COMPILER(GCC_OR_CLANG)
+    if (sizeof(T) <= sizeof(unsigned))
+        return __builtin_ctz(static_cast<unsigned>(value));
+    return __builtin_ctzll(static_cast<unsigned long long>(value));
+#else
+    unsigned count = 0;
+    for (; !(value & 1); value >>= 1)
+        ++count;
+    return count;
+#endif
+}
+
+// The number of zero bits above the highest set bit of a non-zero unsigned
+// integer, within T's width.
+template<typename T>
+inline unsigned count_leading_zeros(T value)
+{
+    static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value && sizeof(T) <= 8, "Only for unsigned integers");
+#if COMPILER(GCC_OR_CLANG)
+    if (sizeof(T) <= sizeof(unsigned))
+        return __builtin_clz(static_cast<unsigned>(value)) - (sizeof(unsigned) - sizeof(T)) * 8;
+    return __builtin_clzll(static_cast<unsigned long long>(value));
+#else
+    unsigned count = 0;
+    for (; !(value >> (sizeof(T) * 8 - 1)); value <<= 1)
+        ++count;
+    return count;
+#endif
+}
+
 #endif
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Litmus stress engine for the publication patterns consume_load exists for.
+// Each test runs many thread groups at once for millions of iterations, once
+// through the consume_load paths, once with acquire loads, and once with
+// relaxed loads as a control, and reports how often each observed an outcome
+// the pattern forbids along with iterations per second.
+//
+//   mp     Message passing. W: data = 1; flag = 1 (release).
+//          R: wait for flag; read data through flag's dependency.
+//          Forbidden: data == 0.
+//   wrc    Write-to-read causality. T0: x = 1. T1: wait for x; y = x (release).
+//          T2: wait for y; read x through y's dependency.
+//          Forbidden: x == 0.
+//   chain  Pointer-chain publication. W: initialize a chain of nodes, then
+//          publish its head (release). R: wait for the head and walk the
+//          chain through member(). Forbidden: any node not yet initialized.
+//
+// Each group runs --iterations iterations, in batches. Before each batch, the
+// group's variables are reset and scattered over the lines of the group's
+// arena in a random order, then the threads meet at a barrier and race through
+// the batch: the readers spin on each slot until it's published, which keeps
+// them right behind the writers, where reorderings show up. Groups are pinned
+// to CPUs in a random order, and optional stress threads stream through a
+// large buffer to keep the memory system busy.
+//
+// The relaxed control should show forbidden outcomes on weakly ordered CPUs
+// given enough iterations, which shows that the harness can catch what it's
+// looking for; on x86, whose TSO ordering forbids all three outcomes even for
+// relaxed loads, it shouldn't. Any forbidden outcome on the consume_load or
+// acquire paths makes the exit status non-zero, so a run can gate a compiler.
+//
+// Usage: litmus [--tests mp,wrc,chain] [--iterations N] [--groups N] [--batch N]
+//               [--chain L] [--stress N] [--seed S]
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include "bench/bench.h"
+#include "consume.h"
+
+namespace {
+
+constexpr size_t line_size = CACHE_LINE_SIZE;
+
+inline std::atomic<uint64_t>& as_atomic(uint64_t& word) {
+    static_assert(sizeof(uint64_t) == sizeof(std::atomic<uint64_t>), "The cast below relies on this fact");
+    return reinterpret_cast<std::atomic<uint64_t>&>(word);
+}
+
+// Readers wait for writers which may have been preempted, so they back off to
+// the scheduler after a while.
+inline void backoff(unsigned& spins) {
+    if (++spins > 256)
+        std::this_thread::yield();
+}
+
+class SpinBarrier {
+public:
+    explicit SpinBarrier(unsigned count) : count(count) {}
+
+    void wait() {
+        unsigned gen = generation.load(std::memory_order_acquire);
+        if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == count) {
+            arrived.store(0, std::memory_order_relaxed);
+            generation.store(gen + 1, std::memory_order_release);
+            return;
+        }
+        for (unsigned spins = 0; generation.load(std::memory_order_acquire) == gen; )
+            backoff(spins);
+    }
+
+private:
+    unsigned count;
+    std::atomic<unsigned> arrived { 0 };
+    std::atomic<unsigned> generation { 0 };
+};
+
+struct alignas(CACHE_LINE_SIZE) Node {
+    Node* next;
+    uint64_t value;
+};
+
+// Read paths. Each spins until its source is published, then reads what the
+// publication is supposed to order.
+
+struct ConsumePath {
+    static constexpr const char* name = "consume_load";
+    static constexpr bool ordered = true;
+    static constexpr std::memory_order store_order = std::memory_order_release;
+
+    static uint64_t wait(std::atomic<uint64_t>& flag) {
+        unsigned spins = 0;
+        dependent<uint64_t> f = consume_load(flag);
+        while (!f.value()) {
+            backoff(spins);
+            f = consume_load(flag);
+        }
+        return f.value();
+    }
+
+    static uint64_t read_after(std::atomic<uint64_t>& flag, uint64_t& data) {
+        unsigned spins = 0;
+        dependent<uint64_t> f = consume_load(flag);
+        while (!f.value()) {
+            backoff(spins);
+            f = consume_load(flag);
+        }
+        return consume_load(&data, f.dependency()).value();
+    }
+
+    // Returns how many nodes of the chain were not yet initialized to value.
+    static size_t walk(std::atomic<Node*>& head, uint64_t value) {
+        unsigned spins = 0;
+        dependent_ptr<Node> p = consume_load(head);
+        while (!p.value()) {
+            backoff(spins);
+            p = consume_load(head);
+        }
+        size_t stale = 0;
+        for (; p.value(); p = p.member(&Node::next))
+            stale += p.field(&Node::value).value() != value;
+        return stale;
+    }
+};
+
+template<std::memory_order order>
+struct OrderedPath {
+    static constexpr const char* name = order == std::memory_order_acquire ? "acquire" : "relaxed";
+    static constexpr bool ordered = order == std::memory_order_acquire;
+    static constexpr std::memory_order store_order = order == std::memory_order_acquire ? std::memory_order_release : std::memory_order_relaxed;
+
+    static uint64_t wait(std::atomic<uint64_t>& flag) {
+        unsigned spins = 0;
+        uint64_t f;
+        while (!(f = flag.load(order)))
+            backoff(spins);
+        return f;
+    }
+
+    static uint64_t read_after(std::atomic<uint64_t>& flag, uint64_t& data) {
+        wait(flag);
+        return as_atomic(data).load(std::memory_order_relaxed);
+    }
+
+    static size_t walk(std::atomic<Node*>& head, uint64_t value) {
+        unsigned spins = 0;
+        Node* p;
+        while (!(p = head.load(order)))
+            backoff(spins);
+        size_t stale = 0;
+        for (; p; p = reinterpret_cast<std::atomic<Node*>&>(p->next).load(std::memory_order_relaxed))
+            stale += as_atomic(p->value).load(std::memory_order_relaxed) != value;
+        return stale;
+    }
+};
+
+// A group's variables, scattered over the lines of its arena. Slot k's
+// variable v lives on line place[k * vars + v].
+struct Arena {
+    Arena(size_t batch, size_t vars)
+        : batch(batch)
+        , vars(vars)
+        , lines(new Line[batch * vars])
+        , place(batch * vars)
+    {
+        for (size_t i = 0; i != place.size(); ++i)
+            place[i] = i;
+    }
+
+    struct alignas(CACHE_LINE_SIZE) Line {
+        uint64_t words[line_size / sizeof(uint64_t)];
+    };
+
+    template<typename T>
+    T& at(size_t slot, size_t var) {
+        static_assert(sizeof(T) <= line_size, "Variables occupy one line");
+        return *reinterpret_cast<T*>(&lines[place[slot * vars + var]]);
+    }
+
+    void scatter(std::mt19937_64& rng) {
+        std::shuffle(place.begin(), place.end(), rng);
+        std::memset(static_cast<void*>(lines.get()), 0, batch * vars * sizeof(Line));
+    }
+
+    size_t batch;
+    size_t vars;
+    std::unique_ptr<Line[]> lines;
+    std::vector<uint32_t> place;
+};
+
+struct Options {
+    std::vector<std::string> tests { "mp", "wrc", "chain" };
+    size_t iterations { 1000000 };
+    size_t groups { 0 };
+    size_t batch { 1024 };
+    size_t chain { 4 };
+    size_t stress { 1 };
+    uint64_t seed { 42 };
+};
+
+// Tests. Each thread of a group runs role(thread, ...) over every slot of a
+// batch, adding forbidden outcomes to its count.
+
+template<typename Path>
+struct MessagePassing {
+    static constexpr const char* name = "mp";
+    static constexpr unsigned threads = 2;
+    static size_t vars(const Options&) { return 2; }
+
+    static uint64_t role(unsigned thread, Arena& arena, size_t slot, const Options&) {
+        uint64_t& data = arena.at<uint64_t>(slot, 0);
+        std::atomic<uint64_t>& flag = arena.at<std::atomic<uint64_t>>(slot, 1);
+        if (!thread) {
+            as_atomic(data).store(1, std::memory_order_relaxed);
+            flag.store(1, Path::store_order);
+            return 0;
+        }
+        return Path::read_after(flag, data) != 1;
+    }
+};
+
+template<typename Path>
+struct WriteToReadCausality {
+    static constexpr const char* name = "wrc";
+    static constexpr unsigned threads = 3;
+    static size_t vars(const Options&) { return 2; }
+
+    static uint64_t role(unsigned thread, Arena& arena, size_t slot, const Options&) {
+        uint64_t& x = arena.at<uint64_t>(slot, 0);
+        std::atomic<uint64_t>& y = arena.at<std::atomic<uint64_t>>(slot, 1);
+        switch (thread) {
+        case 0:
+            as_atomic(x).store(1, std::memory_order_relaxed);
+            return 0;
+        case 1:
+            y.store(Path::wait(as_atomic(x)), Path::store_order);
+            return 0;
+        default:
+            return Path::read_after(y, x) != 1;
+        }
+    }
+};
+
+template<typename Path>
+struct ChainPublication {
+    static constexpr const char* name = "chain";
+    static constexpr unsigned threads = 2;
+    static size_t vars(const Options& options) { return 1 + options.chain; }
+
+    static uint64_t role(unsigned thread, Arena& arena, size_t slot, const Options& options) {
+        std::atomic<Node*>& head = arena.at<std::atomic<Node*>>(slot, 0);
+        uint64_t value = slot + 1;
+        if (!thread) {
+            Node* next = nullptr;
+            for (size_t i = options.chain; i; --i) {
+                Node& node = arena.at<Node>(slot, i);
+                node.next = next;
+                node.value = value;
+                next = &node;
+            }
+            head.store(next, Path::store_order);
+            return 0;
+        }
+        return Path::walk(head, value);
+    }
+};
+
+struct Result {
+    uint64_t iterations { 0 };
+    uint64_t forbidden { 0 };
+    double seconds { 0 };
+};
+
+template<typename Test>
+Result run(const Options& options, const std::vector<unsigned>& cpus) {
+    struct alignas(CACHE_LINE_SIZE) Group {
+        Group(const Options& options) : arena(options.batch, Test::vars(options)), barrier(Test::threads) {}
+        Arena arena;
+        SpinBarrier barrier;
+        std::atomic<uint64_t> forbidden { 0 };
+    };
+
+    size_t batches = std::max<size_t>(options.iterations / options.batch, 1);
+    std::vector<std::unique_ptr<Group>> groups;
+    for (size_t g = 0; g != options.groups; ++g)
+        groups.emplace_back(new Group(options));
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> stressors;
+    for (size_t s = 0; s != options.stress; ++s) {
+        stressors.emplace_back([&, s] () {
+                bench::pin_to_cpu(cpus[(options.groups * Test::threads + s) % cpus.size()]);
+                std::vector<uint64_t> buffer((64 << 20) / sizeof(uint64_t));
+                uint64_t rng = 0x9e3779b97f4a7c15ull * (s + 1);
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (unsigned i = 0; i != 4096; ++i)
+                        ++buffer[bench::xorshift(rng) % buffer.size()];
+                }
+                bench::do_not_optimize(buffer[0]);
+            });
+    }
+
+    std::vector<std::thread> threads;
+    uint64_t start = bench::now_ns();
+    for (size_t g = 0; g != options.groups; ++g) {
+        for (unsigned t = 0; t != Test::threads; ++t) {
+            threads.emplace_back([&, g, t] () {
+                    bench::pin_to_cpu(cpus[(g * Test::threads + t) % cpus.size()]);
+                    Group& group = *groups[g];
+                    std::mt19937_64 rng(options.seed + g);
+                    uint64_t forbidden = 0;
+                    for (size_t b = 0; b != batches; ++b) {
+                        // Thread 0 prepares the batch, and the barrier orders
+                        // that before everyone's accesses.
+                        if (!t)
+                            group.arena.scatter(rng);
+                        group.barrier.wait();
+                        for (size_t slot = 0; slot != options.batch; ++slot)
+                            forbidden += Test::role(t, group.arena, slot, options);
+                        group.barrier.wait();
+                    }
+                    group.forbidden.fetch_add(forbidden);
+                });
+        }
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    Result result;
+    result.seconds = (bench::now_ns() - start) / 1e9;
+    stop.store(true);
+    for (std::thread& stressor : stressors)
+        stressor.join();
+
+    result.iterations = batches * options.batch * options.groups;
+    for (const std::unique_ptr<Group>& group : groups)
+        result.forbidden += group->forbidden.load();
+    return result;
+}
+
+template<template<typename> class Test, typename Path>
+bool report(const Options& options, const std::vector<unsigned>& cpus) {
+    Result result = run<Test<Path>>(options, cpus);
+    bool failed = Path::ordered && result.forbidden;
+    std::cout << std::left << std::setw(8) << Test<Path>::name << std::setw(14) << Path::name << std::right
+              << std::setw(8) << options.groups << std::setw(14) << result.iterations
+              << std::setw(12) << result.forbidden
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << result.iterations / result.seconds / 1e6
+              << (failed ? "  FAILED" : Path::ordered ? "" : "  (control)") << '\n';
+    return !failed;
+}
+
+template<template<typename> class Test>
+bool run_test(const Options& options, const std::vector<unsigned>& cpus) {
+    bool ok = report<Test, ConsumePath>(options, cpus);
+    ok &= report<Test, OrderedPath<std::memory_order_acquire>>(options, cpus);
+    ok &= report<Test, OrderedPath<std::memory_order_relaxed>>(options, cpus);
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--tests")) {
+            options.tests.clear();
+            std::string list(argv[i + 1]);
+            for (char* item = std::strtok(&list[0], ","); item; item = std::strtok(nullptr, ","))
+                options.tests.push_back(item);
+        } else if (!std::strcmp(argv[i], "--iterations"))
+            options.iterations = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--groups"))
+            options.groups = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--batch"))
+            options.batch = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--chain"))
+            options.chain = std::max<size_t>(bench::parse_size(argv[i + 1]), 1);
+        else if (!std::strcmp(argv[i], "--stress"))
+            options.stress = bench::parse_size(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--seed"))
+            options.seed = bench::parse_size(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    // One group per pair of CPUs by default, placed on CPUs in a random order.
+    std::vector<unsigned> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+    for (unsigned c = 0; c != cpus.size(); ++c)
+        cpus[c] = c;
+    std::mt19937_64 rng(options.seed);
+    std::shuffle(cpus.begin(), cpus.end(), rng);
+    if (!options.groups)
+        options.groups = std::max<size_t>(cpus.size() / 2, 1);
+
+    std::cout << std::left << std::setw(8) << "# test" << std::setw(14) << "path" << std::right
+              << std::setw(8) << "groups" << std::setw(14) << "iterations" << std::setw(12) << "forbidden"
+              << std::setw(14) << "Miter/s" << '\n';
+    bool ok = true;
+    for (const std::string& test : options.tests) {
+        if (test == "mp")
+            ok &= run_test<MessagePassing>(options, cpus);
+        else if (test == "wrc")
+            ok &= run_test<WriteToReadCausality>(options, cpus);
+        else if (test == "chain")
+            ok &= run_test<ChainPublication>(options, cpus);
+        else {
+            std::cerr << "Unknown test " << test << '\n';
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
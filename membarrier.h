@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef membarrier_h
+#define membarrier_h
+
+#include <atomic>
+#include "helpers.h"
+
+#if OS(LINUX)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Asymmetric fences for read-mostly reclamation schemes. Readers execute a
+// light fence, which is only a compiler fence when the process is registered
+// for private expedited membarrier. Reclaimers execute a heavy fence, which
+// forces a full barrier on every running thread of the process. Together they
+// order like a pair of full fences.
+//
+// Schemes hold the result of __register_membarrier() so that both sides agree
+// on whether the light fence may be weakened.
+
+namespace {
+
+#if OS(LINUX) && defined(__NR_membarrier)
+inline bool __membarrier(int cmd) { return !syscall(__NR_membarrier, cmd, 0, 0); }
+#endif
+
+// Registers the process for private expedited membarrier, if the kernel (and
+// any seccomp policy) allows it.
+inline bool __register_membarrier() {
+#if OS(LINUX) && defined(__NR_membarrier)
+    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED))
+        return false;
+    return __membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED);
+#else
+    return false;
+#endif
+}
+
+inline void __light_fence(bool has_membarrier) {
+    if (has_membarrier)
+        COMPILER_FENCE();
+    else
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline void __heavy_fence(bool has_membarrier) {
+#if OS(LINUX) && defined(__NR_membarrier)
+    if (has_membarrier && __membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED))
+        return;
+#else
+    (void)has_membarrier;
+#endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+} // anonymous namespace
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef node_arena_h
+#define node_arena_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "helpers.h"
+
+// An allocator for nodes which readers reach through consume_load.
+//
+// Every block starts on a cache line, and sizes are rounded up to a size class
+// of whole lines, so a published node never shares a line with an unrelated
+// allocation whose writer would invalidate it under readers. Each thread
+// allocates from its own free lists and from a slab of fresh memory, so
+// writers don't serialize on the allocator, and freshly carved blocks are
+// already zero: allocate_zeroed only clears recycled ones.
+//
+// Freed blocks go to the freeing thread's list, which is typically a
+// reclaimer's rather than the allocating writer's. Once a list holds two
+// batches' worth, one batch goes back to a shared depot, where any thread that
+// runs dry picks it up whole. A thread's blocks return to the depot when it
+// exits, or on flush().
+//
+// Blocks larger than max_size fall back to aligned operator new. Slabs are
+// never returned to the system, and the arena itself is never destroyed, so
+// that nodes freed by other static destructors still have somewhere to go.
+class node_arena {
+public:
+    static constexpr size_t line_size = CACHE_LINE_SIZE;
+    static constexpr size_t max_size = 1024;
+
+    static node_arena& global();
+
+    void* allocate(size_t);
+    void* allocate_zeroed(size_t);
+    void deallocate(void*, size_t);
+
+    // Hands the calling thread's free blocks back to the depot.
+    void flush();
+
+private:
+    static constexpr size_t class_count = 8;
+    static constexpr size_t slab_size = 256 << 10;
+
+    struct block {
+        block* next;
+    };
+
+    struct batch {
+        block* head;
+        size_t count;
+    };
+
+    struct local_class {
+        block* free { nullptr };
+        size_t free_count { 0 };
+        // The unused part of the current slab, which is still zero.
+        char* fresh { nullptr };
+        char* fresh_end { nullptr };
+    };
+
+    struct local {
+        local_class classes[class_count];
+        ~local();
+    };
+
+    node_arena() = default;
+    node_arena(const node_arena&) = delete;
+    node_arena& operator=(const node_arena&) = delete;
+
+    static size_t class_of(size_t);
+    static size_t class_size(size_t);
+    static size_t batch_size(size_t);
+    static local& self();
+
+    void refill(local_class&, size_t);
+    void release(local_class&, size_t, size_t count);
+
+    static node_arena* const global_arena;
+
+    std::mutex lock;
+    std::vector<batch> depot[class_count];
+    std::vector<void*> slabs;
+};
+
+// Typed helpers.
+template<typename T, typename... Args> T* arena_new(Args&&...);
+template<typename T> void arena_delete(T*);
+
+#include "node_arena_impl.h"
+
+#endif
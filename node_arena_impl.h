@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef node_arena_impl_h
+#define node_arena_impl_h
+
+#include <cstdlib>
+#include <cstring>
+
+// Leaked on purpose, see node_arena.h. The pointer keeps the arena and its
+// slabs reachable for leak checkers.
+inline node_arena* const node_arena::global_arena = new node_arena;
+
+inline node_arena& node_arena::global() { return *global_arena; }
+
+// 1, 2, 3, 4, 6, 8, 12 and 16 lines: at most a third of a block is padding
+// beyond the first class.
+inline size_t node_arena::class_size(size_t cls)
+{
+    static constexpr size_t lines[class_count] = { 1, 2, 3, 4, 6, 8, 12, 16 };
+    return lines[cls] * line_size;
+}
+
+inline size_t node_arena::class_of(size_t size)
+{
+    size_t cls = 0;
+    while (class_size(cls) < size)
+        ++cls;
+    return cls;
+}
+
+// Roughly 16KB per batch, and never fewer than 8 blocks.
+inline size_t node_arena::batch_size(size_t cls) { return std::max<size_t>(8, (16 << 10) / class_size(cls)); }
+
+inline node_arena::local& node_arena::self()
+{
+    static thread_local local l;
+    return l;
+}
+
+inline void* node_arena::allocate(size_t size)
+{
+    if (UNLIKELY(size > max_size))
+        return ::operator new(size, std::align_val_t(line_size));
+    size_t cls = class_of(size);
+    local_class& c = self().classes[cls];
+    for (;;) {
+        if (block* b = c.free) {
+            c.free = b->next;
+            --c.free_count;
+            return b;
+        }
+        if (c.fresh != c.fresh_end) {
+            void* p = c.fresh;
+            c.fresh += class_size(cls);
+            return p;
+        }
+        refill(c, cls);
+    }
+}
+
+// Fresh slab memory is preferred, since it needs no clearing.
+inline void* node_arena::allocate_zeroed(size_t size)
+{
+    if (size <= max_size) {
+        size_t cls = class_of(size);
+        local_class& c = self().classes[cls];
+        if (c.fresh != c.fresh_end) {
+            void* p = c.fresh;
+            c.fresh += class_size(cls);
+            return p;
+        }
+    }
+    void* p = allocate(size);
+    std::memset(p, 0, size);
+    return p;
+}
+
+inline void node_arena::deallocate(void* p, size_t size)
+{
+    if (UNLIKELY(size > max_size)) {
+        ::operator delete(p, std::align_val_t(line_size));
+        return;
+    }
+    size_t cls = class_of(size);
+    local_class& c = self().classes[cls];
+    block* b = static_cast<block*>(p);
+    b->next = c.free;
+    c.free = b;
+    // Keeping one batch back avoids bouncing a batch to the depot and straight
+    // back when a thread alternates between freeing and allocating.
+    if (++c.free_count >= 2 * batch_size(cls))
+        release(c, cls, batch_size(cls));
+}
+
+inline void node_arena::release(local_class& c, size_t cls, size_t count)
+{
+    block* head = c.free;
+    block* tail = head;
+    for (size_t i = 1; i < count; ++i)
+        tail = tail->next;
+    c.free = tail->next;
+    c.free_count -= count;
+    tail->next = nullptr;
+    std::lock_guard<std::mutex> locker(lock);
+    depot[cls].push_back(batch { head, count });
+}
+
+// The slab's unused tail, if any, is smaller than a block and is abandoned.
+// calloc gets large slabs straight from mmap, whose pages are already zero.
+inline void node_arena::refill(local_class& c, size_t cls)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    if (!depot[cls].empty()) {
+        batch b = depot[cls].back();
+        depot[cls].pop_back();
+        c.free = b.head;
+        c.free_count = b.count;
+        return;
+    }
+    void* slab = std::calloc(1, slab_size + line_size);
+    if (!slab)
+        throw std::bad_alloc();
+    slabs.push_back(slab);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(slab) + line_size - 1) & ~uintptr_t(line_size - 1);
+    c.fresh = reinterpret_cast<char*>(start);
+    c.fresh_end = c.fresh + slab_size / class_size(cls) * class_size(cls);
+}
+
+inline void node_arena::flush()
+{
+    local& l = self();
+    for (size_t cls = 0; cls != class_count; ++cls) {
+        local_class& c = l.classes[cls];
+        if (c.free_count)
+            release(c, cls, c.free_count);
+    }
+}
+
+// The unused part of each slab is handed over as ordinary free blocks.
+inline node_arena::local::~local()
+{
+    node_arena& arena = global();
+    for (size_t cls = 0; cls != class_count; ++cls) {
+        local_class& c = classes[cls];
+        for (; c.fresh != c.fresh_end; c.fresh += class_size(cls)) {
+            block* b = reinterpret_cast<block*>(c.fresh);
+            b->next = c.free;
+            c.free = b;
+            ++c.free_count;
+        }
+        if (c.free_count)
+            arena.release(c, cls, c.free_count);
+    }
+}
+
+template<typename T, typename... Args>
+inline T* arena_new(Args&&... args)
+{
+    static_assert(alignof(T) <= node_arena::line_size, "Blocks are only line-aligned");
+    return new (node_arena::global().allocate(sizeof(T))) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+inline void arena_delete(T* ptr)
+{
+    if (!ptr)
+        return;
+    ptr->~T();
+    node_arena::global().deallocate(const_cast<void*>(static_cast<const void*>(ptr)), sizeof(T));
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef publish_batch_h
+#define publish_batch_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "consume.h"
+
+// Writer-side counterpart of consume_load for publishing many values at once,
+// such as a set of hash buckets or the slots of a ring.
+//
+// The writer initializes every new node, stages the stores which publish them,
+// then commits: a single release fence followed by relaxed stores. Each store
+// is thereby ordered after every initialization which preceded the commit,
+// exactly as if each had been a release store, and readers consume the
+// published values with the existing consume_load overloads. Where a release
+// store is a barrier plus a store (lwsync on POWER, dmb on 32-bit ARM), the
+// batch pays for one barrier instead of one per value; on x86 both forms are
+// plain stores.
+//
+// Stores are committed in staging order, but readers may observe them in any
+// order: the batch orders initializations before publications, not
+// publications among themselves. A batch belongs to one writer thread, and
+// commits whatever is still staged when destroyed.
+class publish_batch {
+public:
+    publish_batch() = default;
+    explicit publish_batch(size_t capacity);
+    publish_batch(const publish_batch&) = delete;
+    publish_batch& operator=(const publish_batch&) = delete;
+    ~publish_batch();
+
+    // T must be trivially copyable and 1, 2, 4 or 8 bytes wide, which covers
+    // pointers and sequence numbers.
+    template<typename T> void stage(std::atomic<T>&, T);
+
+    // Publishes every staged store behind one release fence, and empties the
+    // batch.
+    void commit();
+
+    size_t size() const;
+    bool empty() const;
+
+private:
+    struct entry {
+        void* target;
+        uint64_t bits;
+        void (*store)(void* target, uint64_t bits);
+    };
+
+    std::vector<entry> staged;
+};
+
+#include "publish_batch_impl.h"
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef publish_batch_impl_h
+#define publish_batch_impl_h
+
+#include <cstring>
+
+namespace {
+
+// Stores through the staged std::atomic<T> itself, whatever T is.
+template<typename T>
+inline void __publish_relaxed(void* target, uint64_t bits)
+{
+    // Copying the bytes back, rather than truncating, is endian-neutral.
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    static_cast<std::atomic<T>*>(target)->store(value, std::memory_order_relaxed);
+}
+
+} // anonymous namespace
+
+inline publish_batch::publish_batch(size_t capacity) { staged.reserve(capacity); }
+
+inline publish_batch::~publish_batch() { commit(); }
+
+// The value is kept as its bytes, next to the function which stores it back
+// through atom.
+template<typename T>
+inline void publish_batch::stage(std::atomic<T>& atom, T value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Staged values are stored by their bytes");
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "Staged values must fit in a word");
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    staged.push_back(entry { &atom, bits, &__publish_relaxed<T> });
+}
+
+inline void publish_batch::commit()
+{
+    if (staged.empty())
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+    for (const entry& e : staged)
+        e.store(e.target, e.bits);
+    staged.clear();
+}
+
+inline size_t publish_batch::size() const { return staged.size(); }
+
+inline bool publish_batch::empty() const { return staged.empty(); }
+
+#endif
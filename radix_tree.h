@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef radix_tree_h
+#define radix_tree_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "consume.h"
+#include "rcu.h"
+
+// An adaptive radix tree for longest-prefix matching, such as routing tables
+// which are read on every request and updated by a control-plane writer.
+//
+// Keys are byte strings, and each inner node branches on one byte through one
+// of four layouts, picked by fan-out: 4 or 16 unsorted keys, a 256-entry index
+// into 48 children, or 256 direct children. Lookups consume the root and then
+// hop from node to node with consume_load(T**, dependency); the 16-key layout
+// is searched with an SSE2 or NEON compare whose load address comes from the
+// dependent node pointer, so the child index, and therefore the next hop,
+// stays in the chain.
+//
+// Published nodes are immutable. Writers, serialized by a mutex, copy the path
+// from the root to every node they change, link the copies together, publish
+// the new root with one release store, and reclaim the replaced nodes through
+// RCU. Readers see either the old tree or the new one.
+//
+// Prefixes whose length isn't a multiple of 8 bits are stored by controlled
+// prefix expansion into every byte-aligned prefix they cover, and the most
+// specific original prefix wins in each.
+//
+// Readers must be inside an RCU read section of the tree's flavor while they
+// use results from longest_prefix_match(); lookup() enters one itself.
+template<typename Value, typename Flavor = rcu_epoch>
+class consume_radix_tree {
+public:
+    consume_radix_tree();
+    ~consume_radix_tree();
+    consume_radix_tree(const consume_radix_tree&) = delete;
+    consume_radix_tree& operator=(const consume_radix_tree&) = delete;
+
+    // Readers.
+
+    // The value of the longest stored prefix of key's first `bytes` bytes, or
+    // null. The pointer carries the lookup's dependency chain, and stays valid
+    // until the enclosing read section ends.
+    dependent_ptr<const Value> longest_prefix_match(const uint8_t* key, size_t bytes, unsigned* prefix_bits = nullptr) const;
+
+    // Copies the longest match into out, within its own read section.
+    bool lookup(const uint8_t* key, size_t bytes, Value& out, unsigned* prefix_bits = nullptr) const;
+
+    // Writers.
+
+    // Inserts or replaces the prefix made of key's first `bits` bits.
+    void insert(const uint8_t* key, unsigned bits, const Value&);
+    bool erase(const uint8_t* key, unsigned bits);
+
+    // Number of prefixes, before expansion.
+    size_t size() const;
+
+private:
+    enum node_type : uint8_t { node4_type, node16_type, node48_type, node256_type };
+
+    struct node {
+        node_type type;
+        bool has_value { false };
+        uint16_t count { 0 };
+        // Length of the original prefix the value came from, which can be
+        // shorter than this node's depth after expansion.
+        uint16_t prefix_bits { 0 };
+        uint64_t version { 0 };
+        Value value { };
+    };
+
+    struct node4 : node {
+        uint8_t keys[4];
+        node* children[4];
+    };
+
+    struct node16 : node {
+        alignas(16) uint8_t keys[16];
+        node* children[16];
+    };
+
+    struct node48 : node {
+        // Zero when absent, otherwise the child's slot plus one.
+        uint8_t index[256];
+        node* children[48];
+    };
+
+    struct node256 : node {
+        node* children[256];
+    };
+
+    typedef std::pair<std::vector<uint8_t>, unsigned> route;
+
+    static dependent_ptr<node> child(dependent_ptr<node>, uint8_t);
+    static node* child(node*, uint8_t);
+    static node* create(node_type);
+    static node* clone(const node*);
+    static void destroy(node*);
+    static void destroy_tree(node*);
+    static node* grow(node*);
+    static node* set_child(node*, uint8_t, node*);
+    static std::vector<uint8_t> masked(const uint8_t* key, unsigned bits);
+
+    node* writable(node*);
+    node* update(node*, const uint8_t* key, size_t depth, size_t target, const std::function<void(node*)>&);
+    void update_slots(node*& top, std::vector<uint8_t> prefix, unsigned bits, const std::function<void(node*, const uint8_t* slot)>&);
+    void publish(node*);
+
+    std::atomic<node*> root;
+    mutable std::mutex writer_lock;
+    // Writer-side copy of the original prefixes, to re-expand shorter ones
+    // when a more specific prefix is erased.
+    std::map<route, Value> routes;
+    uint64_t version { 0 };
+    std::vector<node*> retired;
+};
+
+#include "radix_tree_impl.h"
+
+#endif
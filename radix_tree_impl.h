@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef radix_tree_impl_h
+#define radix_tree_impl_h
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Index of byte among the first count keys, or -1. All 16 keys are loaded, so
+// the caller's array must be 16 bytes long; only the first count can match.
+inline int __find_byte16(const uint8_t* keys, unsigned count, uint8_t byte)
+{
+#if defined(__SSE2__)
+    __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matches)) & ((1u << count) - 1);
+    return mask ? static_cast<int>(count_trailing_zeros(mask)) : -1;
+#elif defined(__ARM_NEON)
+    // NEON has no movemask: narrowing each 16-bit lane by 4 leaves a nibble
+    // per key.
+    uint8x16_t matches = vceqq_u8(vdupq_n_u8(byte), vld1q_u8(keys));
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+    if (count < 16)
+        mask &= (1ull << (4 * count)) - 1;
+    return mask ? static_cast<int>(count_trailing_zeros(mask) / 4) : -1;
+#else
+    for (unsigned i = 0; i != count; ++i) {
+        if (keys[i] == byte)
+            return i;
+    }
+    return -1;
+#endif
+}
+
+} // anonymous namespace
+
+template<typename Value, typename Flavor>
+inline consume_radix_tree<Value, Flavor>::consume_radix_tree()
+    : root(create(node4_type))
+{
+}
+
+template<typename Value, typename Flavor>
+inline consume_radix_tree<Value, Flavor>::~consume_radix_tree()
+{
+    destroy_tree(root.load(std::memory_order_relaxed));
+}
+
+// Published nodes are never written again, so every field is read through the
+// node's dependent pointer and only the child links need consume_load. The key
+// and index arrays are addressed from __pointer(n), which keeps the chosen slot,
+// and so the next hop's address, dependent on n.
+template<typename Value, typename Flavor>
+inline dependent_ptr<typename consume_radix_tree<Value, Flavor>::node> consume_radix_tree<Value, Flavor>::child(dependent_ptr<node> n, uint8_t byte)
+{
+    switch (__pointer(n)->type) {
+    case node4_type: {
+        node4* n4 = static_cast<node4*>(__pointer(n));
+        for (unsigned i = 0; i != n4->count; ++i) {
+            if (n4->keys[i] == byte)
+                return consume_load(&n4->children[i], n.dependency());
+        }
+        return nullptr;
+    }
+    case node16_type: {
+        node16* n16 = static_cast<node16*>(__pointer(n));
+        int i = __find_byte16(n16->keys, n16->count, byte);
+        if (i < 0)
+            return nullptr;
+        return consume_load(&n16->children[i], n.dependency());
+    }
+    case node48_type: {
+        node48* n48 = static_cast<node48*>(__pointer(n));
+        unsigned slot = n48->index[byte];
+        if (!slot)
+            return nullptr;
+        return consume_load(&n48->children[slot - 1], n.dependency());
+    }
+    case node256_type:
+        return consume_load(&static_cast<node256*>(__pointer(n))->children[byte], n.dependency());
+    }
+    return nullptr;
+}
+
+// Writers only.
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::child(node* n, uint8_t byte)
+{
+    switch (n->type) {
+    case node4_type: {
+        node4* n4 = static_cast<node4*>(n);
+        for (unsigned i = 0; i != n4->count; ++i) {
+            if (n4->keys[i] == byte)
+                return n4->children[i];
+        }
+        return nullptr;
+    }
+    case node16_type: {
+        node16* n16 = static_cast<node16*>(n);
+        int i = __find_byte16(n16->keys, n16->count, byte);
+        return i < 0 ? nullptr : n16->children[i];
+    }
+    case node48_type: {
+        node48* n48 = static_cast<node48*>(n);
+        unsigned slot = n48->index[byte];
+        return slot ? n48->children[slot - 1] : nullptr;
+    }
+    case node256_type:
+        return static_cast<node256*>(n)->children[byte];
+    }
+    return nullptr;
+}
+
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::create(node_type type)
+{
+    node* n = nullptr;
+    switch (type) {
+    case node4_type: n = new node4(); break;
+    case node16_type: n = new node16(); break;
+    case node48_type: n = new node48(); break;
+    case node256_type: n = new node256(); break;
+    }
+    n->type = type;
+    return n;
+}
+
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::clone(const node* n)
+{
+    switch (n->type) {
+    case node4_type: return new node4(*static_cast<const node4*>(n));
+    case node16_type: return new node16(*static_cast<const node16*>(n));
+    case node48_type: return new node48(*static_cast<const node48*>(n));
+    case node256_type: return new node256(*static_cast<const node256*>(n));
+    }
+    return nullptr;
+}
+
+template<typename Value, typename Flavor>
+inline void consume_radix_tree<Value, Flavor>::destroy(node* n)
+{
+    switch (n->type) {
+    case node4_type: delete static_cast<node4*>(n); break;
+    case node16_type: delete static_cast<node16*>(n); break;
+    case node48_type: delete static_cast<node48*>(n); break;
+    case node256_type: delete static_cast<node256*>(n); break;
+    }
+}
+
+template<typename Value, typename Flavor>
+inline void consume_radix_tree<Value, Flavor>::destroy_tree(node* n)
+{
+    for (unsigned byte = 0; byte != 256; ++byte) {
+        if (node* c = child(n, byte))
+            destroy_tree(c);
+    }
+    destroy(n);
+}
+
+template<typename Value, typename Flavor>
+inline std::vector<uint8_t> consume_radix_tree<Value, Flavor>::masked(const uint8_t* key, unsigned bits)
+{
+    std::vector<uint8_t> prefix(key, key + (bits + 7) / 8);
+    if (bits % 8)
+        prefix.back() &= static_cast<uint8_t>(0xff << (8 - bits % 8));
+    return prefix;
+}
+
+template<typename Value, typename Flavor>
+inline dependent_ptr<const Value> consume_radix_tree<Value, Flavor>::longest_prefix_match(const uint8_t* key, size_t bytes, unsigned* prefixBits) const
+{
+    dependent_ptr<node> n = consume_load(root);
+    dependent_ptr<node> best(nullptr);
+    for (size_t depth = 0; __pointer(n); ) {
+        if (__pointer(n)->has_value)
+            best = n;
+        if (depth == bytes)
+            break;
+        n = child(n, key[depth++]);
+    }
+    if (!__pointer(best))
+        return nullptr;
+    if (prefixBits)
+        *prefixBits = __pointer(best)->prefix_bits;
+    return dependent_ptr<const Value>(&__pointer(best)->value, best.dependency());
+}
+
+template<typename Value, typename Flavor>
+inline bool consume_radix_tree<Value, Flavor>::lookup(const uint8_t* key, size_t bytes, Value& out, unsigned* prefixBits) const
+{
+    rcu_read_guard<Flavor> guard;
+    dependent_ptr<const Value> value = longest_prefix_match(key, bytes, prefixBits);
+    if (!__pointer(value))
+        return false;
+    out = *__pointer(value);
+    return true;
+}
+
+// A node this transaction may write: either one it created, or a copy of a
+// published node, which is retired once the new root is published.
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::writable(node* n)
+{
+    node* m;
+    if (!n)
+        m = create(node4_type);
+    else if (n->version == version)
+        return n;
+    else {
+        m = clone(n);
+        retired.push_back(n);
+    }
+    m->version = version;
+    return m;
+}
+
+// Moves n's children into the next larger layout. n was created by this
+// transaction, so it can be freed right away.
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::grow(node* n)
+{
+    node* g = create(static_cast<node_type>(n->type + 1));
+    node_type type = g->type;
+    static_cast<node&>(*g) = static_cast<const node&>(*n);
+    g->type = type;
+    switch (n->type) {
+    case node4_type: {
+        node4* from = static_cast<node4*>(n);
+        node16* to = static_cast<node16*>(g);
+        std::copy(from->keys, from->keys + from->count, to->keys);
+        std::copy(from->children, from->children + from->count, to->children);
+        break;
+    }
+    case node16_type: {
+        node16* from = static_cast<node16*>(n);
+        node48* to = static_cast<node48*>(g);
+        for (unsigned i = 0; i != from->count; ++i) {
+            to->index[from->keys[i]] = i + 1;
+            to->children[i] = from->children[i];
+        }
+        break;
+    }
+    case node48_type: {
+        node48* from = static_cast<node48*>(n);
+        node256* to = static_cast<node256*>(g);
+        for (unsigned byte = 0; byte != 256; ++byte) {
+            if (from->index[byte])
+                to->children[byte] = from->children[from->index[byte] - 1];
+        }
+        break;
+    }
+    case node256_type:
+        break;
+    }
+    destroy(n);
+    return g;
+}
+
+// Links, replaces or (when c is null) unlinks the child for byte in a writable
+// node, and returns the node, which growing may have replaced. Nodes don't
+// shrink back to smaller layouts.
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::set_child(node* n, uint8_t byte, node* c)
+{
+    switch (n->type) {
+    case node4_type:
+    case node16_type:
+        break;
+    case node48_type: {
+        node48* n48 = static_cast<node48*>(n);
+        unsigned slot = n48->index[byte];
+        if (slot && c)
+            n48->children[slot - 1] = c;
+        else if (slot) {
+            // Fill the hole with the last child.
+            unsigned last = --n48->count;
+            n48->index[byte] = 0;
+            if (slot - 1 != last) {
+                for (unsigned other = 0; other != 256; ++other) {
+                    if (n48->index[other] == last + 1) {
+                        n48->index[other] = slot;
+                        break;
+                    }
+                }
+                n48->children[slot - 1] = n48->children[last];
+            }
+        } else if (c) {
+            if (n48->count == 48)
+                return set_child(grow(n), byte, c);
+            n48->children[n48->count] = c;
+            n48->index[byte] = ++n48->count;
+        }
+        return n;
+    }
+    case node256_type: {
+        node256* n256 = static_cast<node256*>(n);
+        if (!n256->children[byte] != !c)
+            n256->count += c ? 1 : -1;
+        n256->children[byte] = c;
+        return n;
+    }
+    }
+
+    bool small = n->type == node4_type;
+    uint8_t* keys = small ? static_cast<node4*>(n)->keys : static_cast<node16*>(n)->keys;
+    node** children = small ? static_cast<node4*>(n)->children : static_cast<node16*>(n)->children;
+    unsigned capacity = small ? 4 : 16;
+    for (unsigned i = 0; i != n->count; ++i) {
+        if (keys[i] != byte)
+            continue;
+        if (c)
+            children[i] = c;
+        else {
+            --n->count;
+            keys[i] = keys[n->count];
+            children[i] = children[n->count];
+        }
+        return n;
+    }
+    if (!c)
+        return n;
+    if (n->count == capacity)
+        return set_child(grow(n), byte, c);
+    keys[n->count] = byte;
+    children[n->count] = c;
+    ++n->count;
+    return n;
+}
+
+// Copies the path from n down to the node for key's first target bytes,
+// applies mutate to that node, and returns the new subtree root. Nodes left
+// with neither a value nor children are dropped, except for the root.
+template<typename Value, typename Flavor>
+inline typename consume_radix_tree<Value, Flavor>::node* consume_radix_tree<Value, Flavor>::update(node* n, const uint8_t* key, size_t depth, size_t target, const std::function<void(node*)>& mutate)
+{
+    node* m = writable(n);
+    if (depth == target)
+        mutate(m);
+    else {
+        node* c = child(m, key[depth]);
+        node* updated = update(c, key, depth + 1, target, mutate);
+        if (updated != c)
+            m = set_child(m, key[depth], updated);
+    }
+    if (depth && !m->has_value && !m->count) {
+        destroy(m);
+        return nullptr;
+    }
+    return m;
+}
+
+// Applies mutate to each byte-aligned expansion of the prefix.
+template<typename Value, typename Flavor>
+inline void consume_radix_tree<Value, Flavor>::update_slots(node*& top, std::vector<uint8_t> slot, unsigned bits, const std::function<void(node*, const uint8_t*)>& mutate)
+{
+    size_t bytes = slot.size();
+    unsigned spare = static_cast<unsigned>(bytes * 8 - bits);
+    for (unsigned low = 0; low != 1u << spare; ++low) {
+        if (spare)
+            slot.back() = static_cast<uint8_t>((slot.back() & (0xff << spare)) | low);
+        top = update(top, slot.data(), 0, bytes, [&] (node* n) { mutate(n, slot.data()); });
+    }
+}
+
+// One release store publishes every node the transaction created, and one
+// grace period covers every node it replaced.
+template<typename Value, typename Flavor>
+inline void consume_radix_tree<Value, Flavor>::publish(node* top)
+{
+    if (top != root.load(std::memory_order_relaxed))
+        rcu_assign_pointer(root, top);
+    if (retired.empty())
+        return;
+    struct deferred : rcu_head {
+        std::vector<node*> nodes;
+    };
+    deferred* d = new deferred;
+    d->nodes.swap(retired);
+    call_rcu<Flavor>(d, [] (rcu_head* head) {
+            deferred* d = static_cast<deferred*>(head);
+            for (node* n : d->nodes)
+                destroy(n);
+            delete d;
+        });
+}
+
+template<typename Value, typename Flavor>
+inline void consume_radix_tree<Value, Flavor>::insert(const uint8_t* key, unsigned bits, const Value& value)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    std::vector<uint8_t> prefix = masked(key, bits);
+    routes[route(prefix, bits)] = value;
+    ++version;
+    node* top = root.load(std::memory_order_relaxed);
+    update_slots(top, prefix, bits, [&] (node* n, const uint8_t*) {
+            // A more specific prefix already expanded here wins.
+            if (n->has_value && n->prefix_bits > bits)
+                return;
+            n->has_value = true;
+            n->prefix_bits = static_cast<uint16_t>(bits);
+            n->value = value;
+        });
+    publish(top);
+}
+
+template<typename Value, typename Flavor>
+inline bool consume_radix_tree<Value, Flavor>::erase(const uint8_t* key, unsigned bits)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    std::vector<uint8_t> prefix = masked(key, bits);
+    if (!routes.erase(route(prefix, bits)))
+        return false;
+    ++version;
+    node* top = root.load(std::memory_order_relaxed);
+    unsigned floor = prefix.empty() ? 0 : static_cast<unsigned>(prefix.size() - 1) * 8;
+    update_slots(top, prefix, bits, [&] (node* n, const uint8_t* slot) {
+            if (!n->has_value || n->prefix_bits != bits)
+                return;
+            n->has_value = false;
+            // Re-expand the most specific remaining prefix which ends within
+            // the same byte, if any.
+            for (unsigned shorter = bits; shorter-- > floor + 1; ) {
+                auto found = routes.find(route(masked(slot, shorter), shorter));
+                if (found != routes.end()) {
+                    n->has_value = true;
+                    n->prefix_bits = static_cast<uint16_t>(shorter);
+                    n->value = found->second;
+                    return;
+                }
+            }
+        });
+    publish(top);
+    return true;
+}
+
+template<typename Value, typename Flavor>
+inline size_t consume_radix_tree<Value, Flavor>::size() const
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    return routes.size();
+}
+
+#endif
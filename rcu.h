@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef rcu_h
+#define rcu_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "consume.h"
+
+// Userspace read-copy-update, for reclaiming nodes which readers reach through
+// consume_load.
+//
+// Readers bracket their traversals with rcu_read_lock and rcu_read_unlock, and
+// every dependent_ptr obtained through consume_load in between remains valid
+// until the matching unlock. Writers unpublish a node, then either wait for all
+// pre-existing readers with synchronize_rcu or hand the node to call_rcu, which
+// batches many nodes behind a single grace period.
+//
+// Neither flavor adds fences to the reader side when the kernel supports
+// membarrier: writers instead force a full barrier on every running thread of
+// the process, which is what makes reader-side dependency ordering sufficient.
+// Without membarrier, epoch readers fall back to a full fence per section.
+
+// Epoch flavor: rcu_read_lock and rcu_read_unlock publish whether the thread is
+// inside a read section. Threads register themselves on first use.
+struct rcu_epoch {
+    static constexpr bool quiescent_state_based = false;
+};
+
+// Quiescent-state-based flavor: rcu_read_lock and rcu_read_unlock compile to
+// nothing. Instead, each thread must call rcu_register_thread before its first
+// read section, then periodically call rcu_quiescent_state outside of read
+// sections, or go offline while blocked. Grace periods wait for every online
+// thread to report a quiescent state.
+struct rcu_qsbr {
+    static constexpr bool quiescent_state_based = true;
+};
+
+// Intrusive callback for call_rcu. Embed it in the node being reclaimed.
+struct rcu_head {
+    rcu_head* next;
+    void (*func)(rcu_head*);
+};
+
+template<typename Flavor>
+class rcu_domain {
+public:
+    // Each flavor has a single process-wide domain.
+    static rcu_domain& global();
+
+    // Registration. Epoch threads register lazily, and unregister when they
+    // exit. QSBR threads must register before reading, and start online.
+    void register_thread();
+    void unregister_thread();
+
+    // Read-side critical sections may nest. They must not block on a grace
+    // period: calling synchronize from inside one deadlocks.
+    void read_lock();
+    void read_unlock();
+
+    // QSBR only: the calling thread holds no references obtained in earlier
+    // read sections. Offline threads are ignored by grace periods.
+    void quiescent_state();
+    void thread_offline();
+    void thread_online();
+
+    // Waits until every read section which was in progress when called has
+    // completed.
+    void synchronize();
+
+    // Invokes func(head) after a grace period, from a reclaimer thread which
+    // batches all callbacks queued since its last grace period.
+    void call(rcu_head*, void (*func)(rcu_head*));
+
+    // Waits until every callback queued before this call has been invoked.
+    void barrier();
+
+    ~rcu_domain();
+
+private:
+    rcu_domain();
+    rcu_domain(const rcu_domain&) = delete;
+    rcu_domain& operator=(const rcu_domain&) = delete;
+
+    struct alignas(CACHE_LINE_SIZE) reader {
+        // Zero when the thread is outside of read sections (epoch) or offline
+        // (QSBR), otherwise the grace-period counter it last observed.
+        std::atomic<uint64_t> ctr { 0 };
+        unsigned nesting { 0 };
+        bool registered { false };
+        ~reader();
+    };
+
+    static reader& self();
+    void unregister(reader&);
+    void reader_fence();
+    void writer_fence();
+    void reclaimer();
+
+    static rcu_domain global_domain;
+
+    bool has_membarrier;
+    std::atomic<uint64_t> gp_ctr { 1 };
+    std::mutex gp_lock;
+    std::mutex registry_lock;
+    std::vector<reader*> registry;
+
+    std::mutex callbacks_lock;
+    std::condition_variable callbacks_cv;
+    std::condition_variable callbacks_done_cv;
+    rcu_head* callbacks { nullptr };
+    uint64_t callbacks_queued { 0 };
+    uint64_t callbacks_invoked { 0 };
+    bool stopping { false };
+    std::once_flag reclaimer_started;
+    std::thread reclaimer_thread;
+};
+
+// Free functions operating on each flavor's global domain. The flavor defaults
+// to rcu_epoch.
+template<typename Flavor = rcu_epoch> void rcu_register_thread();
+template<typename Flavor = rcu_epoch> void rcu_unregister_thread();
+template<typename Flavor = rcu_epoch> void rcu_read_lock();
+template<typename Flavor = rcu_epoch> void rcu_read_unlock();
+void rcu_quiescent_state();
+void rcu_thread_offline();
+void rcu_thread_online();
+template<typename Flavor = rcu_epoch> void synchronize_rcu();
+template<typename Flavor = rcu_epoch> void call_rcu(rcu_head*, void (*func)(rcu_head*));
+template<typename Flavor = rcu_epoch> void rcu_barrier();
+
+// Scoped read-side critical section.
+template<typename Flavor = rcu_epoch>
+class rcu_read_guard {
+public:
+    rcu_read_guard() { rcu_read_lock<Flavor>(); }
+    ~rcu_read_guard() { rcu_read_unlock<Flavor>(); }
+    rcu_read_guard(const rcu_read_guard&) = delete;
+    rcu_read_guard& operator=(const rcu_read_guard&) = delete;
+};
+
+// Publication counterpart of consume_load: initializing stores to the node
+// happen before readers can consume the pointer.
+template<typename T> void rcu_assign_pointer(std::atomic<T*>&, T*);
+
+// Deletes the node after a grace period. The node doesn't need an rcu_head.
+template<typename Flavor = rcu_epoch, typename T> void rcu_delete(T*);
+
+#include "rcu_impl.h"
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef rcu_impl_h
+#define rcu_impl_h
+
+#include <algorithm>
+#include "membarrier.h"
+
+// A namespace-scope object rather than a function-local static: the latter's
+// initialization guard would put an acquire load on the read side.
+template<typename Flavor> rcu_domain<Flavor> rcu_domain<Flavor>::global_domain;
+
+template<typename Flavor>
+inline rcu_domain<Flavor>& rcu_domain<Flavor>::global() { return global_domain; }
+
+template<typename Flavor>
+inline rcu_domain<Flavor>::rcu_domain() : has_membarrier(__register_membarrier()) {}
+
+template<typename Flavor>
+inline rcu_domain<Flavor>::~rcu_domain()
+{
+    {
+        std::lock_guard<std::mutex> locker(callbacks_lock);
+        stopping = true;
+    }
+    callbacks_cv.notify_one();
+    if (reclaimer_thread.joinable())
+        reclaimer_thread.join();
+}
+
+template<typename Flavor>
+inline rcu_domain<Flavor>::reader::~reader()
+{
+    if (registered)
+        global().unregister(*this);
+}
+
+template<typename Flavor>
+inline typename rcu_domain<Flavor>::reader& rcu_domain<Flavor>::self()
+{
+    static thread_local reader r;
+    return r;
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::reader_fence() { __light_fence(has_membarrier); }
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::writer_fence() { __heavy_fence(has_membarrier); }
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::register_thread()
+{
+    reader& r = self();
+    if (r.registered)
+        return;
+    {
+        std::lock_guard<std::mutex> locker(registry_lock);
+        registry.push_back(&r);
+        r.registered = true;
+    }
+    if (Flavor::quiescent_state_based) {
+        r.ctr.store(gp_ctr.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        reader_fence();
+    }
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::unregister_thread()
+{
+    reader& r = self();
+    if (r.registered)
+        unregister(r);
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::unregister(reader& r)
+{
+    if (Flavor::quiescent_state_based) {
+        reader_fence();
+        r.ctr.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> locker(registry_lock);
+    registry.erase(std::find(registry.begin(), registry.end(), &r));
+    r.registered = false;
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::read_lock()
+{
+    if (Flavor::quiescent_state_based) {
+        COMPILER_FENCE();
+        return;
+    }
+    reader& r = self();
+    if (UNLIKELY(!r.registered))
+        register_thread();
+    if (!r.nesting++) {
+        r.ctr.store(gp_ctr.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        reader_fence();
+    }
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::read_unlock()
+{
+    if (Flavor::quiescent_state_based) {
+        COMPILER_FENCE();
+        return;
+    }
+    reader& r = self();
+    if (!--r.nesting) {
+        reader_fence();
+        r.ctr.store(0, std::memory_order_relaxed);
+    }
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::quiescent_state()
+{
+    static_assert(Flavor::quiescent_state_based, "Only QSBR threads report quiescent states");
+    reader& r = self();
+    reader_fence();
+    r.ctr.store(gp_ctr.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    reader_fence();
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::thread_offline()
+{
+    static_assert(Flavor::quiescent_state_based, "Only QSBR threads go offline");
+    reader_fence();
+    self().ctr.store(0, std::memory_order_relaxed);
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::thread_online()
+{
+    static_assert(Flavor::quiescent_state_based, "Only QSBR threads go offline");
+    self().ctr.store(gp_ctr.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    reader_fence();
+}
+
+// The grace-period counter is 64 bits wide and never wraps, so a single pass
+// suffices: a reader which snapshotted an older counter value is waited on even
+// if it published that snapshot late, and one which hadn't published anything
+// yet will observe the unpublished pointer thanks to the first writer fence.
+template<typename Flavor>
+inline void rcu_domain<Flavor>::synchronize()
+{
+    reader* me = nullptr;
+    if (Flavor::quiescent_state_based) {
+        reader& r = self();
+        if (r.registered && r.ctr.load(std::memory_order_relaxed)) {
+            me = &r;
+            reader_fence();
+            r.ctr.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> gpLocker(gp_lock);
+        writer_fence();
+        uint64_t target = gp_ctr.fetch_add(1, std::memory_order_relaxed) + 1;
+        {
+            std::lock_guard<std::mutex> registryLocker(registry_lock);
+            for (reader* r : registry) {
+                for (unsigned spins = 0; ; ++spins) {
+                    uint64_t ctr = r->ctr.load(std::memory_order_relaxed);
+                    if (!ctr || ctr >= target)
+                        break;
+                    if (spins > 128)
+                        std::this_thread::yield();
+                }
+            }
+        }
+        writer_fence();
+    }
+
+    if (me) {
+        me->ctr.store(gp_ctr.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        reader_fence();
+    }
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::call(rcu_head* head, void (*func)(rcu_head*))
+{
+    std::call_once(reclaimer_started, [this] { reclaimer_thread = std::thread([this] { reclaimer(); }); });
+    head->func = func;
+    {
+        std::lock_guard<std::mutex> locker(callbacks_lock);
+        head->next = callbacks;
+        callbacks = head;
+        ++callbacks_queued;
+    }
+    callbacks_cv.notify_one();
+}
+
+// Callbacks which arrive while a grace period is in progress accumulate, and
+// are all covered by the next one.
+template<typename Flavor>
+inline void rcu_domain<Flavor>::reclaimer()
+{
+    std::unique_lock<std::mutex> locker(callbacks_lock);
+    for (;;) {
+        callbacks_cv.wait(locker, [this] { return callbacks || stopping; });
+        if (!callbacks)
+            return;
+        rcu_head* batch = callbacks;
+        callbacks = nullptr;
+        locker.unlock();
+
+        synchronize();
+        // Invoke in queueing order.
+        rcu_head* reversed = nullptr;
+        while (batch) {
+            rcu_head* next = batch->next;
+            batch->next = reversed;
+            reversed = batch;
+            batch = next;
+        }
+        uint64_t invoked = 0;
+        while (reversed) {
+            rcu_head* next = reversed->next;
+            reversed->func(reversed);
+            reversed = next;
+            ++invoked;
+        }
+
+        locker.lock();
+        callbacks_invoked += invoked;
+        callbacks_done_cv.notify_all();
+    }
+}
+
+template<typename Flavor>
+inline void rcu_domain<Flavor>::barrier()
+{
+    std::unique_lock<std::mutex> locker(callbacks_lock);
+    uint64_t target = callbacks_queued;
+    callbacks_done_cv.wait(locker, [&] { return callbacks_invoked >= target; });
+}
+
+template<typename Flavor> inline void rcu_register_thread() { rcu_domain<Flavor>::global().register_thread(); }
+template<typename Flavor> inline void rcu_unregister_thread() { rcu_domain<Flavor>::global().unregister_thread(); }
+template<typename Flavor> inline void rcu_read_lock() { rcu_domain<Flavor>::global().read_lock(); }
+template<typename Flavor> inline void rcu_read_unlock() { rcu_domain<Flavor>::global().read_unlock(); }
+inline void rcu_quiescent_state() { rcu_domain<rcu_qsbr>::global().quiescent_state(); }
+inline void rcu_thread_offline() { rcu_domain<rcu_qsbr>::global().thread_offline(); }
+inline void rcu_thread_online() { rcu_domain<rcu_qsbr>::global().thread_online(); }
+template<typename Flavor> inline void synchronize_rcu() { rcu_domain<Flavor>::global().synchronize(); }
+template<typename Flavor> inline void call_rcu(rcu_head* head, void (*func)(rcu_head*)) { rcu_domain<Flavor>::global().call(head, func); }
+template<typename Flavor> inline void rcu_barrier() { rcu_domain<Flavor>::global().barrier(); }
+
+template<typename T> inline void rcu_assign_pointer(std::atomic<T*>& atom, T* value) { atom.store(value, std::memory_order_release); }
+
+template<typename Flavor, typename T>
+inline void rcu_delete(T* ptr)
+{
+    struct deferred : rcu_head {
+        T* ptr;
+    };
+    deferred* d = new deferred;
+    d->ptr = ptr;
+    call_rcu<Flavor>(d, [] (rcu_head* head) {
+            deferred* d = static_cast<deferred*>(head);
+            delete d->ptr;
+            delete d;
+        });
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef seqlock_h
+#define seqlock_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include "consume.h"
+
+// A sequence lock for snapshots too large for dependent<T>, such as
+// configuration or statistics structs.
+//
+// The reader consumes the sequence and reads the payload through a pointer
+// built from the sequence's dependency, which orders the payload after the
+// first sequence load. It then folds every payload word into a dependency and
+// reloads the sequence through a pointer built from that, which orders the
+// second load after the payload. Neither step needs a fence, so a reader which
+// doesn't race with a writer costs two loads of the sequence plus the copy,
+// where an acquire-based seqlock also pays for a load-load barrier (a dmb on
+// ARM).
+//
+// The payload is stored as relaxed atomic words, so racing readers are well
+// defined and simply retry. Writers are serialized by a mutex.
+template<typename T>
+class seqlock {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock copies T word by word");
+
+    seqlock();
+    explicit seqlock(const T&);
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    // Retries until it reads a consistent snapshot.
+    T load() const;
+
+    // A single attempt, which fails if a writer was active.
+    bool try_load(T&) const;
+
+    void store(const T&);
+
+private:
+    static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> sequence { 0 };
+    std::atomic<uint64_t> payload[words];
+    std::mutex writer_lock;
+};
+
+#include "seqlock_impl.h"
+
+#endif
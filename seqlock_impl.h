@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef seqlock_impl_h
+#define seqlock_impl_h
+
+#include <cstring>
+#include <thread>
+
+template<typename T>
+inline seqlock<T>::seqlock()
+{
+    for (std::atomic<uint64_t>& word : payload)
+        word.store(0, std::memory_order_relaxed);
+}
+
+template<typename T>
+inline seqlock<T>::seqlock(const T& value)
+    : seqlock()
+{
+    store(value);
+}
+
+template<typename T>
+inline bool seqlock<T>::try_load(T& out) const
+{
+    dependent<uint64_t> before = consume_load(sequence);
+    if (UNLIKELY(__value(before) & 1))
+        return false;
+
+    dependent_ptr<const std::atomic<uint64_t>> source(payload, before.dependency());
+    uint64_t copy[words];
+    uint64_t folded = 0;
+    for (size_t i = 0; i != words; ++i) {
+        copy[i] = __pointer(source)[i].load(std::memory_order_relaxed);
+        folded ^= copy[i];
+    }
+
+    // The reload's address depends on every payload word. Policies without
+    // dependencies need the fence an acquire-based seqlock uses instead.
+    if (!consume_ordering::carries_dependencies)
+        std::atomic_thread_fence(std::memory_order_acquire);
+    dependent_ptr<const std::atomic<uint64_t>> reload(&sequence, dependency(folded));
+    if (UNLIKELY(__pointer(reload)->load(std::memory_order_relaxed) != __value(before)))
+        return false;
+    std::memcpy(&out, copy, sizeof(T));
+    return true;
+}
+
+template<typename T>
+inline T seqlock<T>::load() const
+{
+    T out;
+    for (unsigned spins = 0; !try_load(out); ++spins) {
+        if (spins > 128)
+            std::this_thread::yield();
+    }
+    return out;
+}
+
+template<typename T>
+inline void seqlock<T>::store(const T& value)
+{
+    uint64_t copy[words] = { };
+    std::memcpy(copy, &value, sizeof(T));
+    std::lock_guard<std::mutex> locker(writer_lock);
+    uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i != words; ++i)
+        payload[i].store(copy[i], std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef skip_list_h
+#define skip_list_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include "consume.h"
+#include "rcu.h"
+
+// An ordered read-mostly map, as a skip list whose searches take no locks and
+// execute no fences.
+//
+// Searches start from the head tower and descend level by level. Every hop,
+// across a level or down a tower, is a consume_load(dependent_ptr<T*>) of the
+// next link through the current node, so each node's key and value are
+// ordered after the store which published it. Writers are serialized by a
+// mutex. Inserts link a fully initialized node bottom-up with release stores,
+// so readers see it at a prefix of its levels; erases unlink it top-down and
+// reclaim it through RCU, and readers still standing on it continue along its
+// links.
+//
+// Readers must be inside an RCU read section of the list's flavor while they
+// use results from lookup() or while scanning; find() and scan() enter one
+// themselves.
+template<typename Key, typename Value, typename Compare = std::less<Key>, typename Flavor = rcu_epoch>
+class consume_skip_list {
+public:
+    static constexpr unsigned max_height = 24;
+
+    consume_skip_list();
+    ~consume_skip_list();
+    consume_skip_list(const consume_skip_list&) = delete;
+    consume_skip_list& operator=(const consume_skip_list&) = delete;
+
+    // Readers.
+
+    // The value for key, or null. The pointer carries the search's dependency
+    // chain, and stays valid until the enclosing read section ends.
+    dependent_ptr<const Value> lookup(const Key&) const;
+
+    // Copies the value for key into out, within its own read section.
+    bool find(const Key&, Value& out) const;
+
+    // Calls visit(key, value) in order for every entry in [low, high), within
+    // its own read section, and returns the number of entries visited.
+    template<typename Visitor> size_t scan(const Key& low, const Key& high, Visitor&&) const;
+
+    // Writers.
+
+    // Returns false, leaving the list unchanged, if key is already present.
+    bool insert(const Key&, const Value&);
+    bool erase(const Key&);
+
+    size_t size() const;
+
+private:
+    struct node {
+        Key key;
+        Value value;
+        unsigned height;
+        node* next[1];
+    };
+
+    static node* create_node(const Key&, const Value&, unsigned height);
+    static void destroy_node(node*);
+    static std::atomic<node*>& as_atomic(node*&);
+    dependent_ptr<node> lower_bound(const Key&) const;
+    void find_predecessors(const Key&, node** preds) const;
+    unsigned random_height();
+
+    node* head;
+    std::atomic<unsigned> height { 1 };
+    size_t count { 0 };
+    uint64_t rng { 0x9e3779b97f4a7c15ull };
+    mutable std::mutex writer_lock;
+    Compare less;
+};
+
+#include "skip_list_impl.h"
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef skip_list_impl_h
+#define skip_list_impl_h
+
+#include <new>
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline consume_skip_list<Key, Value, Compare, Flavor>::consume_skip_list()
+    : head(create_node(Key(), Value(), max_height))
+{
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline consume_skip_list<Key, Value, Compare, Flavor>::~consume_skip_list()
+{
+    for (node* n = head; n; ) {
+        node* next = n->next[0];
+        destroy_node(n);
+        n = next;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline typename consume_skip_list<Key, Value, Compare, Flavor>::node* consume_skip_list<Key, Value, Compare, Flavor>::create_node(const Key& key, const Value& value, unsigned height)
+{
+    void* memory = ::operator new(sizeof(node) + (height - 1) * sizeof(node*));
+    node* n = new (memory) node { key, value, height, { nullptr } };
+    for (unsigned level = 0; level != height; ++level)
+        n->next[level] = nullptr;
+    return n;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline void consume_skip_list<Key, Value, Compare, Flavor>::destroy_node(node* n)
+{
+    n->~node();
+    ::operator delete(n);
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline std::atomic<typename consume_skip_list<Key, Value, Compare, Flavor>::node*>& consume_skip_list<Key, Value, Compare, Flavor>::as_atomic(node*& link)
+{
+    static_assert(sizeof(node*) == sizeof(std::atomic<node*>), "The cast below relies on this fact");
+    return reinterpret_cast<std::atomic<node*>&>(link);
+}
+
+// The first node whose key isn't less than key, or null. The head is never
+// unpublished, so the walk starts without a dependency and picks one up on the
+// first hop.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline dependent_ptr<typename consume_skip_list<Key, Value, Compare, Flavor>::node> consume_skip_list<Key, Value, Compare, Flavor>::lower_bound(const Key& key) const
+{
+    dependent_ptr<node> x(head);
+    dependent_ptr<node> next(nullptr);
+    for (unsigned level = height.load(std::memory_order_relaxed); level--; ) {
+        for (;;) {
+            next = consume_load(dependent_ptr<node*>(&__pointer(x)->next[level], x.dependency()));
+            if (!__pointer(next) || !less(__pointer(next)->key, key))
+                break;
+            x = next;
+        }
+    }
+    return next;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline dependent_ptr<const Value> consume_skip_list<Key, Value, Compare, Flavor>::lookup(const Key& key) const
+{
+    dependent_ptr<node> n = lower_bound(key);
+    if (!__pointer(n) || less(key, __pointer(n)->key))
+        return nullptr;
+    return dependent_ptr<const Value>(&__pointer(n)->value, n.dependency());
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_skip_list<Key, Value, Compare, Flavor>::find(const Key& key, Value& out) const
+{
+    rcu_read_guard<Flavor> guard;
+    dependent_ptr<const Value> value = lookup(key);
+    if (!__pointer(value))
+        return false;
+    out = *__pointer(value);
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+template<typename Visitor>
+inline size_t consume_skip_list<Key, Value, Compare, Flavor>::scan(const Key& low, const Key& high, Visitor&& visit) const
+{
+    rcu_read_guard<Flavor> guard;
+    size_t visited = 0;
+    for (dependent_ptr<node> n = lower_bound(low); __pointer(n) && less(__pointer(n)->key, high); ++visited) {
+        visit(__pointer(n)->key, __pointer(n)->value);
+        n = consume_load(dependent_ptr<node*>(&__pointer(n)->next[0], n.dependency()));
+    }
+    return visited;
+}
+
+// Writers only. Fills preds with the last node before key at every level.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline void consume_skip_list<Key, Value, Compare, Flavor>::find_predecessors(const Key& key, node** preds) const
+{
+    node* x = head;
+    for (unsigned level = max_height; level--; ) {
+        while (x->next[level] && less(x->next[level]->key, key))
+            x = x->next[level];
+        preds[level] = x;
+    }
+}
+
+// Geometric with p = 1/4, which keeps towers short without hurting search.
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline unsigned consume_skip_list<Key, Value, Compare, Flavor>::random_height()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    unsigned h = 1 + count_trailing_zeros(rng | (uint64_t(1) << 63)) / 2;
+    return h < max_height ? h : max_height;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_skip_list<Key, Value, Compare, Flavor>::insert(const Key& key, const Value& value)
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    node* preds[max_height];
+    find_predecessors(key, preds);
+    node* existing = preds[0]->next[0];
+    if (existing && !less(key, existing->key))
+        return false;
+
+    unsigned h = random_height();
+    node* n = create_node(key, value, h);
+    for (unsigned level = 0; level != h; ++level)
+        n->next[level] = preds[level]->next[level];
+    for (unsigned level = 0; level != h; ++level)
+        as_atomic(preds[level]->next[level]).store(n, std::memory_order_release);
+    if (h > height.load(std::memory_order_relaxed))
+        height.store(h, std::memory_order_relaxed);
+    ++count;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline bool consume_skip_list<Key, Value, Compare, Flavor>::erase(const Key& key)
+{
+    node* n;
+    {
+        std::lock_guard<std::mutex> locker(writer_lock);
+        node* preds[max_height];
+        find_predecessors(key, preds);
+        n = preds[0]->next[0];
+        if (!n || less(key, n->key))
+            return false;
+        for (unsigned level = n->height; level--; )
+            as_atomic(preds[level]->next[level]).store(n->next[level], std::memory_order_release);
+        --count;
+    }
+    struct deferred : rcu_head {
+        node* n;
+    };
+    deferred* d = new deferred;
+    d->n = n;
+    call_rcu<Flavor>(d, [] (rcu_head* head) {
+            deferred* d = static_cast<deferred*>(head);
+            destroy_node(d->n);
+            delete d;
+        });
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Flavor>
+inline size_t consume_skip_list<Key, Value, Compare, Flavor>::size() const
+{
+    std::lock_guard<std::mutex> locker(writer_lock);
+    return count;
+}
+
+#endif
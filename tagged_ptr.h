@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef tagged_ptr_h
+#define tagged_ptr_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "consume.h"
+
+// Tagged pointers whose tag and pointer extraction stay in the dependency
+// chain, for lock-free stacks with ABA counters and lists which mark deleted
+// nodes in their next pointers (Harris-style deletion).
+//
+// A tagged pointer packs LowBits tag bits below the pointer, where T's alignment
+// leaves them clear, and TopBits more in the pointer's top byte. The tag is one
+// integer of LowBits + TopBits bits: its low LowBits bits are stored below the
+// pointer and the rest in the top byte.
+//
+// Tags and pointers are extracted by masking the consumed word, so both carry
+// its chain and readers need no acquire loads. On AArch64 Linux, where loads
+// ignore the top byte (TBI), operator-> doesn't bother clearing it.
+template<typename T, unsigned LowBits, unsigned TopBits = 0>
+class atomic_tagged_ptr;
+
+// The result of consuming an atomic_tagged_ptr.
+template<typename T, unsigned LowBits, unsigned TopBits = 0>
+class dependent_tagged_ptr {
+public:
+    static_assert(alignof(T) >= (size_t(1) << LowBits), "Low tag bits must be clear in T's alignment");
+    static_assert(TopBits <= 8, "At most the top byte can hold a tag");
+    static_assert(!TopBits || sizeof(uintptr_t) == 8, "Top-byte tags need 64-bit pointers");
+
+    static constexpr unsigned tag_bits = LowBits + TopBits;
+
+    // Packs a pointer and a tag, which is truncated to tag_bits.
+    static uintptr_t pack(T*, uintptr_t tag);
+
+    explicit dependent_tagged_ptr(dependent<uintptr_t>);
+
+    // The untagged pointer, which extends the chain.
+    dependent_ptr<T> ptr() const;
+
+    // The tag, which extends the chain.
+    dependent<uintptr_t> tag() const;
+
+    // For member access only: with TBI, the top byte may still be tagged.
+    T* operator->() const;
+
+    // The packed word, for compare-and-swap.
+    uintptr_t raw() const;
+
+    // A pure dependency from the packed word.
+    class dependency dependency() const;
+
+private:
+    static constexpr uintptr_t low_mask = (uintptr_t(1) << LowBits) - 1;
+    static constexpr unsigned top_shift = TopBits ? sizeof(uintptr_t) * 8 - TopBits : 0;
+    static constexpr uintptr_t top_mask = TopBits ? ~(~uintptr_t(0) >> TopBits) : 0;
+
+    // Compare-and-swap reads the word without it counting as an escape.
+    friend class atomic_tagged_ptr<T, LowBits, TopBits>;
+
+    dependent<uintptr_t> word;
+};
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+class atomic_tagged_ptr {
+public:
+    typedef dependent_tagged_ptr<T, LowBits, TopBits> dependent_type;
+
+    atomic_tagged_ptr(T* = nullptr, uintptr_t tag = 0);
+    atomic_tagged_ptr(const atomic_tagged_ptr&) = delete;
+    atomic_tagged_ptr& operator=(const atomic_tagged_ptr&) = delete;
+
+    // Publication: initializing stores to *ptr happen before readers can
+    // consume it.
+    void store(T*, uintptr_t tag, std::memory_order = std::memory_order_release);
+
+    // Replaces the pointer and tag if the word still holds expected. Succeeds
+    // with release semantics, so that a new pointer is published.
+    bool compare_exchange(const dependent_type& expected, T*, uintptr_t tag);
+
+    // Replaces only the tag, for example to mark a node's next pointer.
+    bool compare_exchange_tag(const dependent_type& expected, uintptr_t tag);
+
+    // Sets low tag bits unconditionally, returning the previous word.
+    uintptr_t fetch_or_low_tag(uintptr_t bits);
+
+private:
+    template<typename U, unsigned L, unsigned H> friend dependent_tagged_ptr<U, L, H> consume_load(const atomic_tagged_ptr<U, L, H>&);
+    template<typename U, unsigned L, unsigned H> friend dependent_tagged_ptr<U, L, H> consume_load(const atomic_tagged_ptr<U, L, H>*, dependency);
+
+    std::atomic<uintptr_t> word;
+};
+
+// Beginning of a chain.
+template<typename T, unsigned LowBits, unsigned TopBits>
+dependent_tagged_ptr<T, LowBits, TopBits> consume_load(const atomic_tagged_ptr<T, LowBits, TopBits>&);
+
+// A tagged pointer reached through a dependency, such as a node's next field.
+// Both constnesses are needed to win over consume_load(T*, dependency).
+template<typename T, unsigned LowBits, unsigned TopBits>
+dependent_tagged_ptr<T, LowBits, TopBits> consume_load(const atomic_tagged_ptr<T, LowBits, TopBits>*, dependency);
+template<typename T, unsigned LowBits, unsigned TopBits>
+dependent_tagged_ptr<T, LowBits, TopBits> consume_load(atomic_tagged_ptr<T, LowBits, TopBits>*, dependency);
+
+#include "tagged_ptr_impl.h"
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef tagged_ptr_impl_h
+#define tagged_ptr_impl_h
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline uintptr_t dependent_tagged_ptr<T, LowBits, TopBits>::pack(T* ptr, uintptr_t tag)
+{
+    uintptr_t bits = reinterpret_cast<uintptr_t>(ptr) | (tag & low_mask);
+    if (TopBits)
+        bits |= ((tag >> LowBits) << top_shift) & top_mask;
+    return bits;
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent_tagged_ptr<T, LowBits, TopBits>::dependent_tagged_ptr(dependent<uintptr_t> word) : word(word) {}
+
+// Masking the word keeps the result in its chain.
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent_ptr<T> dependent_tagged_ptr<T, LowBits, TopBits>::ptr() const
+{
+    return dependent_ptr<T>(dependent<uintptr_t>(__value(word) & ~(low_mask | top_mask)));
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent<uintptr_t> dependent_tagged_ptr<T, LowBits, TopBits>::tag() const
+{
+    uintptr_t bits = __value(word) & low_mask;
+    if (TopBits)
+        bits |= (__value(word) >> top_shift) << LowBits;
+    return dependent<uintptr_t>(bits);
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline T* dependent_tagged_ptr<T, LowBits, TopBits>::operator->() const
+{
+    CONSUME_RECORD(arrow_escape);
+#if CPU(ARM64) && OS(LINUX)
+    return reinterpret_cast<T*>(__value(word) & ~low_mask);
+#else
+    return __pointer(ptr());
+#endif
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline uintptr_t dependent_tagged_ptr<T, LowBits, TopBits>::raw() const { CONSUME_RECORD(value_escape); return __value(word); }
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline class dependency dependent_tagged_ptr<T, LowBits, TopBits>::dependency() const { return word.dependency(); }
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline atomic_tagged_ptr<T, LowBits, TopBits>::atomic_tagged_ptr(T* ptr, uintptr_t tag)
+    : word(dependent_type::pack(ptr, tag))
+{
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline void atomic_tagged_ptr<T, LowBits, TopBits>::store(T* ptr, uintptr_t tag, std::memory_order order)
+{
+    word.store(dependent_type::pack(ptr, tag), order);
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline bool atomic_tagged_ptr<T, LowBits, TopBits>::compare_exchange(const dependent_type& expected, T* ptr, uintptr_t tag)
+{
+    uintptr_t old = __value(expected.word);
+    return word.compare_exchange_strong(old, dependent_type::pack(ptr, tag), std::memory_order_release, std::memory_order_relaxed);
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline bool atomic_tagged_ptr<T, LowBits, TopBits>::compare_exchange_tag(const dependent_type& expected, uintptr_t tag)
+{
+    return compare_exchange(expected, __pointer(expected.ptr()), tag);
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline uintptr_t atomic_tagged_ptr<T, LowBits, TopBits>::fetch_or_low_tag(uintptr_t bits)
+{
+    static_assert(LowBits > 0, "There are no low tag bits");
+    return word.fetch_or(bits & ((uintptr_t(1) << LowBits) - 1), std::memory_order_release);
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent_tagged_ptr<T, LowBits, TopBits> consume_load(const atomic_tagged_ptr<T, LowBits, TopBits>& atom)
+{
+    CONSUME_RECORD(load_atomic_pointer);
+    return dependent_tagged_ptr<T, LowBits, TopBits>(dependent<uintptr_t>(__consume_load_value(atom.word)));
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent_tagged_ptr<T, LowBits, TopBits> consume_load(const atomic_tagged_ptr<T, LowBits, TopBits>* atom, dependency dep)
+{
+    CONSUME_RECORD(load_pointer_with_dependency);
+    uintptr_t* word = reinterpret_cast<uintptr_t*>(const_cast<std::atomic<uintptr_t>*>(&atom->word));
+    return dependent_tagged_ptr<T, LowBits, TopBits>(__consume_load_through(dependent_ptr<uintptr_t>(word, dep)));
+}
+
+template<typename T, unsigned LowBits, unsigned TopBits>
+inline dependent_tagged_ptr<T, LowBits, TopBits> consume_load(atomic_tagged_ptr<T, LowBits, TopBits>* atom, dependency dep)
+{
+    return consume_load(static_cast<const atomic_tagged_ptr<T, LowBits, TopBits>*>(atom), dep);
+}
+
+#endif
@@ -0,0 +1,21 @@
+# Cross-compiles for little-endian 64-bit POWER and runs the tests under qemu-user:
+#
+#   cmake -S . -B build-ppc64le -DCMAKE_TOOLCHAIN_FILE=toolchains/powerpc64le-linux-gnu.cmake
+#   cmake --build build-ppc64le && ctest --test-dir build-ppc64le
+#
+# Needs the powerpc64le-linux-gnu cross compiler and binutils, and
+# qemu-ppc64le. Debian and Ubuntu package them as g++-powerpc64le-linux-gnu,
+# binutils-powerpc64le-linux-gnu and qemu-user.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR ppc64le)
+
+set(CMAKE_CXX_COMPILER powerpc64le-linux-gnu-g++)
+set(CMAKE_OBJDUMP powerpc64le-linux-gnu-objdump CACHE FILEPATH "")
+
+set(CMAKE_FIND_ROOT_PATH /usr/powerpc64le-linux-gnu)
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+set(CMAKE_CROSSCOMPILING_EMULATOR qemu-ppc64le -L /usr/powerpc64le-linux-gnu)
@@ -0,0 +1,21 @@
+# Cross-compiles for 64-bit RISC-V and runs the tests under qemu-user:
+#
+#   cmake -S . -B build-riscv64 -DCMAKE_TOOLCHAIN_FILE=toolchains/riscv64-linux-gnu.cmake
+#   cmake --build build-riscv64 && ctest --test-dir build-riscv64
+#
+# Needs the riscv64-linux-gnu cross compiler and binutils, and
+# qemu-riscv64. Debian and Ubuntu package them as g++-riscv64-linux-gnu,
+# binutils-riscv64-linux-gnu and qemu-user.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR riscv64)
+
+set(CMAKE_CXX_COMPILER riscv64-linux-gnu-g++)
+set(CMAKE_OBJDUMP riscv64-linux-gnu-objdump CACHE FILEPATH "")
+
+set(CMAKE_FIND_ROOT_PATH /usr/riscv64-linux-gnu)
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+set(CMAKE_CROSSCOMPILING_EMULATOR qemu-riscv64 -L /usr/riscv64-linux-gnu)